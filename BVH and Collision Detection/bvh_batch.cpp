@@ -0,0 +1,152 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_batch.hpp"
+
+#include "bvh_bounds.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace bvh {
+namespace {
+
+/**
+ * Estimated cost of a pair: the volume of the overlap of the root boxes in world space. Negative if the boxes do not
+ * overlap (or a tree is empty), the pair has no contacts then. Flat models have overlaps of no volume, they are
+ * still tested and only come last.
+ */
+float estimate_cost(const CollisionPair& pair)
+{
+    if ( pair.first.empty() || pair.second.empty() )
+    {
+        return -1.0f;
+    }
+
+    const FlatNode& firstRoot = pair.first.nodes[0];
+    const FlatNode& secondRoot = pair.second.nodes[0];
+    Aabb first = transform(pair.first_matrix, Aabb(firstRoot.min, firstRoot.max));
+    Aabb second = transform(pair.second_matrix, Aabb(secondRoot.min, secondRoot.max));
+    if ( !overlaps(first, second) )
+    {
+        return -1.0f;
+    }
+
+    glm::vec3 extent = glm::min(first.max, second.max) - glm::max(first.min, second.min);
+    return extent.x * extent.y * extent.z;
+}
+
+} // namespace
+
+size_t collide_batch(ArrayView<CollisionPair> pairs, BatchContacts& out, const QuerySettings& settings)
+{
+    unsigned threads = ThreadPool::resolve_thread_count(settings.threads);
+    if ( threads > 1 )
+    {
+        ThreadPool pool(threads - 1);
+        return collide_batch(pairs, out, pool, settings);
+    }
+
+    out.clear();
+    out.offsets.reserve(pairs.size() + 1);
+    out.offsets.push_back(0);
+
+    QueryStats pairStats;
+    QuerySettings pairSettings = settings;
+    pairSettings.stats = settings.stats != nullptr ? &pairStats : nullptr;
+    if ( settings.stats != nullptr )
+    {
+        *settings.stats = QueryStats();
+    }
+
+    ContactBuffer buffer;
+    for ( const CollisionPair& pair : pairs )
+    {
+        collide(pair.first, pair.first_matrix, pair.second, pair.second_matrix, buffer, pairSettings);
+        out.contacts.insert(out.contacts.end(), buffer.contacts.begin(), buffer.contacts.end());
+        out.offsets.push_back(out.contacts.size());
+        if ( settings.stats != nullptr )
+        {
+            settings.stats->merge(pairStats);
+        }
+    }
+
+    return out.contacts.size();
+}
+
+size_t collide_batch(ArrayView<CollisionPair> pairs, BatchContacts& out, ThreadPool& pool,
+                     const QuerySettings& settings)
+{
+    out.clear();
+    if ( settings.stats != nullptr )
+    {
+        *settings.stats = QueryStats();
+    }
+
+    std::vector<float> costs(pairs.size());
+    std::vector<uint32_t> order;
+    order.reserve(pairs.size());
+    float totalCost = 0.0f;
+    for ( size_t i = 0; i < pairs.size(); ++i )
+    {
+        costs[i] = estimate_cost(pairs[i]);
+        if ( costs[i] >= 0.0f )
+        {
+            order.push_back(static_cast<uint32_t>(i));
+            totalCost += costs[i];
+        }
+    }
+
+    // the most expensive pairs first, ties in pair order so that the schedule does not depend on the sort
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return costs[a] != costs[b] ? costs[a] > costs[b] : a < b;
+    });
+    float splitCost = totalCost / static_cast<float>(pool.get_concurrency());
+
+    std::vector<ContactBuffer> buffers(pairs.size());
+    std::vector<QueryStats> pairStats(settings.stats != nullptr ? pairs.size() : 0);
+
+    parallel_for(pool, 0, order.size(), 1, [&](size_t index, size_t) {
+        uint32_t i = order[index];
+        const CollisionPair& pair = pairs[i];
+
+        QuerySettings pairSettings = settings;
+        pairSettings.stats = settings.stats != nullptr ? &pairStats[i] : nullptr;
+        if ( costs[i] > splitCost )
+        {
+            collide(pair.first, pair.first_matrix, pair.second, pair.second_matrix, buffers[i], pool, pairSettings);
+        }
+        else
+        {
+            pairSettings.threads = 1;
+            collide(pair.first, pair.first_matrix, pair.second, pair.second_matrix, buffers[i], pairSettings);
+        }
+    });
+
+    for ( const QueryStats& stats : pairStats )
+    {
+        settings.stats->merge(stats);
+    }
+
+    size_t total = 0;
+    for ( const ContactBuffer& buffer : buffers )
+    {
+        total += buffer.contacts.size();
+    }
+    out.offsets.reserve(pairs.size() + 1);
+    out.contacts.reserve(total);
+    out.offsets.push_back(0);
+    for ( const ContactBuffer& buffer : buffers )
+    {
+        out.contacts.insert(out.contacts.end(), buffer.contacts.begin(), buffer.contacts.end());
+        out.offsets.push_back(out.contacts.size());
+    }
+
+    return out.contacts.size();
+}
+
+} // namespace bvh
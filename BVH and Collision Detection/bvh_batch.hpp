@@ -0,0 +1,77 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_flat.hpp"
+#include "bvh_query.hpp"
+#include "bvh_thread_pool.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace bvh {
+
+/** Two placed models tested by collide_batch, for example a candidate pair found by a broadphase. */
+struct CollisionPair
+{
+    FlatBVHView first;
+    glm::mat4 first_matrix = glm::mat4(1.0f);
+    FlatBVHView second;
+    glm::mat4 second_matrix = glm::mat4(1.0f);
+};
+
+/**
+ * Output of collide_batch. The contacts of all pairs are stored in one array in the order of the pairs; the contacts
+ * of pair i are contacts[offsets[i]] to contacts[offsets[i + 1]] (exclusive), so there is one offset more than there
+ * are pairs. The buffer keeps its capacity from one query to the next.
+ */
+struct BatchContacts
+{
+    std::vector<size_t> offsets;
+    std::vector<ContactPair> contacts;
+
+    void clear()
+    {
+        offsets.clear();
+        contacts.clear();
+    }
+
+    size_t contact_count(size_t pair) const { return offsets[pair + 1] - offsets[pair]; }
+
+    /** The first contact of the pair, followed by the other contact_count(pair) - 1 ones. */
+    const ContactPair* pair_contacts(size_t pair) const { return contacts.data() + offsets[pair]; }
+};
+
+/**
+ * Runs collide on every pair of the list and stores the contacts of all of them in one buffer. With settings.threads
+ * other than 1 the pairs are shared by the threads as in the pool version below.
+ *
+ * @param 	pairs   	The model pairs; the trees must stay alive until the query returns.
+ * @param 	out     	The contacts of all pairs, cleared first.
+ * @param 	settings	The options of the per pair queries. settings.stats receives the sum over all pairs.
+ * @return	The total number of contacts.
+ */
+size_t collide_batch(ArrayView<CollisionPair> pairs, BatchContacts& out,
+                     const QuerySettings& settings = QuerySettings());
+
+/**
+ * Parallel collide_batch running on the given pool (settings.threads is ignored). The cost of every pair is estimated
+ * by the volume in which the world space boxes of its two roots overlap; pairs whose root boxes do not overlap cannot
+ * collide and are skipped, the others are started in order of decreasing estimate, so that an expensive pair does not
+ * start last and keep all other threads waiting. A pair estimated at more than the share of one thread runs the
+ * parallel collide on the same pool, whose tasks idle threads steal once the cheap pairs run out.
+ *
+ * Every pair writes into a buffer of its own, the buffers are concatenated in pair order at the end, so the output is
+ * the same as of the serial query (up to the subset of contacts found for large pairs with settings.max_hits set, see
+ * QuerySettings::threads).
+ */
+size_t collide_batch(ArrayView<CollisionPair> pairs, BatchContacts& out, ThreadPool& pool,
+                     const QuerySettings& settings = QuerySettings());
+
+} // namespace bvh
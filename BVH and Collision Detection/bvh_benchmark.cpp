@@ -0,0 +1,698 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+/*
+ * Standalone benchmark of the BVH builds and the collision query, built as its own executable next to the
+ * application (this file has a main and no Application):
+ *
+ *     bvh_benchmark [--mesh <file.ply|file.obj>]... [--repeat <n>] [--json <file>] [--no-generated]
+ *
+ * Every mesh (the generated reference scenes and the given files, e.g. the Stanford models) is built with every
+ * configuration of split strategy, depth budget (and with it the leaf size) and thread count. Each configuration
+ * reports the build time, the tree size and SAH cost, and a collision query of the mesh against a moved copy of
+ * itself: its time, its QueryStats counters and the contacts found. Times are the best of --repeat runs. The table
+ * goes to the standard output, --json additionally writes all results to a file for comparing runs.
+ */
+
+#include "application.hpp"
+#include "bvh_build.hpp"
+#include "bvh_query.hpp"
+#include "bvh_thread_pool.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double milliseconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/** A named triangle soup owning its triangles. */
+struct Mesh
+{
+    std::string name;
+    std::vector<std::unique_ptr<Triangle>> storage;
+    std::vector<Triangle*> triangles;
+
+    void add(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+    {
+        storage.push_back(std::make_unique<Triangle>(glm::vec4(a, 1.0f), glm::vec4(b, 1.0f), glm::vec4(c, 1.0f)));
+        triangles.push_back(storage.back().get());
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Reference scenes
+// ----------------------------------------------------------------------------
+
+/** Small triangles scattered uniformly in a cube, the easy case for every strategy. */
+Mesh random_soup(size_t count, unsigned seed)
+{
+    Mesh mesh;
+    mesh.name = "soup-" + std::to_string(count);
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(0.0f, 10.0f);
+    std::uniform_real_distribution<float> offset(-0.15f, 0.15f);
+    for ( size_t i = 0; i < count; ++i )
+    {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        auto vertex = [&]() { return center + glm::vec3(offset(rng), offset(rng), offset(rng)); };
+        glm::vec3 a = vertex(), b = vertex(), c = vertex();
+        mesh.add(a, b, c);
+    }
+    return mesh;
+}
+
+/**
+ * Long thin triangles spanning most of the scene along random axes. Their boxes overlap heavily, so midpoint splits
+ * degrade and the fallbacks and the SAH have to do the work.
+ */
+Mesh slivers(size_t count, unsigned seed)
+{
+    Mesh mesh;
+    mesh.name = "slivers-" + std::to_string(count);
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(0.0f, 10.0f);
+    std::uniform_real_distribution<float> width(0.001f, 0.01f);
+    std::uniform_int_distribution<int> axis(0, 2);
+    for ( size_t i = 0; i < count; ++i )
+    {
+        glm::vec3 start(position(rng), position(rng), position(rng));
+        glm::vec3 end = start;
+        int along = axis(rng);
+        start[along] = 0.0f;
+        end[along] = 10.0f;
+        glm::vec3 side(0.0f);
+        side[(along + 1) % 3] = width(rng);
+        mesh.add(start, end, start + side);
+    }
+    return mesh;
+}
+
+/** A finely tessellated sphere, a closed smooth surface standing in for the scanned models. */
+Mesh sphere(int rings, int segments)
+{
+    Mesh mesh;
+    mesh.name = "sphere-" + std::to_string(2 * rings * segments);
+    const float pi = 3.14159265358979f;
+    auto point = [&](int ring, int segment) {
+        float theta = pi * ring / rings;
+        float phi = 2.0f * pi * segment / segments;
+        return glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)) * 5.0f;
+    };
+    for ( int ring = 0; ring < rings; ++ring )
+    {
+        for ( int segment = 0; segment < segments; ++segment )
+        {
+            glm::vec3 a = point(ring, segment), b = point(ring + 1, segment);
+            glm::vec3 c = point(ring + 1, segment + 1), d = point(ring, segment + 1);
+            mesh.add(a, b, c);
+            mesh.add(a, c, d);
+        }
+    }
+    return mesh;
+}
+
+// ----------------------------------------------------------------------------
+// Mesh files
+// ----------------------------------------------------------------------------
+
+std::string file_name(const std::string& path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+/** Adds the polygon as a triangle fan, dropping polygons with invalid indices. */
+void add_polygon(Mesh& mesh, const std::vector<glm::vec3>& vertices, const std::vector<long long>& polygon)
+{
+    for ( long long index : polygon )
+    {
+        if ( index < 0 || index >= static_cast<long long>(vertices.size()) )
+        {
+            return;
+        }
+    }
+    for ( size_t i = 2; i < polygon.size(); ++i )
+    {
+        mesh.add(vertices[polygon[0]], vertices[polygon[i - 1]], vertices[polygon[i]]);
+    }
+}
+
+/** Wavefront OBJ, only the positions and faces are read. */
+bool load_obj(const std::string& path, Mesh& mesh)
+{
+    std::ifstream in(path);
+    if ( !in )
+    {
+        return false;
+    }
+
+    std::vector<glm::vec3> vertices;
+    std::vector<long long> polygon;
+    std::string line;
+    while ( std::getline(in, line) )
+    {
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+        if ( keyword == "v" )
+        {
+            glm::vec3 v(0.0f);
+            words >> v.x >> v.y >> v.z;
+            vertices.push_back(v);
+        }
+        else if ( keyword == "f" )
+        {
+            // "f a b c", "f a/t b/t c/t" or "f a/t/n ..."; negative indices count from the last vertex
+            polygon.clear();
+            std::string corner;
+            while ( words >> corner )
+            {
+                long long index = std::atoll(corner.c_str());
+                polygon.push_back(index < 0 ? static_cast<long long>(vertices.size()) + index : index - 1);
+            }
+            add_polygon(mesh, vertices, polygon);
+        }
+    }
+    return !mesh.triangles.empty();
+}
+
+/** Size in bytes of a PLY scalar type, 0 if unknown. */
+size_t ply_type_size(const std::string& type)
+{
+    if ( type == "char" || type == "uchar" || type == "int8" || type == "uint8" )
+    {
+        return 1;
+    }
+    if ( type == "short" || type == "ushort" || type == "int16" || type == "uint16" )
+    {
+        return 2;
+    }
+    if ( type == "int" || type == "uint" || type == "float" || type == "int32" || type == "uint32" ||
+         type == "float32" )
+    {
+        return 4;
+    }
+    if ( type == "double" || type == "float64" )
+    {
+        return 8;
+    }
+    return 0;
+}
+
+/** Reads one little endian binary PLY scalar as a double. */
+double read_ply_scalar(const char* data, const std::string& type)
+{
+    auto read = [data](auto value) {
+        std::memcpy(&value, data, sizeof(value));
+        return static_cast<double>(value);
+    };
+    if ( type == "char" || type == "int8" )
+    {
+        return read(int8_t());
+    }
+    if ( type == "uchar" || type == "uint8" )
+    {
+        return read(uint8_t());
+    }
+    if ( type == "short" || type == "int16" )
+    {
+        return read(int16_t());
+    }
+    if ( type == "ushort" || type == "uint16" )
+    {
+        return read(uint16_t());
+    }
+    if ( type == "int" || type == "int32" )
+    {
+        return read(int32_t());
+    }
+    if ( type == "uint" || type == "uint32" )
+    {
+        return read(uint32_t());
+    }
+    if ( type == "float" || type == "float32" )
+    {
+        return read(float());
+    }
+    return read(double());
+}
+
+/**
+ * Stanford PLY in the ascii or the binary little endian format, as the Stanford repository distributes its models.
+ * Only the x, y, z vertex properties and the face index lists are read.
+ */
+bool load_ply(const std::string& path, Mesh& mesh)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::string line;
+    if ( !in || !std::getline(in, line) || line.compare(0, 3, "ply") != 0 )
+    {
+        return false;
+    }
+
+    struct Property
+    {
+        std::string name;
+        std::string type;
+        // list properties: the types of the count and of the items
+        std::string count_type;
+    };
+    struct Element
+    {
+        std::string name;
+        size_t count = 0;
+        std::vector<Property> properties;
+    };
+
+    std::vector<Element> elements;
+    bool binary = false;
+    while ( std::getline(in, line) )
+    {
+        if ( !line.empty() && line.back() == '\r' )
+        {
+            line.pop_back();
+        }
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+        if ( keyword == "format" )
+        {
+            std::string format;
+            words >> format;
+            if ( format == "binary_big_endian" )
+            {
+                return false;
+            }
+            binary = format == "binary_little_endian";
+        }
+        else if ( keyword == "element" )
+        {
+            Element element;
+            words >> element.name >> element.count;
+            elements.push_back(element);
+        }
+        else if ( keyword == "property" && !elements.empty() )
+        {
+            Property property;
+            words >> property.type;
+            if ( property.type == "list" )
+            {
+                words >> property.count_type >> property.type;
+            }
+            words >> property.name;
+            elements.back().properties.push_back(property);
+        }
+        else if ( keyword == "end_header" )
+        {
+            break;
+        }
+    }
+
+    std::vector<glm::vec3> vertices;
+    std::vector<long long> polygon;
+    std::vector<char> buffer;
+    for ( const Element& element : elements )
+    {
+        for ( size_t item = 0; item < element.count; ++item )
+        {
+            glm::vec3 position(0.0f);
+            polygon.clear();
+            for ( const Property& property : element.properties )
+            {
+                bool isList = !property.count_type.empty();
+                bool isIndexList = isList && (property.name == "vertex_indices" || property.name == "vertex_index");
+                size_t count = 1;
+                if ( isList )
+                {
+                    double listCount;
+                    if ( binary )
+                    {
+                        buffer.resize(8);
+                        in.read(buffer.data(), static_cast<std::streamsize>(ply_type_size(property.count_type)));
+                        listCount = read_ply_scalar(buffer.data(), property.count_type);
+                    }
+                    else
+                    {
+                        in >> listCount;
+                    }
+                    count = static_cast<size_t>(listCount);
+                }
+
+                for ( size_t i = 0; i < count; ++i )
+                {
+                    double value;
+                    if ( binary )
+                    {
+                        size_t size = ply_type_size(property.type);
+                        if ( size == 0 )
+                        {
+                            return false;
+                        }
+                        buffer.resize(8);
+                        in.read(buffer.data(), static_cast<std::streamsize>(size));
+                        value = read_ply_scalar(buffer.data(), property.type);
+                    }
+                    else
+                    {
+                        in >> value;
+                    }
+
+                    if ( isIndexList )
+                    {
+                        polygon.push_back(static_cast<long long>(value));
+                    }
+                    else if ( element.name == "vertex" && !isList && property.name.size() == 1 &&
+                              property.name[0] >= 'x' && property.name[0] <= 'z' )
+                    {
+                        position[property.name[0] - 'x'] = static_cast<float>(value);
+                    }
+                }
+            }
+
+            if ( !in )
+            {
+                return false;
+            }
+            if ( element.name == "vertex" )
+            {
+                vertices.push_back(position);
+            }
+            else if ( element.name == "face" )
+            {
+                add_polygon(mesh, vertices, polygon);
+            }
+        }
+    }
+    return !mesh.triangles.empty();
+}
+
+bool load_mesh(const std::string& path, Mesh& mesh)
+{
+    mesh.name = file_name(path);
+    std::string extension = path.size() >= 4 ? path.substr(path.size() - 4) : std::string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if ( extension == ".ply" )
+    {
+        return load_ply(path, mesh);
+    }
+    if ( extension == ".obj" )
+    {
+        return load_obj(path, mesh);
+    }
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+// Measurements
+// ----------------------------------------------------------------------------
+
+struct Configuration
+{
+    bvh::SplitStrategy strategy;
+    /** The depth budget, which bounds the leaf sizes from below on large models. */
+    int max_depth;
+    unsigned threads;
+};
+
+struct Result
+{
+    std::string mesh;
+    size_t triangles = 0;
+    Configuration configuration;
+
+    double build_milliseconds = 0.0;
+    size_t nodes = 0;
+    size_t leaves = 0;
+    float sah_cost = 0.0f;
+
+    double query_milliseconds = 0.0;
+    bvh::QueryStats stats;
+    size_t contacts = 0;
+};
+
+/** The pose of the second copy in the collision query: turned and shifted so that about half of it overlaps. */
+glm::mat4 query_pose(const bvh::FlatBVH& bvh)
+{
+    const bvh::FlatNode& root = bvh.nodes[0];
+    glm::vec3 extent = root.max - root.min;
+    glm::vec3 center = (root.min + root.max) * 0.5f;
+    glm::mat4 pose(1.0f);
+    pose = glm::translate(pose, center + glm::vec3(extent.x * 0.25f, extent.y * 0.1f, 0.0f));
+    pose = glm::rotate(pose, 0.4f, glm::vec3(0.0f, 1.0f, 0.0f));
+    return glm::translate(pose, -center);
+}
+
+Result measure(const Mesh& mesh, const Configuration& configuration, int repeat)
+{
+    Result result;
+    result.mesh = mesh.name;
+    result.triangles = mesh.triangles.size();
+    result.configuration = configuration;
+
+    bvh::BuildSettings settings;
+    settings.strategy = configuration.strategy;
+    settings.max_depth = configuration.max_depth;
+    settings.threads = configuration.threads;
+
+    // the parallel runs share one pool started before the clocks, so that no timed run starts or joins threads
+    unsigned threads = bvh::ThreadPool::resolve_thread_count(configuration.threads);
+    std::unique_ptr<bvh::ThreadPool> pool;
+    if ( threads > 1 )
+    {
+        pool = std::make_unique<bvh::ThreadPool>(threads - 1);
+    }
+
+    bvh::FlatBVH bvh;
+    result.build_milliseconds = 1e30;
+    for ( int i = 0; i < repeat; ++i )
+    {
+        Clock::time_point start = Clock::now();
+        bvh = pool != nullptr ? bvh::construct_flat(mesh.triangles, settings, *pool)
+                              : bvh::construct_flat(mesh.triangles, settings);
+        result.build_milliseconds = std::min(result.build_milliseconds, milliseconds_since(start));
+    }
+
+    bvh::BuildReport report = bvh::evaluate(bvh, settings);
+    result.nodes = report.node_count;
+    result.leaves = report.leaf_count;
+    result.sah_cost = report.sah_cost;
+
+    glm::mat4 identity(1.0f);
+    glm::mat4 pose = query_pose(bvh);
+    bvh::QuerySettings query;
+    query.threads = configuration.threads;
+    bvh::ContactBuffer contacts;
+    auto collide = [&]() {
+        if ( pool != nullptr )
+        {
+            bvh::collide(bvh, identity, bvh, pose, contacts, *pool, query);
+        }
+        else
+        {
+            bvh::collide(bvh, identity, bvh, pose, contacts, query);
+        }
+    };
+
+    result.query_milliseconds = 1e30;
+    for ( int i = 0; i < repeat; ++i )
+    {
+        Clock::time_point start = Clock::now();
+        collide();
+        result.query_milliseconds = std::min(result.query_milliseconds, milliseconds_since(start));
+    }
+    result.contacts = contacts.contacts.size();
+
+    // the work done by the query, counted on an extra run so that the timed ones count nothing
+    query.stats = &result.stats;
+    collide();
+
+    return result;
+}
+
+// ----------------------------------------------------------------------------
+// Output
+// ----------------------------------------------------------------------------
+
+void print_header()
+{
+    std::printf("%-22s %9s %-13s %5s %4s %10s %9s %9s %10s %12s %14s %10s\n", "mesh", "triangles", "strategy",
+                "depth", "thr", "build ms", "nodes", "SAH", "query ms", "node pairs", "triangle tests", "contacts");
+}
+
+void print_result(const Result& r)
+{
+    std::printf("%-22s %9zu %-13s %5d %4u %10.2f %9zu %9.1f %10.3f %12zu %14zu %10zu\n", r.mesh.c_str(), r.triangles,
+                bvh::to_string(r.configuration.strategy), r.configuration.max_depth,
+                r.configuration.threads, r.build_milliseconds, r.nodes, r.sah_cost, r.query_milliseconds,
+                r.stats.node_pairs, r.stats.triangle_tests, r.contacts);
+}
+
+std::string json_string(const std::string& text)
+{
+    std::string quoted = "\"";
+    for ( char c : text )
+    {
+        if ( c == '"' || c == '\\' )
+        {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if ( static_cast<unsigned char>(c) < 0x20 )
+        {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        }
+        else
+        {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+void write_json(std::ostream& out, const std::vector<Result>& results)
+{
+    out << "{\n  \"results\": [\n";
+    for ( size_t i = 0; i < results.size(); ++i )
+    {
+        const Result& r = results[i];
+        out << "    {\"mesh\": " << json_string(r.mesh) << ", \"triangles\": " << r.triangles
+            << ", \"strategy\": " << json_string(bvh::to_string(r.configuration.strategy))
+            << ", \"max_depth\": " << r.configuration.max_depth
+            << ", \"threads\": " << r.configuration.threads << ", \"build_ms\": " << r.build_milliseconds
+            << ", \"nodes\": " << r.nodes << ", \"leaves\": " << r.leaves << ", \"sah_cost\": " << r.sah_cost
+            << ", \"query_ms\": " << r.query_milliseconds << ", \"box_tests\": " << r.stats.box_tests
+            << ", \"node_pairs\": " << r.stats.node_pairs << ", \"leaf_pairs\": " << r.stats.leaf_pairs
+            << ", \"triangle_tests\": " << r.stats.triangle_tests
+            << ", \"max_stack_depth\": " << r.stats.max_stack_depth << ", \"contacts\": " << r.contacts << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+void print_usage()
+{
+    std::fprintf(stderr, "usage: bvh_benchmark [--mesh <file.ply|file.obj>]... [--repeat <n>] [--json <file>] "
+                         "[--no-generated]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> meshPaths;
+    std::string jsonPath;
+    int repeat = 3;
+    bool generated = true;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        std::string argument = argv[i];
+        if ( argument == "--mesh" && i + 1 < argc )
+        {
+            meshPaths.push_back(argv[++i]);
+        }
+        else if ( argument == "--json" && i + 1 < argc )
+        {
+            jsonPath = argv[++i];
+        }
+        else if ( argument == "--repeat" && i + 1 < argc )
+        {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        }
+        else if ( argument == "--no-generated" )
+        {
+            generated = false;
+        }
+        else
+        {
+            print_usage();
+            return 1;
+        }
+    }
+
+    std::vector<Mesh> meshes;
+    if ( generated )
+    {
+        meshes.push_back(random_soup(100000, 1));
+        meshes.push_back(slivers(5000, 2));
+        meshes.push_back(sphere(256, 256));
+    }
+    for ( const std::string& path : meshPaths )
+    {
+        Mesh mesh;
+        if ( !load_mesh(path, mesh) )
+        {
+            std::fprintf(stderr, "could not load %s\n", path.c_str());
+            return 1;
+        }
+        meshes.push_back(std::move(mesh));
+    }
+    if ( meshes.empty() )
+    {
+        print_usage();
+        return 1;
+    }
+
+    std::vector<unsigned> threadCounts{ 1 };
+    unsigned hardwareThreads = bvh::ThreadPool::resolve_thread_count(0);
+    if ( hardwareThreads > 1 )
+    {
+        threadCounts.push_back(hardwareThreads);
+    }
+
+    std::vector<Result> results;
+    print_header();
+    for ( const Mesh& mesh : meshes )
+    {
+        for ( bvh::SplitStrategy strategy :
+              { bvh::SplitStrategy::Midpoint, bvh::SplitStrategy::ObjectMedian, bvh::SplitStrategy::BinnedSAH } )
+        {
+            for ( int maxDepth : { 10, 15, 20 } )
+            {
+                for ( unsigned threads : threadCounts )
+                {
+                    results.push_back(measure(mesh, Configuration{ strategy, maxDepth, threads }, repeat));
+                    print_result(results.back());
+                }
+            }
+        }
+    }
+
+    if ( !jsonPath.empty() )
+    {
+        std::ofstream out(jsonPath);
+        write_json(out, results);
+        if ( !out )
+        {
+            std::fprintf(stderr, "could not write %s\n", jsonPath.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,318 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace bvh {
+
+/**
+ * Axis aligned bounding box in the local space of a model. Starts out empty (inverted) so that the first grow()
+ * call initializes it.
+ */
+struct Aabb
+{
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    Aabb() = default;
+    Aabb(const glm::vec3& min_point, const glm::vec3& max_point) : min(min_point), max(max_point) {}
+
+    void grow(const glm::vec3& point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void grow(const Aabb& other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    bool is_empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+    glm::vec3 extent() const { return max - min; }
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+
+    float surface_area() const
+    {
+        if ( is_empty() )
+        {
+            return 0.0f;
+        }
+        glm::vec3 e = extent();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    /** Index of the longest axis; ties prefer x over y over z, the same order construct always used. */
+    int longest_axis() const
+    {
+        glm::vec3 e = glm::abs(extent());
+        if ( e.x >= e.y && e.x >= e.z )
+        {
+            return 0;
+        }
+        else if ( e.y >= e.x && e.y >= e.z )
+        {
+            return 1;
+        }
+        return 2;
+    }
+};
+
+/** Bounds of a single triangle (w components are ignored). */
+inline Aabb triangle_bounds(const Triangle& triangle)
+{
+    Aabb bounds;
+    bounds.grow(glm::vec3(triangle.v1));
+    bounds.grow(glm::vec3(triangle.v2));
+    bounds.grow(glm::vec3(triangle.v3));
+    return bounds;
+}
+
+/** Local space bounds stored in a framework node. */
+inline Aabb node_bounds(BVHNode& node)
+{
+    return Aabb(glm::vec3(node.get_min()), glm::vec3(node.get_max()));
+}
+
+/** Returns whether the two boxes (given in the same space) overlap, touching boxes overlap. */
+inline bool overlaps(const Aabb& first, const Aabb& second)
+{
+    return first.max.x >= second.min.x && first.min.x <= second.max.x &&
+           first.max.y >= second.min.y && first.min.y <= second.max.y &&
+           first.max.z >= second.min.z && first.min.z <= second.max.z;
+}
+
+/** Distance between the closest points of two boxes, 0 if they overlap. */
+inline float box_distance(const Aabb& first, const Aabb& second)
+{
+    glm::vec3 gap = glm::max(glm::max(first.min - second.max, second.min - first.max), glm::vec3(0.0f));
+    return glm::length(gap);
+}
+
+/**
+ * The smallest AABB enclosing the transformed box (Arvo, "Transforming Axis-Aligned Bounding Boxes"). Every output
+ * axis takes the smaller and larger contribution of each matrix column separately, so no corner has to be transformed.
+ */
+inline Aabb transform(const glm::mat4& matrix, const Aabb& box)
+{
+    glm::vec3 translation = glm::vec3(matrix[3]);
+    Aabb result(translation, translation);
+    for ( int column = 0; column < 3; ++column )
+    {
+        for ( int row = 0; row < 3; ++row )
+        {
+            float a = matrix[column][row] * box.min[column];
+            float b = matrix[column][row] * box.max[column];
+            result.min[row] += std::min(a, b);
+            result.max[row] += std::max(a, b);
+        }
+    }
+    return result;
+}
+
+/** How the node boxes of two differently transformed models are compared. */
+enum class BoundsMode
+{
+    /**
+     * Only the min and max corners are transformed to world space and compared as an AABB. This is the original
+     * test_collision behaviour; it is cheap but does not enclose the geometry once a model is rotated.
+     */
+    Corners,
+    /** The second model's boxes are moved into the first model's local space as enclosing AABBs. */
+    TransformedAabb,
+    /**
+     * The second model's boxes are moved into the first model's local space as oriented boxes and tested against the
+     * first model's boxes with the separating axis theorem. Tighter than TransformedAabb for rotated models.
+     */
+    Obb
+};
+
+/** The box with only its min and max corners transformed, as the original test_collision compared boxes. */
+inline Aabb corners_to_world(const glm::mat4& matrix, const Aabb& box)
+{
+    return Aabb(glm::vec3(matrix * glm::vec4(box.min, 1.0f)), glm::vec3(matrix * glm::vec4(box.max, 1.0f)));
+}
+
+/** Whether the axis separates the boxes. Axes that are (nearly) zero because of parallel edges never do. */
+inline bool separates(const glm::vec3& axis, float reference_length_sq, const glm::vec3& offset,
+                      const glm::vec3& first_half, const glm::vec3 (&second_axes)[3])
+{
+    if ( glm::dot(axis, axis) <= 1e-12f * reference_length_sq )
+    {
+        return false;
+    }
+
+    float firstRadius = std::abs(axis.x) * first_half.x + std::abs(axis.y) * first_half.y +
+                        std::abs(axis.z) * first_half.z;
+    float secondRadius = std::abs(glm::dot(axis, second_axes[0])) + std::abs(glm::dot(axis, second_axes[1])) +
+                         std::abs(glm::dot(axis, second_axes[2]));
+    return std::abs(glm::dot(axis, offset)) > firstRadius + secondRadius;
+}
+
+/**
+ * Separating axis test of the first box against the second box moved by relative into the first box's space, as an
+ * oriented box.
+ */
+inline bool obb_overlap(const glm::mat4& relative, const Aabb& first, const Aabb& second)
+{
+    glm::vec3 firstHalf = first.extent() * 0.5f;
+    glm::vec3 secondHalf = second.extent() * 0.5f;
+
+    // the second box is a parallelepiped in the first model's space (the matrices may contain scale)
+    glm::vec3 axes[3] = { glm::vec3(relative[0]) * secondHalf.x, glm::vec3(relative[1]) * secondHalf.y,
+                          glm::vec3(relative[2]) * secondHalf.z };
+    glm::vec3 offset = glm::vec3(relative * glm::vec4(second.center(), 1.0f)) - first.center();
+
+    // face normals of the first box
+    for ( int i = 0; i < 3; ++i )
+    {
+        float secondRadius = std::abs(axes[0][i]) + std::abs(axes[1][i]) + std::abs(axes[2][i]);
+        if ( std::abs(offset[i]) > firstHalf[i] + secondRadius )
+        {
+            return false;
+        }
+    }
+
+    // face normals of the second box
+    for ( int k = 0; k < 3; ++k )
+    {
+        const glm::vec3& u = axes[(k + 1) % 3];
+        const glm::vec3& v = axes[(k + 2) % 3];
+        if ( separates(glm::cross(u, v), glm::dot(u, u) * glm::dot(v, v), offset, firstHalf, axes) )
+        {
+            return false;
+        }
+    }
+
+    // cross products of the edge directions
+    for ( int i = 0; i < 3; ++i )
+    {
+        for ( int k = 0; k < 3; ++k )
+        {
+            glm::vec3 edge(0.0f);
+            edge[i] = 1.0f;
+            if ( separates(glm::cross(edge, axes[k]), glm::dot(axes[k], axes[k]), offset, firstHalf, axes) )
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Overlap test between a node of the first model and a node of the second model, both given in their local spaces,
+ * with the bounding volume fixed at compile time. The traversals are templates over the test, so every mode gets a
+ * loop of its own without a switch per box pair. Everything that depends only on the two model matrices is computed
+ * once in the constructor.
+ */
+template <BoundsMode Mode>
+class BoxOverlap
+{
+  public:
+    BoxOverlap(const glm::mat4& first_matrix, const glm::mat4& second_matrix)
+        : first_matrix(first_matrix), second_matrix(second_matrix)
+    {
+        if constexpr ( Mode != BoundsMode::Corners )
+        {
+            relative = glm::inverse(first_matrix) * second_matrix;
+        }
+    }
+
+    bool operator()(const Aabb& first, const Aabb& second) const
+    {
+        if constexpr ( Mode == BoundsMode::Corners )
+        {
+            return overlaps(corners_to_world(first_matrix, first), corners_to_world(second_matrix, second));
+        }
+        else if constexpr ( Mode == BoundsMode::Obb )
+        {
+            return obb_overlap(relative, first, second);
+        }
+        else
+        {
+            return overlaps(first, transform(relative, second));
+        }
+    }
+
+    BoundsMode get_mode() const { return Mode; }
+
+    /** The transformation from the second model's local space to the first model's local space. */
+    const glm::mat4& relative_matrix() const { return relative; }
+
+  private:
+    glm::mat4 first_matrix;
+    glm::mat4 second_matrix;
+    glm::mat4 relative = glm::mat4(1.0f);
+};
+
+/** The test above with the mode chosen at run time, for code that tests boxes one at a time. */
+class BoxOverlapTest
+{
+  public:
+    BoxOverlapTest(const glm::mat4& first_matrix, const glm::mat4& second_matrix, BoundsMode mode)
+        : mode(mode), first_matrix(first_matrix), second_matrix(second_matrix)
+    {
+        if ( mode != BoundsMode::Corners )
+        {
+            relative = glm::inverse(first_matrix) * second_matrix;
+        }
+    }
+
+    bool operator()(const Aabb& first, const Aabb& second) const
+    {
+        switch ( mode )
+        {
+        case BoundsMode::Corners:
+            return overlaps(corners_to_world(first_matrix, first), corners_to_world(second_matrix, second));
+        case BoundsMode::Obb:
+            return obb_overlap(relative, first, second);
+        case BoundsMode::TransformedAabb:
+        default:
+            return overlaps(first, transform(relative, second));
+        }
+    }
+
+    BoundsMode get_mode() const { return mode; }
+
+    /** The transformation from the second model's local space to the first model's local space. */
+    const glm::mat4& relative_matrix() const { return relative; }
+
+  private:
+    BoundsMode mode;
+    glm::mat4 first_matrix;
+    glm::mat4 second_matrix;
+    glm::mat4 relative = glm::mat4(1.0f);
+};
+
+/** Calls query(overlap) with the BoxOverlap of the given mode and returns its result. */
+template <typename Query>
+auto with_box_overlap(const glm::mat4& first_matrix, const glm::mat4& second_matrix, BoundsMode mode, Query query)
+{
+    switch ( mode )
+    {
+    case BoundsMode::Corners:
+        return query(BoxOverlap<BoundsMode::Corners>(first_matrix, second_matrix));
+    case BoundsMode::Obb:
+        return query(BoxOverlap<BoundsMode::Obb>(first_matrix, second_matrix));
+    case BoundsMode::TransformedAabb:
+    default:
+        return query(BoxOverlap<BoundsMode::TransformedAabb>(first_matrix, second_matrix));
+    }
+}
+
+} // namespace bvh
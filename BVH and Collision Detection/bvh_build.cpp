@@ -0,0 +1,1087 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_build.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+namespace bvh {
+namespace {
+
+/** Bounds and centroid of a triangle, computed once per build so the splits never touch the vertices again. */
+struct PrimitiveRef
+{
+    Aabb bounds;
+    glm::vec3 centroid;
+};
+
+void make_refs(const std::vector<Triangle*>& triangles, std::vector<PrimitiveRef>& refs)
+{
+    refs.resize(triangles.size());
+    for ( size_t i = 0; i < triangles.size(); ++i )
+    {
+        refs[i].bounds = triangle_bounds(*triangles[i]);
+        refs[i].centroid = refs[i].bounds.center();
+    }
+}
+
+std::vector<PrimitiveRef> make_refs(const std::vector<Aabb>& boxes)
+{
+    std::vector<PrimitiveRef> refs(boxes.size());
+    for ( size_t i = 0; i < boxes.size(); ++i )
+    {
+        refs[i].bounds = boxes[i];
+        refs[i].centroid = boxes[i].center();
+    }
+    return refs;
+}
+
+PrimitiveRef triangle_ref(const IndexedMesh& mesh, size_t triangle)
+{
+    TriangleVertices vertices = mesh.triangle(triangle);
+    PrimitiveRef ref;
+    ref.bounds.grow(vertices.v[0]);
+    ref.bounds.grow(vertices.v[1]);
+    ref.bounds.grow(vertices.v[2]);
+    ref.centroid = ref.bounds.center();
+    return ref;
+}
+
+std::vector<PrimitiveRef> make_refs(const IndexedMesh& mesh, ThreadPool* pool)
+{
+    std::vector<PrimitiveRef> refs(mesh.triangle_count());
+    auto makeRange = [&](size_t first, size_t last) {
+        for ( size_t i = first; i < last; ++i )
+        {
+            refs[i] = triangle_ref(mesh, i);
+        }
+    };
+    if ( pool != nullptr )
+    {
+        parallel_for(*pool, 0, refs.size(), size_t(1) << 14, makeRange);
+    }
+    else
+    {
+        makeRange(0, refs.size());
+    }
+    return refs;
+}
+
+std::vector<PrimitiveRef> make_refs(const std::vector<Triangle*>& triangles)
+{
+    std::vector<PrimitiveRef> refs;
+    make_refs(triangles, refs);
+    return refs;
+}
+
+std::vector<PrimitiveRef> make_refs(const std::vector<Triangle*>& triangles, ThreadPool& pool)
+{
+    std::vector<PrimitiveRef> refs(triangles.size());
+    parallel_for(pool, 0, triangles.size(), size_t(1) << 14, [&](size_t first, size_t last) {
+        for ( size_t i = first; i < last; ++i )
+        {
+            refs[i].bounds = triangle_bounds(*triangles[i]);
+            refs[i].centroid = refs[i].bounds.center();
+        }
+    });
+    return refs;
+}
+
+Aabb range_bounds(const std::vector<PrimitiveRef>& refs, const uint32_t* begin, const uint32_t* end)
+{
+    Aabb bounds;
+    for ( const uint32_t* it = begin; it != end; ++it )
+    {
+        bounds.grow(refs[*it].bounds);
+    }
+    return bounds;
+}
+
+Aabb range_centroid_bounds(const std::vector<PrimitiveRef>& refs, const uint32_t* begin, const uint32_t* end)
+{
+    Aabb bounds;
+    for ( const uint32_t* it = begin; it != end; ++it )
+    {
+        bounds.grow(refs[*it].centroid);
+    }
+    return bounds;
+}
+
+// nodes with at least this many triangles compute their bounds, bins and partition in parallel
+constexpr size_t kParallelSplitSize = size_t(1) << 15;
+// number of triangles handled by one task of a parallel bounds reduction, binning or partition
+constexpr size_t kParallelChunkSize = size_t(1) << 13;
+// subtrees with fewer triangles are built serially by a single task
+constexpr uint32_t kSerialSubtreeSize = 1u << 12;
+
+/** Single bin of the SAH sweep. */
+struct SahBin
+{
+    Aabb bounds;
+    uint32_t count = 0;
+};
+
+/** Scratch buffers used by a Splitter, owned by the caller so that they can be kept from one build to the next. */
+struct SplitScratch
+{
+    std::vector<SahBin> bins;
+    std::vector<float> right_areas;
+    /** The triangles going right during a partition. */
+    std::vector<uint32_t> partition;
+};
+
+/**
+ * Chooses the split of a node according to the build settings. Every split function partitions the range in place
+ * and returns the first element of the right child, or returns end when the node should stay a leaf. The partitions
+ * are stable, so the serial and the parallel code paths always produce the same order.
+ */
+class Splitter
+{
+  public:
+    Splitter(const std::vector<PrimitiveRef>& refs, const BuildSettings& settings, SplitScratch& scratch,
+             ThreadPool* pool = nullptr)
+        : refs(refs), settings(settings), pool(pool), bins(scratch.bins), right_areas(scratch.right_areas),
+          scratch(scratch.partition)
+    {
+        bins.resize(std::max(2, settings.sah_bins));
+        right_areas.resize(bins.size());
+    }
+
+    Aabb bounds(const uint32_t* begin, const uint32_t* end)
+    {
+        return reduce(begin, end, [&](const uint32_t* first, const uint32_t* last) {
+            return range_bounds(refs, first, last);
+        });
+    }
+
+    Aabb centroid_bounds(const uint32_t* begin, const uint32_t* end)
+    {
+        return reduce(begin, end, [&](const uint32_t* first, const uint32_t* last) {
+            return range_centroid_bounds(refs, first, last);
+        });
+    }
+
+    uint32_t* split(uint32_t* begin, uint32_t* end, const Aabb& bounds)
+    {
+        switch ( settings.strategy )
+        {
+        case SplitStrategy::ObjectMedian:
+            return split_object_median(begin, end);
+        case SplitStrategy::BinnedSAH:
+            return split_binned_sah(begin, end, bounds);
+        case SplitStrategy::Midpoint:
+        default:
+            return split_midpoint(begin, end, bounds);
+        }
+    }
+
+  private:
+    uint32_t* split_midpoint(uint32_t* begin, uint32_t* end, const Aabb& bounds)
+    {
+        int axis = bounds.longest_axis();
+        uint32_t* middle = partition_at_midpoint(begin, end, bounds, axis);
+
+        if ( !settings.split_fallbacks || (middle != begin && middle != end) )
+        {
+            return middle;
+        }
+        return split_degenerate(begin, end, bounds, axis);
+    }
+
+    uint32_t* partition_at_midpoint(uint32_t* begin, uint32_t* end, const Aabb& bounds, int axis)
+    {
+        float splitCoord = (bounds.min[axis] + bounds.max[axis]) / 2.0f;
+
+        return partition(begin, end, [&](uint32_t index) {
+            const Aabb& triangle = refs[index].bounds;
+            // the triangle lies completely or mostly to the left of the split plane
+            return splitCoord - triangle.min[axis] >= triangle.max[axis] - splitCoord;
+        });
+    }
+
+    /**
+     * Fallbacks for a midpoint split that put every triangle on one side: the midpoints of the other two axes (longer
+     * first), then the midpoint of the centroid bounds with the triangles assigned by their centroids, and finally
+     * the centroid median, which separates any two or more triangles, even identical ones.
+     */
+    uint32_t* split_degenerate(uint32_t* begin, uint32_t* end, const Aabb& bounds, int failed_axis)
+    {
+        int first = (failed_axis + 1) % 3;
+        int second = (failed_axis + 2) % 3;
+        if ( bounds.extent()[second] > bounds.extent()[first] )
+        {
+            std::swap(first, second);
+        }
+
+        for ( int axis : { first, second } )
+        {
+            if ( bounds.extent()[axis] <= 0.0f )
+            {
+                continue;
+            }
+            uint32_t* middle = partition_at_midpoint(begin, end, bounds, axis);
+            if ( middle != begin && middle != end )
+            {
+                return middle;
+            }
+        }
+
+        Aabb centroidBounds = centroid_bounds(begin, end);
+        int axis = centroidBounds.longest_axis();
+        if ( centroidBounds.extent()[axis] > 0.0f )
+        {
+            float splitCoord = (centroidBounds.min[axis] + centroidBounds.max[axis]) / 2.0f;
+            uint32_t* middle = partition(begin, end, [&](uint32_t index) {
+                return refs[index].centroid[axis] < splitCoord;
+            });
+            if ( middle != begin && middle != end )
+            {
+                return middle;
+            }
+        }
+
+        return split_object_median(begin, end);
+    }
+
+    uint32_t* split_object_median(uint32_t* begin, uint32_t* end)
+    {
+        if ( end - begin < 2 )
+        {
+            return end;
+        }
+
+        int axis = centroid_bounds(begin, end).longest_axis();
+        uint32_t* middle = begin + (end - begin) / 2;
+
+        std::nth_element(begin, middle, end, [&](uint32_t first, uint32_t second) {
+            return refs[first].centroid[axis] < refs[second].centroid[axis];
+        });
+        return middle;
+    }
+
+    uint32_t* split_binned_sah(uint32_t* begin, uint32_t* end, const Aabb& bounds)
+    {
+        size_t count = end - begin;
+        if ( count < 2 )
+        {
+            return end;
+        }
+
+        Aabb centroidBounds = centroid_bounds(begin, end);
+        int binCount = static_cast<int>(bins.size());
+
+        float nodeArea = bounds.surface_area();
+        float invNodeArea = nodeArea > 0.0f ? 1.0f / nodeArea : 1.0f;
+        float leafCost = settings.intersection_cost * count;
+
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        int bestBin = -1;
+
+        for ( int axis = 0; axis < 3; ++axis )
+        {
+            float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+            if ( extent <= 0.0f )
+            {
+                continue;
+            }
+
+            fill_bins(begin, end, axis, centroidBounds.min[axis], extent);
+
+            // sweep from the right to get the area of everything right of each plane
+            Aabb rightBounds;
+            for ( int i = binCount - 1; i > 0; --i )
+            {
+                rightBounds.grow(bins[i].bounds);
+                right_areas[i] = rightBounds.surface_area();
+            }
+
+            // sweep from the left and evaluate the plane between bins i and i + 1
+            Aabb leftBounds;
+            uint32_t leftCount = 0;
+            for ( int i = 0; i < binCount - 1; ++i )
+            {
+                leftBounds.grow(bins[i].bounds);
+                leftCount += bins[i].count;
+                uint32_t rightCount = static_cast<uint32_t>(count) - leftCount;
+
+                if ( leftCount == 0 || rightCount == 0 )
+                {
+                    continue;
+                }
+
+                float cost = settings.traversal_cost + settings.intersection_cost * invNodeArea *
+                             (leftBounds.surface_area() * leftCount + right_areas[i + 1] * rightCount);
+                if ( cost < bestCost )
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = i;
+                }
+            }
+        }
+
+        // no plane separates the centroids (all of them coincide), the median still bounds the leaf size
+        if ( bestAxis < 0 )
+        {
+            return settings.split_fallbacks ? split_object_median(begin, end) : end;
+        }
+
+        // keeping the leaf is cheaper than any split
+        if ( bestCost >= leafCost )
+        {
+            return end;
+        }
+
+        float extent = centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis];
+        return partition(begin, end, [&](uint32_t index) {
+            return bin_index(refs[index].centroid[bestAxis], centroidBounds.min[bestAxis], extent) <= bestBin;
+        });
+    }
+
+    int bin_index(float coord, float min, float extent) const
+    {
+        int binCount = static_cast<int>(bins.size());
+        int index = static_cast<int>(binCount * ((coord - min) / extent));
+        return std::min(std::max(index, 0), binCount - 1);
+    }
+
+    void fill_bins(const uint32_t* begin, const uint32_t* end, int axis, float min, float extent)
+    {
+        auto binRange = [&](const uint32_t* first, const uint32_t* last, std::vector<SahBin>& out) {
+            std::fill(out.begin(), out.end(), SahBin());
+            for ( const uint32_t* it = first; it != last; ++it )
+            {
+                SahBin& bin = out[bin_index(refs[*it].centroid[axis], min, extent)];
+                bin.bounds.grow(refs[*it].bounds);
+                bin.count++;
+            }
+        };
+
+        if ( !is_parallel(begin, end) )
+        {
+            binRange(begin, end, bins);
+            return;
+        }
+
+        // every chunk bins into its own copy, merged afterwards (bounds and counts merge exactly)
+        size_t chunkCount = chunk_count(begin, end);
+        std::vector<std::vector<SahBin>> partial(chunkCount, std::vector<SahBin>(bins.size()));
+        parallel_for(*pool, 0, chunkCount, 1, [&](size_t chunk, size_t) {
+            binRange(chunk_begin(begin, end, chunk), chunk_begin(begin, end, chunk + 1), partial[chunk]);
+        });
+
+        std::fill(bins.begin(), bins.end(), SahBin());
+        for ( const std::vector<SahBin>& chunkBins : partial )
+        {
+            for ( size_t i = 0; i < bins.size(); ++i )
+            {
+                bins[i].bounds.grow(chunkBins[i].bounds);
+                bins[i].count += chunkBins[i].count;
+            }
+        }
+    }
+
+    /** Stable in-place partition, the triangles going right are parked in the scratch buffer. */
+    template <typename Predicate>
+    uint32_t* partition(uint32_t* begin, uint32_t* end, const Predicate& goes_left)
+    {
+        if ( is_parallel(begin, end) )
+        {
+            return parallel_partition(begin, end, goes_left);
+        }
+
+        scratch.clear();
+        uint32_t* out = begin;
+        for ( uint32_t* it = begin; it != end; ++it )
+        {
+            if ( goes_left(*it) )
+            {
+                *out++ = *it;
+            }
+            else
+            {
+                scratch.push_back(*it);
+            }
+        }
+        std::copy(scratch.begin(), scratch.end(), out);
+        return out;
+    }
+
+    /** The same partition computed by chunks: count, prefix sum, scatter into the scratch buffer and copy back. */
+    template <typename Predicate>
+    uint32_t* parallel_partition(uint32_t* begin, uint32_t* end, const Predicate& goes_left)
+    {
+        size_t chunkCount = chunk_count(begin, end);
+        std::vector<size_t> leftCounts(chunkCount, 0);
+
+        parallel_for(*pool, 0, chunkCount, 1, [&](size_t chunk, size_t) {
+            const uint32_t* last = chunk_begin(begin, end, chunk + 1);
+            for ( const uint32_t* it = chunk_begin(begin, end, chunk); it != last; ++it )
+            {
+                leftCounts[chunk] += goes_left(*it) ? 1 : 0;
+            }
+        });
+
+        size_t totalLeft = 0;
+        for ( size_t count : leftCounts )
+        {
+            totalLeft += count;
+        }
+
+        std::vector<size_t> leftOffsets(chunkCount);
+        std::vector<size_t> rightOffsets(chunkCount);
+        size_t leftBefore = 0;
+        for ( size_t chunk = 0; chunk < chunkCount; ++chunk )
+        {
+            size_t chunkStart = chunk_begin(begin, end, chunk) - begin;
+            leftOffsets[chunk] = leftBefore;
+            rightOffsets[chunk] = totalLeft + (chunkStart - leftBefore);
+            leftBefore += leftCounts[chunk];
+        }
+
+        scratch.resize(end - begin);
+        parallel_for(*pool, 0, chunkCount, 1, [&](size_t chunk, size_t) {
+            size_t left = leftOffsets[chunk];
+            size_t right = rightOffsets[chunk];
+            const uint32_t* last = chunk_begin(begin, end, chunk + 1);
+            for ( const uint32_t* it = chunk_begin(begin, end, chunk); it != last; ++it )
+            {
+                scratch[goes_left(*it) ? left++ : right++] = *it;
+            }
+        });
+        parallel_for(*pool, 0, chunkCount, 1, [&](size_t chunk, size_t) {
+            size_t first = chunk_begin(begin, end, chunk) - begin;
+            size_t last = chunk_begin(begin, end, chunk + 1) - begin;
+            std::copy(scratch.begin() + first, scratch.begin() + last, begin + first);
+        });
+
+        return begin + totalLeft;
+    }
+
+    /** Serial or chunked parallel reduction of the bounds of a range. */
+    template <typename Reduce>
+    Aabb reduce(const uint32_t* begin, const uint32_t* end, const Reduce& reduce_range)
+    {
+        if ( !is_parallel(begin, end) )
+        {
+            return reduce_range(begin, end);
+        }
+
+        size_t chunkCount = chunk_count(begin, end);
+        std::vector<Aabb> partial(chunkCount);
+        parallel_for(*pool, 0, chunkCount, 1, [&](size_t chunk, size_t) {
+            partial[chunk] = reduce_range(chunk_begin(begin, end, chunk), chunk_begin(begin, end, chunk + 1));
+        });
+
+        Aabb result;
+        for ( const Aabb& bounds : partial )
+        {
+            result.grow(bounds);
+        }
+        return result;
+    }
+
+    bool is_parallel(const uint32_t* begin, const uint32_t* end) const
+    {
+        return pool != nullptr && static_cast<size_t>(end - begin) >= kParallelSplitSize;
+    }
+
+    static size_t chunk_count(const uint32_t* begin, const uint32_t* end)
+    {
+        return (end - begin + kParallelChunkSize - 1) / kParallelChunkSize;
+    }
+
+    template <typename Pointer>
+    static Pointer chunk_begin(Pointer begin, Pointer end, size_t chunk)
+    {
+        return begin + std::min(static_cast<size_t>(end - begin), chunk * kParallelChunkSize);
+    }
+
+    const std::vector<PrimitiveRef>& refs;
+    const BuildSettings& settings;
+    ThreadPool* pool;
+
+    // scratch reused by every node the splitter handles
+    std::vector<SahBin>& bins;
+    std::vector<float>& right_areas;
+    std::vector<uint32_t>& scratch;
+};
+
+/** Depth budget handed to a child with the given number of triangles. */
+int child_depth(size_t count, int max_depth, const BuildSettings& settings)
+{
+    return count >= static_cast<size_t>(settings.min_triangles_for_split) ? max_depth - 1 : 0;
+}
+
+/** Recursive top to bottom builder producing the framework's BVHNode tree. */
+class NodeBuilder
+{
+  public:
+    NodeBuilder(const std::vector<Triangle*>& triangles, const std::vector<PrimitiveRef>& refs,
+                const BuildSettings& settings)
+        : triangles(triangles), refs(refs), settings(settings), splitter(refs, settings, scratch)
+    {
+    }
+
+    BVHNode* build(uint32_t* begin, uint32_t* end, int max_depth)
+    {
+        Aabb bounds = splitter.bounds(begin, end);
+
+        std::vector<Triangle*> nodeTriangles;
+        nodeTriangles.reserve(end - begin);
+        for ( uint32_t* it = begin; it != end; ++it )
+        {
+            nodeTriangles.push_back(triangles[*it]);
+        }
+
+        auto node = new BVHNode(glm::vec4(bounds.min, 1.0f), glm::vec4(bounds.max, 1.0f), nodeTriangles);
+
+        if ( max_depth >= 0 )
+        {
+            uint32_t* middle = splitter.split(begin, end, bounds);
+
+            // split only if both children receive some triangles
+            if ( middle != begin && middle != end )
+            {
+                node->set_left( build(begin, middle, child_depth(middle - begin, max_depth, settings)) );
+                node->set_right( build(middle, end, child_depth(end - middle, max_depth, settings)) );
+            }
+        }
+
+        return node;
+    }
+
+  private:
+    const std::vector<Triangle*>& triangles;
+    const std::vector<PrimitiveRef>& refs;
+    const BuildSettings& settings;
+    SplitScratch scratch;
+    Splitter splitter;
+};
+
+/**
+ * Serial builder producing flat nodes. The index array that is partitioned by the splits is the final
+ * triangle_indices array of the tree, so a leaf only has to remember the range it ended up with. Interior nodes
+ * store the index of their right child relative to the start of the node vector.
+ */
+class FlatBuilder
+{
+  public:
+    FlatBuilder(std::vector<FlatNode>& nodes, uint32_t* indices, const std::vector<PrimitiveRef>& refs,
+                const BuildSettings& settings, SplitScratch& scratch)
+        : nodes(nodes), indices(indices), settings(settings), splitter(refs, settings, scratch)
+    {
+    }
+
+    void build(uint32_t first, uint32_t last, int max_depth)
+    {
+        uint32_t* begin = indices + first;
+        uint32_t* end = indices + last;
+        Aabb bounds = splitter.bounds(begin, end);
+
+        uint32_t index = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(FlatNode{ bounds.min, first, bounds.max, last - first });
+
+        if ( max_depth >= 0 )
+        {
+            uint32_t middle = static_cast<uint32_t>(splitter.split(begin, end, bounds) - indices);
+
+            if ( middle != first && middle != last )
+            {
+                nodes[index].count = 0;
+                build(first, middle, child_depth(middle - first, max_depth, settings));
+                nodes[index].offset = static_cast<uint32_t>(nodes.size());
+                build(middle, last, child_depth(last - middle, max_depth, settings));
+            }
+        }
+    }
+
+  private:
+    std::vector<FlatNode>& nodes;
+    uint32_t* indices;
+    const BuildSettings& settings;
+    Splitter splitter;
+};
+
+/**
+ * Parallel flat builder. The large nodes at the top are split with the parallel bounds, binning and partition of the
+ * Splitter, the left subtree of every split is spawned as a task and subtrees below kSerialSubtreeSize are handed to
+ * a serial FlatBuilder. Each part of the tree is built into its own node vector (in depth first order, right child
+ * indices relative to the vector's start); appending the vectors in order gives exactly the serial result.
+ */
+class ParallelFlatBuilder
+{
+  public:
+    using NodeChunks = std::vector<std::vector<FlatNode>>;
+
+    ParallelFlatBuilder(uint32_t* indices, const std::vector<PrimitiveRef>& refs, const BuildSettings& settings,
+                        ThreadPool& pool)
+        : indices(indices), refs(refs), settings(settings), pool(pool)
+    {
+    }
+
+    NodeChunks build(uint32_t first, uint32_t last, int max_depth, Splitter& splitter)
+    {
+        NodeChunks chunks;
+
+        if ( last - first < kSerialSubtreeSize )
+        {
+            chunks.emplace_back();
+            SplitScratch scratch;
+            FlatBuilder(chunks.back(), indices, refs, settings, scratch).build(first, last, max_depth);
+            return chunks;
+        }
+
+        uint32_t* begin = indices + first;
+        uint32_t* end = indices + last;
+        Aabb bounds = splitter.bounds(begin, end);
+
+        FlatNode node{ bounds.min, first, bounds.max, last - first };
+
+        if ( max_depth >= 0 )
+        {
+            uint32_t middle = static_cast<uint32_t>(splitter.split(begin, end, bounds) - indices);
+
+            if ( middle != first && middle != last )
+            {
+                NodeChunks left;
+                TaskGroup group(pool);
+                group.run([&]() {
+                    SplitScratch leftScratch;
+                    Splitter leftSplitter(refs, settings, leftScratch, &pool);
+                    left = build(first, middle, child_depth(middle - first, max_depth, settings), leftSplitter);
+                });
+                NodeChunks right = build(middle, last, child_depth(last - middle, max_depth, settings), splitter);
+                group.wait();
+
+                size_t leftSize = 0;
+                for ( const std::vector<FlatNode>& chunk : left )
+                {
+                    leftSize += chunk.size();
+                }
+                node.count = 0;
+                node.offset = static_cast<uint32_t>(1 + leftSize);
+
+                chunks.push_back({ node });
+                std::move(left.begin(), left.end(), std::back_inserter(chunks));
+                std::move(right.begin(), right.end(), std::back_inserter(chunks));
+                return chunks;
+            }
+        }
+
+        chunks.push_back({ node });
+        return chunks;
+    }
+
+  private:
+    uint32_t* indices;
+    const std::vector<PrimitiveRef>& refs;
+    const BuildSettings& settings;
+    ThreadPool& pool;
+};
+
+void record_interior(BuildReport& report, int depth, float relative_area, const BuildSettings& settings)
+{
+    report.node_count++;
+    report.max_depth = std::max(report.max_depth, depth);
+    report.sah_cost += relative_area * settings.traversal_cost;
+}
+
+void record_leaf(BuildReport& report, size_t size, int depth, float relative_area, const BuildSettings& settings)
+{
+    report.node_count++;
+    report.max_depth = std::max(report.max_depth, depth);
+
+    report.leaf_count++;
+    report.leaf_triangle_count += size;
+    report.min_leaf_size = report.leaf_count == 1 ? size : std::min(report.min_leaf_size, size);
+    report.max_leaf_size = std::max(report.max_leaf_size, size);
+    report.sah_cost += relative_area * settings.intersection_cost * size;
+    report.average_leaf_depth += depth;
+
+    size_t bucket = 0;
+    while ( (size >> (bucket + 1)) > 0 )
+    {
+        bucket++;
+    }
+    if ( report.leaf_size_histogram.size() <= bucket )
+    {
+        report.leaf_size_histogram.resize(bucket + 1, 0);
+    }
+    report.leaf_size_histogram[bucket]++;
+
+    if ( report.depth_histogram.size() <= static_cast<size_t>(depth) )
+    {
+        report.depth_histogram.resize(depth + 1, 0);
+    }
+    report.depth_histogram[depth]++;
+}
+
+void evaluate_node(BVHNode& node, int depth, float inv_root_area, const BuildSettings& settings, BuildReport& report)
+{
+    float relativeArea = node_bounds(node).surface_area() * inv_root_area;
+
+    if ( &node.get_left() == nullptr )
+    {
+        record_leaf(report, node.get_triangles().size(), depth, relativeArea, settings);
+    }
+    else
+    {
+        record_interior(report, depth, relativeArea, settings);
+        evaluate_node(node.get_left(), depth + 1, inv_root_area, settings, report);
+        evaluate_node(node.get_right(), depth + 1, inv_root_area, settings, report);
+    }
+}
+
+void evaluate_node(const FlatBVH& bvh, uint32_t index, int depth, float inv_root_area, const BuildSettings& settings,
+                   BuildReport& report)
+{
+    const FlatNode& node = bvh.nodes[index];
+    float relativeArea = Aabb(node.min, node.max).surface_area() * inv_root_area;
+
+    if ( node.is_leaf() )
+    {
+        record_leaf(report, node.count, depth, relativeArea, settings);
+    }
+    else
+    {
+        record_interior(report, depth, relativeArea, settings);
+        evaluate_node(bvh, FlatBVH::left(index), depth + 1, inv_root_area, settings, report);
+        evaluate_node(bvh, bvh.right(index), depth + 1, inv_root_area, settings, report);
+    }
+}
+
+void finish_report(BuildReport& report)
+{
+    if ( report.leaf_count > 0 )
+    {
+        report.average_leaf_depth /= report.leaf_count;
+    }
+}
+
+/** Builds the nodes of bvh over the refs serially; triangle_indices receives the leaf order of the refs. */
+void build_serial(const std::vector<PrimitiveRef>& refs, const BuildSettings& settings, FlatBVH& bvh)
+{
+    bvh.triangle_indices.resize(refs.size());
+    std::iota(bvh.triangle_indices.begin(), bvh.triangle_indices.end(), 0u);
+    bvh.nodes.reserve(2 * refs.size() - 1);
+
+    SplitScratch scratch;
+    FlatBuilder(bvh.nodes, bvh.triangle_indices.data(), refs, settings, scratch)
+        .build(0, static_cast<uint32_t>(refs.size()), settings.max_depth);
+}
+
+/** build_serial on the pool, giving exactly the same tree. */
+void build_parallel(const std::vector<PrimitiveRef>& refs, const BuildSettings& settings, ThreadPool& pool,
+                    FlatBVH& bvh)
+{
+    bvh.triangle_indices.resize(refs.size());
+    std::iota(bvh.triangle_indices.begin(), bvh.triangle_indices.end(), 0u);
+
+    SplitScratch scratch;
+    Splitter splitter(refs, settings, scratch, &pool);
+    ParallelFlatBuilder::NodeChunks chunks =
+        ParallelFlatBuilder(bvh.triangle_indices.data(), refs, settings, pool)
+            .build(0, static_cast<uint32_t>(refs.size()), settings.max_depth, splitter);
+
+    // concatenate the parts in depth first order, turning the relative right child indices into absolute ones
+    size_t nodeCount = 0;
+    for ( const std::vector<FlatNode>& chunk : chunks )
+    {
+        nodeCount += chunk.size();
+    }
+    bvh.nodes.reserve(nodeCount);
+
+    for ( const std::vector<FlatNode>& chunk : chunks )
+    {
+        uint32_t base = static_cast<uint32_t>(bvh.nodes.size());
+        for ( FlatNode node : chunk )
+        {
+            if ( !node.is_leaf() )
+            {
+                node.offset += base;
+            }
+            bvh.nodes.push_back(node);
+        }
+    }
+}
+
+} // namespace
+
+struct BuildArena::Storage
+{
+    std::vector<PrimitiveRef> refs;
+    SplitScratch split;
+};
+
+BuildArena::BuildArena() : storage(std::make_unique<Storage>()) {}
+
+BuildArena::~BuildArena() = default;
+
+BuildArena::BuildArena(BuildArena&&) noexcept = default;
+
+BuildArena& BuildArena::operator=(BuildArena&&) noexcept = default;
+
+void BuildArena::release()
+{
+    storage = std::make_unique<Storage>();
+}
+
+size_t BuildArena::get_capacity_bytes() const
+{
+    return storage->refs.capacity() * sizeof(PrimitiveRef) + storage->split.bins.capacity() * sizeof(SahBin) +
+           storage->split.right_areas.capacity() * sizeof(float) +
+           storage->split.partition.capacity() * sizeof(uint32_t);
+}
+
+BVHNode* construct(const std::vector<Triangle*>& triangles, const BuildSettings& settings, BuildReport* report)
+{
+    if ( triangles.empty() )
+    {
+        throw std::invalid_argument("bvh::construct: cannot build a BVH without triangles");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<PrimitiveRef> refs = make_refs(triangles);
+    std::vector<uint32_t> indices(triangles.size());
+    std::iota(indices.begin(), indices.end(), 0u);
+
+    NodeBuilder builder(triangles, refs, settings);
+    BVHNode* root = builder.build(indices.data(), indices.data() + indices.size(), settings.max_depth);
+
+    auto finish = std::chrono::steady_clock::now();
+
+    if ( report != nullptr )
+    {
+        *report = evaluate(*root, settings);
+        report->build_milliseconds = std::chrono::duration<double, std::milli>(finish - start).count();
+    }
+
+    return root;
+}
+
+FlatBVH construct_flat(const std::vector<Triangle*>& triangles, const BuildSettings& settings, BuildReport* report)
+{
+    unsigned threads = ThreadPool::resolve_thread_count(settings.threads);
+    if ( threads > 1 )
+    {
+        ThreadPool pool(threads - 1);
+        return construct_flat(triangles, settings, pool, report);
+    }
+
+    FlatBVH bvh;
+    BuildArena arena;
+    construct_flat(triangles, settings, arena, bvh, report);
+    return bvh;
+}
+
+FlatBVH construct_flat(const std::vector<Triangle*>& triangles, const BuildSettings& settings, ThreadPool& pool,
+                       BuildReport* report)
+{
+    if ( triangles.empty() )
+    {
+        throw std::invalid_argument("bvh::construct_flat: cannot build a BVH without triangles");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    FlatBVH bvh;
+    bvh.triangles = triangles;
+    build_parallel(make_refs(triangles, pool), settings, pool, bvh);
+
+    auto finish = std::chrono::steady_clock::now();
+
+    if ( report != nullptr )
+    {
+        *report = evaluate(bvh, settings);
+        report->build_milliseconds = std::chrono::duration<double, std::milli>(finish - start).count();
+    }
+
+    return bvh;
+}
+
+void construct_flat(const std::vector<Triangle*>& triangles, const BuildSettings& settings, BuildArena& arena,
+                    FlatBVH& out, BuildReport* report)
+{
+    if ( triangles.empty() )
+    {
+        throw std::invalid_argument("bvh::construct_flat: cannot build a BVH without triangles");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    BuildArena::Storage& storage = arena.get_storage();
+
+    out.nodes.clear();
+    out.triangles.assign(triangles.begin(), triangles.end());
+    out.triangle_indices.resize(triangles.size());
+    std::iota(out.triangle_indices.begin(), out.triangle_indices.end(), 0u);
+    // a binary tree with n leaves has 2n - 1 nodes, so the node array never reallocates
+    out.nodes.reserve(2 * triangles.size() - 1);
+
+    make_refs(triangles, storage.refs);
+    FlatBuilder(out.nodes, out.triangle_indices.data(), storage.refs, settings, storage.split)
+        .build(0, static_cast<uint32_t>(triangles.size()), settings.max_depth);
+
+    auto finish = std::chrono::steady_clock::now();
+
+    if ( report != nullptr )
+    {
+        *report = evaluate(out, settings);
+        report->build_milliseconds = std::chrono::duration<double, std::milli>(finish - start).count();
+    }
+}
+
+FlatBVH construct_flat(const std::vector<Aabb>& boxes, const BuildSettings& settings)
+{
+    if ( boxes.empty() )
+    {
+        throw std::invalid_argument("bvh::construct_flat: cannot build a BVH without boxes");
+    }
+
+    FlatBVH bvh;
+    build_serial(make_refs(boxes), settings, bvh);
+    return bvh;
+}
+
+IndexedBVH construct_flat(const IndexedMesh& mesh, const BuildSettings& settings, BuildReport* report)
+{
+    size_t count = mesh.triangle_count();
+    if ( count == 0 )
+    {
+        throw std::invalid_argument("bvh::construct_flat: cannot build a BVH without triangles");
+    }
+    if ( mesh.indices.size() % 3 != 0 )
+    {
+        throw std::invalid_argument("bvh::construct_flat: the index count of a mesh must be a multiple of 3");
+    }
+    for ( uint32_t index : mesh.indices )
+    {
+        if ( index >= mesh.vertices.size() )
+        {
+            throw std::invalid_argument("bvh::construct_flat: mesh index out of range");
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    FlatBVH bvh;
+    unsigned threads = ThreadPool::resolve_thread_count(settings.threads);
+    if ( threads > 1 )
+    {
+        ThreadPool pool(threads - 1);
+        build_parallel(make_refs(mesh, &pool), settings, pool, bvh);
+    }
+    else
+    {
+        build_serial(make_refs(mesh, nullptr), settings, bvh);
+    }
+
+    // the index triples are copied in leaf order, so that the triangles of every leaf are read one after the other
+    IndexedBVH indexed;
+    indexed.vertices = mesh.vertices;
+    indexed.indices.resize(3 * count);
+    for ( size_t i = 0; i < count; ++i )
+    {
+        const uint32_t* corners = &mesh.indices[3 * bvh.triangle_indices[i]];
+        indexed.indices[3 * i] = corners[0];
+        indexed.indices[3 * i + 1] = corners[1];
+        indexed.indices[3 * i + 2] = corners[2];
+    }
+
+    auto finish = std::chrono::steady_clock::now();
+
+    if ( report != nullptr )
+    {
+        *report = evaluate(bvh, settings);
+        report->build_milliseconds = std::chrono::duration<double, std::milli>(finish - start).count();
+    }
+
+    indexed.nodes = std::move(bvh.nodes);
+    indexed.triangle_ids = std::move(bvh.triangle_indices);
+    return indexed;
+}
+
+BuildReport evaluate(BVHNode& root, const BuildSettings& settings)
+{
+    BuildReport report;
+    report.strategy = settings.strategy;
+
+    float rootArea = node_bounds(root).surface_area();
+    evaluate_node(root, 0, rootArea > 0.0f ? 1.0f / rootArea : 1.0f, settings, report);
+
+    finish_report(report);
+    return report;
+}
+
+BuildReport evaluate(const FlatBVH& bvh, const BuildSettings& settings)
+{
+    BuildReport report;
+    report.strategy = settings.strategy;
+
+    if ( !bvh.empty() )
+    {
+        float rootArea = Aabb(bvh.nodes[0].min, bvh.nodes[0].max).surface_area();
+        evaluate_node(bvh, 0, 0, rootArea > 0.0f ? 1.0f / rootArea : 1.0f, settings, report);
+    }
+
+    finish_report(report);
+    return report;
+}
+
+const char* to_string(SplitStrategy strategy)
+{
+    switch ( strategy )
+    {
+    case SplitStrategy::Midpoint:
+        return "midpoint";
+    case SplitStrategy::ObjectMedian:
+        return "object-median";
+    case SplitStrategy::BinnedSAH:
+        return "binned-sah";
+    }
+    return "unknown";
+}
+
+std::ostream& operator<<(std::ostream& out, const BuildReport& report)
+{
+    out << "BVH build (" << to_string(report.strategy) << "): " << report.build_milliseconds << " ms\n";
+    out << "  SAH cost:   " << report.sah_cost << "\n";
+    out << "  nodes:      " << report.node_count << " (" << report.leaf_count << " leaves)\n";
+    out << "  leaf size:  min " << report.min_leaf_size << ", max " << report.max_leaf_size << ", average "
+        << (report.leaf_count > 0 ? static_cast<float>(report.leaf_triangle_count) / report.leaf_count : 0.0f) << "\n";
+    out << "  depth:      max " << report.max_depth << ", average leaf " << report.average_leaf_depth << "\n";
+
+    out << "  leaf sizes:";
+    for ( size_t i = 0; i < report.leaf_size_histogram.size(); ++i )
+    {
+        out << " [" << (size_t(1) << i) << ".." << ((size_t(1) << (i + 1)) - 1) << "]=" << report.leaf_size_histogram[i];
+    }
+    out << "\n";
+
+    out << "  leaf depths:";
+    for ( size_t i = 0; i < report.depth_histogram.size(); ++i )
+    {
+        if ( report.depth_histogram[i] > 0 )
+        {
+            out << " " << i << "=" << report.depth_histogram[i];
+        }
+    }
+    out << "\n";
+
+    return out;
+}
+
+} // namespace bvh
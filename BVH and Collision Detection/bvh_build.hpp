@@ -0,0 +1,201 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_bounds.hpp"
+#include "bvh_flat.hpp"
+#include "bvh_indexed.hpp"
+#include "bvh_thread_pool.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace bvh {
+
+/** The way a node's triangles are divided between its two children. */
+enum class SplitStrategy
+{
+    /** Midpoint of the longest axis of the node's AABB, triangles assigned by the side they mostly lie on. */
+    Midpoint,
+    /** Median of the triangle centroids along the longest axis of the centroid bounds. */
+    ObjectMedian,
+    /** Binned surface area heuristic evaluated on all three axes. */
+    BinnedSAH
+};
+
+/** Parameters shared by all BVH builders. */
+struct BuildSettings
+{
+    SplitStrategy strategy = SplitStrategy::Midpoint;
+
+    /**
+     * The depth budget of the root. A node is split only while its budget is not negative; children get one less,
+     * except children with fewer than min_triangles_for_split triangles which continue with a budget of 0 (this is
+     * how Application::construct has always treated them).
+     */
+    int max_depth = 20;
+    int min_triangles_for_split = 2;
+
+    /**
+     * What happens when a split would put every triangle on one side (long triangles crossing the midpoint, duplicated
+     * geometry, all centroids in one point). If set, the other axes, the centroid midpoint and finally the centroid
+     * median are tried, so such nodes are still split while the depth budget allows it. If not, the node becomes a
+     * leaf, which used to give leaves with most of the model in them on adversarial inputs.
+     */
+    bool split_fallbacks = true;
+
+    /** Number of centroid bins per axis used by SplitStrategy::BinnedSAH. */
+    int sah_bins = 16;
+    /** Relative cost of visiting a node and of testing a single triangle, used by the SAH split and the report. */
+    float traversal_cost = 1.0f;
+    float intersection_cost = 1.0f;
+
+    /**
+     * Threads used by construct_flat, including the calling one; 1 builds serially, 0 uses all hardware threads. The
+     * parallel build produces exactly the same tree as the serial one.
+     */
+    unsigned threads = 1;
+};
+
+/** Quality metrics of a built tree, used to compare the split strategies. */
+struct BuildReport
+{
+    SplitStrategy strategy = SplitStrategy::Midpoint;
+    double build_milliseconds = 0.0;
+
+    /** Expected traversal cost of the tree (node and triangle costs weighted by surface area relative to the root). */
+    float sah_cost = 0.0f;
+
+    size_t node_count = 0;
+    size_t leaf_count = 0;
+    /** Sum of all leaf sizes (equals the triangle count unless the tree has empty leaves). */
+    size_t leaf_triangle_count = 0;
+    size_t min_leaf_size = 0;
+    size_t max_leaf_size = 0;
+
+    int max_depth = 0;
+    float average_leaf_depth = 0.0f;
+
+    /** Bucket i holds the number of leaves whose size lies in [2^i, 2^(i+1)). */
+    std::vector<size_t> leaf_size_histogram;
+    /** Index d holds the number of leaves at depth d (the root has depth 0). */
+    std::vector<size_t> depth_histogram;
+};
+
+/**
+ * Builds a BVH from the given triangles using the strategy selected in the settings.
+ *
+ * @param 	triangles	The list of triangles (must not be empty).
+ * @param 	settings	The build parameters.
+ * @param 	report  	Optional output for the quality report of the built tree, including the build time.
+ * @return	The root node of the computed BVH, owned by the caller.
+ */
+BVHNode* construct(const std::vector<Triangle*>& triangles, const BuildSettings& settings,
+                   BuildReport* report = nullptr);
+
+/**
+ * Builds a flat BVH directly, without creating the intermediate BVHNode tree. The triangles are referenced through a
+ * single index array that is partitioned in place, so every node only keeps its range and the peak memory use stays
+ * linear in the number of triangles. The result describes the same tree as flatten(construct(triangles, settings)).
+ *
+ * @param 	triangles	The list of triangles (must not be empty).
+ * @param 	settings	The build parameters.
+ * @param 	report  	Optional output for the quality report of the built tree, including the build time.
+ * @return	The flat BVH over the given triangles.
+ */
+FlatBVH construct_flat(const std::vector<Triangle*>& triangles, const BuildSettings& settings,
+                       BuildReport* report = nullptr);
+
+/**
+ * Parallel version of construct_flat running on the given pool (settings.threads is ignored). The bounds, binning and
+ * partition of the large nodes at the top of the tree are computed in parallel, below that the subtrees are built as
+ * independent tasks.
+ */
+FlatBVH construct_flat(const std::vector<Triangle*>& triangles, const BuildSettings& settings, ThreadPool& pool,
+                       BuildReport* report = nullptr);
+
+/**
+ * Builds a flat BVH over arbitrary boxes instead of triangles, for example the world bounds of model instances. The
+ * leaves' entries in triangle_indices are indices into the box list and FlatBVH::triangles stays empty.
+ *
+ * @param 	boxes   	The boxes (must not be empty).
+ * @param 	settings	The build parameters (settings.threads is ignored).
+ * @return	The flat BVH over the given boxes.
+ */
+FlatBVH construct_flat(const std::vector<Aabb>& boxes, const BuildSettings& settings);
+
+/**
+ * Builds a flat BVH over an indexed mesh, without any Triangle objects. The tree has the same nodes as construct_flat
+ * builds over the same triangles; IndexedBVH::indices holds the index triples of the mesh in leaf order and
+ * IndexedBVH::vertices refers to the mesh's vertex buffer, which has to outlive the tree.
+ *
+ * @param 	mesh    	The mesh (must not be empty, every index must refer to one of its vertices).
+ * @param 	settings	The build parameters, settings.threads as for construct_flat above.
+ * @param 	report  	Optional output for the quality report of the built tree, including the build time.
+ * @return	The flat BVH over the mesh.
+ */
+IndexedBVH construct_flat(const IndexedMesh& mesh, const BuildSettings& settings, BuildReport* report = nullptr);
+
+/**
+ * Scratch memory of the flat builder (triangle bounds, SAH bins, partition buffer) that is kept between builds. A
+ * model rebuilt every frame with the same arena and the same output FlatBVH reaches a steady state in which the build
+ * does not allocate at all. Each thread building trees should use an arena of its own.
+ */
+class BuildArena
+{
+  public:
+    /** The buffers themselves, only known to the builder. */
+    struct Storage;
+
+    BuildArena();
+    ~BuildArena();
+    BuildArena(BuildArena&&) noexcept;
+    BuildArena& operator=(BuildArena&&) noexcept;
+
+    /** Returns all memory held by the arena to the system. */
+    void release();
+
+    size_t get_capacity_bytes() const;
+
+    Storage& get_storage() { return *storage; }
+
+  private:
+    std::unique_ptr<Storage> storage;
+};
+
+/**
+ * construct_flat drawing all its temporary memory from the arena and rebuilding into an existing tree, whose arrays
+ * are reused as well. Always builds serially (settings.threads is ignored); concurrent builds each use their own arena
+ * and output instead.
+ *
+ * @param 	triangles	The list of triangles (must not be empty).
+ * @param 	settings	The build parameters.
+ * @param 	arena   	The scratch memory of the build.
+ * @param 	out     	The tree to build into, its previous contents are replaced.
+ * @param 	report  	Optional output for the quality report of the built tree, including the build time.
+ */
+void construct_flat(const std::vector<Triangle*>& triangles, const BuildSettings& settings, BuildArena& arena,
+                    FlatBVH& out, BuildReport* report = nullptr);
+
+/**
+ * Computes the quality report of an existing tree.
+ *
+ * @param 	root    	The root of the tree.
+ * @param 	settings	The settings providing the node and triangle costs for the SAH cost.
+ */
+BuildReport evaluate(BVHNode& root, const BuildSettings& settings);
+BuildReport evaluate(const FlatBVH& bvh, const BuildSettings& settings);
+
+const char* to_string(SplitStrategy strategy);
+
+std::ostream& operator<<(std::ostream& out, const BuildReport& report);
+
+} // namespace bvh
@@ -0,0 +1,350 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_cache.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bvh {
+namespace {
+
+constexpr char kCacheMagic[8] = { 'B', 'V', 'H', 'C', 'A', 'C', 'H', 'E' };
+// written in native byte order, a file from a machine of the other byte order reads it swapped
+constexpr uint32_t kByteOrderMark = 0x01020304u;
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t node_bytes;
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t node_count;
+    uint64_t index_count;
+    uint64_t triangle_count;
+    uint64_t indices_offset;
+};
+
+static_assert(sizeof(CacheHeader) <= kCacheHeaderBytes, "the cache header must fit in front of the nodes");
+
+// 64-bit FNV-1a
+constexpr uint64_t kHashBasis = 14695981039346656037ull;
+constexpr uint64_t kHashPrime = 1099511628211ull;
+
+template <typename T>
+uint64_t hash_add(uint64_t hash, const T& item)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&item);
+    for ( size_t i = 0; i < sizeof(T); ++i )
+    {
+        hash = (hash ^ bytes[i]) * kHashPrime;
+    }
+    return hash;
+}
+
+/**
+ * Whether the arrays the header describes lie within the file of the given size, with the counts checked by division
+ * so that a corrupt count cannot overflow.
+ */
+bool valid_layout(const CacheHeader& header, size_t size)
+{
+    uint64_t nodeSpace = (size - kCacheHeaderBytes) / sizeof(FlatNode);
+    if ( header.node_count > nodeSpace || header.node_count > UINT32_MAX ||
+         header.indices_offset != kCacheHeaderBytes + header.node_count * sizeof(FlatNode) )
+    {
+        return false;
+    }
+    return header.index_count <= (size - header.indices_offset) / sizeof(uint32_t) &&
+           header.index_count <= UINT32_MAX;
+}
+
+/**
+ * One linear pass over the mapped nodes and indices, so that a file damaged after its header was written cannot send
+ * a query out of the arrays: every leaf range lies within the indices, every index within the triangles, and the
+ * children of every interior node follow it, which also rules out cycles.
+ */
+bool valid_tree(const CacheHeader& header, const unsigned char* data)
+{
+    const unsigned char* nodes = data + kCacheHeaderBytes;
+    for ( uint64_t i = 0; i < header.node_count; ++i )
+    {
+        // read by copies, like the header
+        FlatNode node;
+        std::memcpy(&node, nodes + i * sizeof(FlatNode), sizeof(node));
+        bool valid = node.is_leaf()
+                         ? uint64_t(node.offset) + node.count <= header.index_count
+                         : i + 1 < header.node_count && node.offset > i + 1 && node.offset < header.node_count;
+        if ( !valid )
+        {
+            return false;
+        }
+    }
+
+    const unsigned char* indices = data + header.indices_offset;
+    for ( uint64_t i = 0; i < header.index_count; ++i )
+    {
+        uint32_t index;
+        std::memcpy(&index, indices + i * sizeof(uint32_t), sizeof(index));
+        if ( index >= header.triangle_count )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+CacheKey::CacheKey(uint64_t triangle_count)
+{
+    value = hash_add(kHashBasis, kCacheVersion);
+    value = hash_add(value, triangle_count);
+}
+
+void CacheKey::add_triangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    for ( const glm::vec3& v : { a, b, c } )
+    {
+        value = hash_add(value, v.x);
+        value = hash_add(value, v.y);
+        value = hash_add(value, v.z);
+    }
+}
+
+uint64_t CacheKey::finish(const BuildSettings& settings) const
+{
+    uint64_t hash = value;
+    hash = hash_add(hash, static_cast<int32_t>(settings.strategy));
+    hash = hash_add(hash, static_cast<int32_t>(settings.max_depth));
+    hash = hash_add(hash, static_cast<int32_t>(settings.min_triangles_for_split));
+    hash = hash_add(hash, static_cast<uint8_t>(settings.split_fallbacks));
+    hash = hash_add(hash, static_cast<int32_t>(settings.sah_bins));
+    hash = hash_add(hash, settings.traversal_cost);
+    hash = hash_add(hash, settings.intersection_cost);
+    return hash;
+}
+
+uint64_t cache_key(const std::vector<Triangle*>& triangles, const BuildSettings& settings)
+{
+    CacheKey key(triangles.size());
+    for ( const Triangle* tr : triangles )
+    {
+        key.add_triangle(glm::vec3(tr->v1), glm::vec3(tr->v2), glm::vec3(tr->v3));
+    }
+    return key.finish(settings);
+}
+
+bool write_cache_header(std::ostream& out, uint64_t key, uint64_t node_count, uint64_t index_count,
+                        uint64_t triangle_count)
+{
+    CacheHeader header = {};
+    std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+    header.version = kCacheVersion;
+    header.byte_order = kByteOrderMark;
+    header.node_bytes = sizeof(FlatNode);
+    header.key = key;
+    header.node_count = node_count;
+    header.index_count = index_count;
+    header.triangle_count = triangle_count;
+    header.indices_offset = kCacheHeaderBytes + node_count * sizeof(FlatNode);
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return static_cast<bool>(out);
+}
+
+bool save_cache(const std::string& path, const FlatBVH& bvh, uint64_t key)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if ( !file )
+    {
+        return false;
+    }
+
+    // a zeroed header until the rest has been written
+    const char blank[kCacheHeaderBytes] = {};
+    file.write(blank, kCacheHeaderBytes);
+    file.write(reinterpret_cast<const char*>(bvh.nodes.data()),
+               static_cast<std::streamsize>(bvh.nodes.size() * sizeof(FlatNode)));
+    file.write(reinterpret_cast<const char*>(bvh.triangle_indices.data()),
+               static_cast<std::streamsize>(bvh.triangle_indices.size() * sizeof(uint32_t)));
+    file.flush();
+    if ( !file )
+    {
+        return false;
+    }
+
+    file.seekp(0);
+    write_cache_header(file, key, bvh.nodes.size(), bvh.triangle_indices.size(), bvh.triangles.size());
+    file.flush();
+    return static_cast<bool>(file);
+}
+
+MappedCache::~MappedCache()
+{
+    close();
+}
+
+MappedCache::MappedCache(MappedCache&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedCache& MappedCache::operator=(MappedCache&& other) noexcept
+{
+    if ( this != &other )
+    {
+        close();
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+#ifdef _WIN32
+        std::swap(file, other.file);
+        std::swap(mapping, other.mapping);
+#endif
+    }
+    return *this;
+}
+
+bool MappedCache::open(const std::string& path, uint64_t key)
+{
+    close();
+
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                    FILE_ATTRIBUTE_NORMAL, nullptr);
+    if ( fileHandle == INVALID_HANDLE_VALUE )
+    {
+        return false;
+    }
+    file = fileHandle;
+
+    LARGE_INTEGER fileSize;
+    if ( !GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(kCacheHeaderBytes) )
+    {
+        close();
+        return false;
+    }
+    size = static_cast<size_t>(fileSize.QuadPart);
+
+    mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if ( mapping == nullptr )
+    {
+        close();
+        return false;
+    }
+    data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if ( data == nullptr )
+    {
+        close();
+        return false;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if ( fd < 0 )
+    {
+        return false;
+    }
+
+    struct stat status;
+    if ( fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(kCacheHeaderBytes) )
+    {
+        ::close(fd);
+        return false;
+    }
+    size = static_cast<size_t>(status.st_size);
+
+    // the mapping keeps the file referenced, the descriptor is not needed any more
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if ( mapped == MAP_FAILED )
+    {
+        size = 0;
+        return false;
+    }
+    data = static_cast<const unsigned char*>(mapped);
+#endif
+
+    CacheHeader header;
+    std::memcpy(&header, data, sizeof(header));
+
+    bool valid = std::memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) == 0 &&
+                 header.version == kCacheVersion && header.byte_order == kByteOrderMark &&
+                 header.node_bytes == sizeof(FlatNode) && header.key == key && valid_layout(header, size) &&
+                 valid_tree(header, data);
+    if ( !valid )
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedCache::close()
+{
+#ifdef _WIN32
+    if ( data != nullptr )
+    {
+        UnmapViewOfFile(data);
+    }
+    if ( mapping != nullptr )
+    {
+        CloseHandle(mapping);
+    }
+    if ( file != nullptr )
+    {
+        CloseHandle(file);
+    }
+    mapping = nullptr;
+    file = nullptr;
+#else
+    if ( data != nullptr )
+    {
+        munmap(const_cast<unsigned char*>(data), size);
+    }
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+FlatBVHView MappedCache::get_view(const std::vector<Triangle*>& triangles) const
+{
+    if ( data == nullptr )
+    {
+        return FlatBVHView();
+    }
+
+    CacheHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if ( header.triangle_count != triangles.size() )
+    {
+        return FlatBVHView();
+    }
+
+    const FlatNode* nodes = reinterpret_cast<const FlatNode*>(data + kCacheHeaderBytes);
+    const uint32_t* indices = reinterpret_cast<const uint32_t*>(data + header.indices_offset);
+    return FlatBVHView(ArrayView<FlatNode>(nodes, header.node_count), ArrayView<uint32_t>(indices, header.index_count),
+                       ArrayView<Triangle*>(triangles));
+}
+
+} // namespace bvh
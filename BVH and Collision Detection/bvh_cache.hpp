@@ -0,0 +1,122 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_build.hpp"
+#include "bvh_flat.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace bvh {
+
+/** Version of the cache file layout, files of any other version are rejected. */
+constexpr uint32_t kCacheVersion = 1;
+
+/** Size of the cache file header, the nodes follow right after it. */
+constexpr uint64_t kCacheHeaderBytes = 64;
+
+/** Incremental form of cache_key, for triangles that are not all in memory at once (see build_streamed). */
+class CacheKey
+{
+  public:
+    explicit CacheKey(uint64_t triangle_count);
+
+    /** Adds the next triangle, in the order the tree refers to them. */
+    void add_triangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+
+    uint64_t finish(const BuildSettings& settings) const;
+
+  private:
+    uint64_t value;
+};
+
+/**
+ * Key identifying a cached tree: a hash of the vertices of all triangles in their order, the build settings that
+ * affect the tree and kCacheVersion. BuildSettings::threads is left out, the tree does not depend on it.
+ *
+ * @param 	triangles	The triangles the tree is built from.
+ * @param 	settings	The build settings.
+ */
+uint64_t cache_key(const std::vector<Triangle*>& triangles, const BuildSettings& settings);
+
+/**
+ * Writes the nodes and the triangle indices of the tree to a cache file. The file header is written last, so a file
+ * left incomplete by a failed write is rejected when opened.
+ *
+ * @param 	path	The file to write, replaced if it exists.
+ * @param 	bvh 	The tree.
+ * @param 	key 	The cache_key of the triangles and settings the tree was built from.
+ * @return	Whether the whole file was written.
+ */
+bool save_cache(const std::string& path, const FlatBVH& bvh, uint64_t key);
+
+/**
+ * Writes the header of a cache file whose nodes and triangle indices were (or will be) written by the caller: the
+ * nodes at kCacheHeaderBytes, the indices right after them.
+ *
+ * @param 	out           	The file, written at its current position.
+ * @param 	key           	The cache_key of the tree.
+ * @param 	node_count    	The number of nodes.
+ * @param 	index_count   	The number of triangle indices.
+ * @param 	triangle_count	The number of triangles the indices refer to.
+ * @return	Whether the header was written.
+ */
+bool write_cache_header(std::ostream& out, uint64_t key, uint64_t node_count, uint64_t index_count,
+                        uint64_t triangle_count);
+
+/**
+ * Cache file mapped read-only into memory. The nodes and triangle indices are used in place, straight from the
+ * mapping: opening a file checks its header and, in one linear pass, that every node and index stays within the
+ * arrays, but copies nothing. The views returned by get_view stay valid until the file is closed.
+ */
+class MappedCache
+{
+  public:
+    MappedCache() = default;
+    ~MappedCache();
+
+    MappedCache(MappedCache&& other) noexcept;
+    MappedCache& operator=(MappedCache&& other) noexcept;
+    MappedCache(const MappedCache&) = delete;
+    MappedCache& operator=(const MappedCache&) = delete;
+
+    /**
+     * Maps the file, closing the one mapped before.
+     *
+     * @param 	path	The cache file.
+     * @param 	key 	The expected cache_key.
+     * @return	Whether the file exists, matches the key and the layout of this build and holds a tree whose nodes and
+     *			indices stay within its arrays; nothing is mapped otherwise.
+     */
+    bool open(const std::string& path, uint64_t key);
+
+    void close();
+
+    bool is_open() const { return data != nullptr; }
+
+    /**
+     * The mapped tree over the given triangles, which must be the ones the key was computed from. Returns an empty view
+     * if no file is open or the triangle count differs from the cached one.
+     */
+    FlatBVHView get_view(const std::vector<Triangle*>& triangles) const;
+
+  private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+} // namespace bvh
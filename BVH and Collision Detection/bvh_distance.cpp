@@ -0,0 +1,201 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_distance.hpp"
+
+#include "bvh_bounds.hpp"
+#include "bvh_traversal.hpp"
+#include "triangle_tests.hpp"
+
+#include <array>
+#include <utility>
+#include <vector>
+
+namespace bvh {
+namespace {
+
+/** The triangles of a leaf and their vertices in world space. */
+struct WorldLeaf
+{
+    std::vector<Triangle*> triangles;
+    std::vector<glm::vec3> vertices;
+
+    template <typename Tree>
+    void load(const Tree& tree, typename Tree::Handle node, const glm::mat4& matrix)
+    {
+        triangles.clear();
+        vertices.clear();
+        for_each_leaf_triangle(tree, node, [&](Triangle& triangle) {
+            triangles.push_back(&triangle);
+            vertices.push_back(glm::vec3(matrix * triangle.v1));
+            vertices.push_back(glm::vec3(matrix * triangle.v2));
+            vertices.push_back(glm::vec3(matrix * triangle.v3));
+            return true;
+        });
+    }
+};
+
+template <typename FirstTree, typename SecondTree>
+class DistanceSearch
+{
+    using FirstHandle = typename FirstTree::Handle;
+    using SecondHandle = typename SecondTree::Handle;
+
+    /** A node pair to visit, with its world space boxes and the lower bound of its distance. */
+    struct Entry
+    {
+        FirstHandle first;
+        SecondHandle second;
+        Aabb first_bounds;
+        Aabb second_bounds;
+        float bound;
+    };
+
+  public:
+    DistanceSearch(const FirstTree& first, const glm::mat4& first_matrix, const SecondTree& second,
+                   const glm::mat4& second_matrix, const DistanceSettings& settings)
+        : first(first), second(second), first_matrix(first_matrix), second_matrix(second_matrix), settings(settings)
+    {
+    }
+
+    DistanceResult run()
+    {
+        TraversalStack<Entry> stack;
+        Entry root = make_entry(first.root(), second.root());
+        if ( !prune(root.bound) )
+        {
+            stack.push(root);
+        }
+
+        while ( !stack.empty() && !(result.found && result.distance == 0.0f) )
+        {
+            Entry entry = stack.pop();
+            // the best distance may have improved since the pair was pushed
+            if ( prune(entry.bound) )
+            {
+                continue;
+            }
+
+            if ( first.is_leaf(entry.first) && second.is_leaf(entry.second) )
+            {
+                test_leaves(entry.first, entry.second);
+                continue;
+            }
+
+            std::array<Entry, 2> children;
+            size_t childCount = 0;
+            for_each_child_pair(first, second, entry.first, entry.second, entry.first_bounds, entry.second_bounds,
+                                DescentRule::Larger, [&](FirstHandle firstChild, SecondHandle secondChild) {
+                                    Entry child = make_entry(firstChild, secondChild);
+                                    if ( !prune(child.bound) )
+                                    {
+                                        children[childCount++] = child;
+                                    }
+                                });
+
+            // the farther pair is pushed first, so that the closer one is visited next
+            if ( childCount == 2 && children[0].bound < children[1].bound )
+            {
+                std::swap(children[0], children[1]);
+            }
+            for ( size_t i = 0; i < childCount; ++i )
+            {
+                stack.push(children[i]);
+            }
+        }
+
+        return result;
+    }
+
+  private:
+    Entry make_entry(FirstHandle first_node, SecondHandle second_node) const
+    {
+        Entry entry;
+        entry.first = first_node;
+        entry.second = second_node;
+        entry.first_bounds = transform(first_matrix, first.bounds(first_node));
+        entry.second_bounds = transform(second_matrix, second.bounds(second_node));
+        entry.bound = box_distance(entry.first_bounds, entry.second_bounds);
+        return entry;
+    }
+
+    /** Whether a pair with the given lower bound can be skipped. */
+    bool prune(float bound) const
+    {
+        if ( result.found )
+        {
+            return bound >= result.distance - settings.tolerance;
+        }
+        return bound > settings.max_distance;
+    }
+
+    void test_leaves(FirstHandle first_node, SecondHandle second_node)
+    {
+        first_leaf.load(first, first_node, first_matrix);
+        second_leaf.load(second, second_node, second_matrix);
+
+        for ( size_t i = 0; i < first_leaf.triangles.size(); ++i )
+        {
+            for ( size_t j = 0; j < second_leaf.triangles.size(); ++j )
+            {
+                glm::vec3 firstPoint, secondPoint;
+                float distance = triangle_distance(&first_leaf.vertices[3 * i], &second_leaf.vertices[3 * j],
+                                                   &firstPoint, &secondPoint);
+                if ( result.found ? distance < result.distance : distance <= settings.max_distance )
+                {
+                    result.found = true;
+                    result.distance = distance;
+                    result.first_point = firstPoint;
+                    result.second_point = secondPoint;
+                    result.first_triangle = first_leaf.triangles[i];
+                    result.second_triangle = second_leaf.triangles[j];
+                    if ( distance == 0.0f )
+                    {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    const FirstTree& first;
+    const SecondTree& second;
+    const glm::mat4& first_matrix;
+    const glm::mat4& second_matrix;
+    const DistanceSettings& settings;
+
+    DistanceResult result;
+    WorldLeaf first_leaf;
+    WorldLeaf second_leaf;
+};
+
+template <typename FirstTree, typename SecondTree>
+DistanceResult search(const FirstTree& first, const glm::mat4& first_matrix, const SecondTree& second,
+                      const glm::mat4& second_matrix, const DistanceSettings& settings)
+{
+    return DistanceSearch<FirstTree, SecondTree>(first, first_matrix, second, second_matrix, settings).run();
+}
+
+} // namespace
+
+DistanceResult min_distance(BVHNode& first_node, const glm::mat4& first_matrix, BVHNode& second_node,
+                            const glm::mat4& second_matrix, const DistanceSettings& settings)
+{
+    return search(NodeTree{ first_node }, first_matrix, NodeTree{ second_node }, second_matrix, settings);
+}
+
+DistanceResult min_distance(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+                            const glm::mat4& second_matrix, const DistanceSettings& settings)
+{
+    if ( first.empty() || second.empty() )
+    {
+        return DistanceResult();
+    }
+    return search(FlatViewTree{ first }, first_matrix, FlatViewTree{ second }, second_matrix, settings);
+}
+
+} // namespace bvh
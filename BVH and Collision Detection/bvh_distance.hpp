@@ -0,0 +1,60 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_flat.hpp"
+
+#include <limits>
+
+namespace bvh {
+
+/** Options of the distance query. */
+struct DistanceSettings
+{
+    /**
+     * Node pairs that could only improve the best distance by less than this are skipped, so the distance found is
+     * at most tolerance above the exact one. 0 finds the exact minimum.
+     */
+    float tolerance = 0.0f;
+    /** Triangle pairs farther apart than this are not searched for, a clearance check needs nothing beyond it. */
+    float max_distance = std::numeric_limits<float>::infinity();
+};
+
+/** Outcome of the distance query, all in world space. */
+struct DistanceResult
+{
+    /** False if the models are farther apart than DistanceSettings::max_distance. */
+    bool found = false;
+    /** 0 if the models intersect. */
+    float distance = std::numeric_limits<float>::infinity();
+    glm::vec3 first_point = glm::vec3(0.0f);
+    glm::vec3 second_point = glm::vec3(0.0f);
+    /** The triangles the closest points lie on. */
+    Triangle* first_triangle = nullptr;
+    Triangle* second_triangle = nullptr;
+};
+
+/**
+ * Finds the closest pair of points of two models, on the same dual tree traversal as test_collision. Node pairs are
+ * bounded from below by the distance of their world space boxes: a pair whose bound cannot beat the best distance
+ * found so far is skipped, and the child pairs are visited in order of their bounds, so that a close triangle pair is
+ * found early and prunes most of the rest. The traversal ends as soon as two triangles intersect.
+ *
+ * @param 	first_node	  The first BVH root.
+ * @param 	first_matrix  The model matrix applied to the first model.
+ * @param   second_node   The second BVH root.
+ * @param   second_matrix The model matrix applied to the second model.
+ * @param   settings      The query options.
+ */
+DistanceResult min_distance(BVHNode& first_node, const glm::mat4& first_matrix, BVHNode& second_node,
+                            const glm::mat4& second_matrix, const DistanceSettings& settings = DistanceSettings());
+DistanceResult min_distance(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+                            const glm::mat4& second_matrix, const DistanceSettings& settings = DistanceSettings());
+
+} // namespace bvh
@@ -0,0 +1,68 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_flat.hpp"
+
+#include <unordered_map>
+
+namespace bvh {
+namespace {
+
+class Flattener
+{
+  public:
+    explicit Flattener(FlatBVH& bvh) : bvh(bvh)
+    {
+        for ( size_t i = 0; i < bvh.triangles.size(); ++i )
+        {
+            triangle_index.emplace(bvh.triangles[i], static_cast<uint32_t>(i));
+        }
+    }
+
+    void emit(BVHNode& node)
+    {
+        uint32_t index = static_cast<uint32_t>(bvh.nodes.size());
+        bvh.nodes.push_back(FlatNode{ glm::vec3(node.get_min()), 0, glm::vec3(node.get_max()), 0 });
+
+        if ( &node.get_left() == nullptr )
+        {
+            std::vector<Triangle*> leafTriangles = node.get_triangles();
+
+            bvh.nodes[index].offset = static_cast<uint32_t>(bvh.triangle_indices.size());
+            bvh.nodes[index].count = static_cast<uint32_t>(leafTriangles.size());
+            for ( Triangle* tr : leafTriangles )
+            {
+                bvh.triangle_indices.push_back(triangle_index.at(tr));
+            }
+        }
+        else
+        {
+            // the left child directly follows its parent
+            emit(node.get_left());
+            bvh.nodes[index].offset = static_cast<uint32_t>(bvh.nodes.size());
+            emit(node.get_right());
+        }
+    }
+
+  private:
+    FlatBVH& bvh;
+    std::unordered_map<Triangle*, uint32_t> triangle_index;
+};
+
+} // namespace
+
+FlatBVH flatten(BVHNode& root)
+{
+    FlatBVH bvh;
+    bvh.triangles = root.get_triangles();
+    bvh.triangle_indices.reserve(bvh.triangles.size());
+
+    Flattener(bvh).emit(root);
+    return bvh;
+}
+
+} // namespace bvh
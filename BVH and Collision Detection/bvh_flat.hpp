@@ -0,0 +1,119 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bvh {
+
+/**
+ * Node of a flattened BVH. The nodes are stored in depth first order, so the left child of an interior node is always
+ * the next node in the array and only the index of the right child has to be stored.
+ */
+struct FlatNode
+{
+    glm::vec3 min;
+    /** Interior node: index of the right child. Leaf: index of the first entry in FlatBVH::triangle_indices. */
+    uint32_t offset;
+    glm::vec3 max;
+    /** Number of triangles of a leaf, 0 for interior nodes. */
+    uint32_t count;
+
+    bool is_leaf() const { return count > 0; }
+};
+
+static_assert(sizeof(FlatNode) == 32, "FlatNode is expected to fill exactly half of a cache line");
+
+/**
+ * BVH stored in two contiguous arrays: the nodes, and the triangle indices referenced by the leaves, ordered so that
+ * every leaf covers one consecutive range.
+ */
+struct FlatBVH
+{
+    /** Nodes in depth first order, the root is the first one. */
+    std::vector<FlatNode> nodes;
+    /** Indices into triangles, in leaf order. */
+    std::vector<uint32_t> triangle_indices;
+    /** The triangles of the model in their original order (not owned). */
+    std::vector<Triangle*> triangles;
+
+    bool empty() const { return nodes.empty(); }
+
+    static uint32_t left(uint32_t node) { return node + 1; }
+    uint32_t right(uint32_t node) const { return nodes[node].offset; }
+
+    /** The i-th triangle of the given leaf. */
+    Triangle& leaf_triangle(const FlatNode& leaf, uint32_t i) const
+    {
+        return *triangles[triangle_indices[leaf.offset + i]];
+    }
+};
+
+/** Read-only view of a contiguous array owned elsewhere. */
+template <typename T>
+struct ArrayView
+{
+    const T* items = nullptr;
+    size_t count = 0;
+
+    ArrayView() = default;
+    ArrayView(const T* items, size_t count) : items(items), count(count) {}
+    ArrayView(const std::vector<T>& vector) : items(vector.data()), count(vector.size()) {}
+
+    const T& operator[](size_t i) const { return items[i]; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+};
+
+/**
+ * FlatBVH whose arrays are owned elsewhere, for example by a memory mapped cache file. It has the same members and
+ * accessors as FlatBVH, so the flat queries run on views as well.
+ */
+struct FlatBVHView
+{
+    ArrayView<FlatNode> nodes;
+    ArrayView<uint32_t> triangle_indices;
+    ArrayView<Triangle*> triangles;
+
+    FlatBVHView() = default;
+    FlatBVHView(ArrayView<FlatNode> nodes, ArrayView<uint32_t> triangle_indices, ArrayView<Triangle*> triangles)
+        : nodes(nodes), triangle_indices(triangle_indices), triangles(triangles)
+    {
+    }
+    FlatBVHView(const FlatBVH& bvh) : nodes(bvh.nodes), triangle_indices(bvh.triangle_indices), triangles(bvh.triangles)
+    {
+    }
+
+    bool empty() const { return nodes.empty(); }
+
+    static uint32_t left(uint32_t node) { return node + 1; }
+    uint32_t right(uint32_t node) const { return nodes[node].offset; }
+
+    /** The i-th triangle of the given leaf. */
+    Triangle& leaf_triangle(const FlatNode& leaf, uint32_t i) const
+    {
+        return *triangles[triangle_indices[leaf.offset + i]];
+    }
+};
+
+/**
+ * Converts a tree produced by construct into the flat representation. The triangle order of the root node is kept as
+ * the order FlatBVH::triangles refers to.
+ *
+ * @param 	root	The root of the BVH.
+ * @return	The flattened copy of the tree, the original tree is left untouched.
+ */
+FlatBVH flatten(BVHNode& root);
+
+} // namespace bvh
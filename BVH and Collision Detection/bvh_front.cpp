@@ -0,0 +1,197 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_front.hpp"
+
+#include <array>
+
+namespace bvh {
+namespace {
+
+uint64_t pair_key(const NodePair& pair)
+{
+    return (static_cast<uint64_t>(pair.first) << 32) | pair.second;
+}
+
+void compute_parents(const FlatBVH& bvh, std::vector<uint32_t>& parent, std::vector<uint32_t>& depth)
+{
+    parent.assign(bvh.nodes.size(), 0);
+    depth.assign(bvh.nodes.size(), 0);
+
+    // parents precede their children in depth first order
+    for ( uint32_t i = 0; i < bvh.nodes.size(); ++i )
+    {
+        if ( !bvh.nodes[i].is_leaf() )
+        {
+            for ( uint32_t child : { FlatBVH::left(i), bvh.right(i) } )
+            {
+                parent[child] = i;
+                depth[child] = depth[i] + 1;
+            }
+        }
+    }
+}
+
+} // namespace
+
+void CollisionFront::reset()
+{
+    first_tree = nullptr;
+    second_tree = nullptr;
+    front.clear();
+}
+
+void CollisionFront::prepare(const FlatBVH& first, const FlatBVH& second)
+{
+    first_tree = &first;
+    second_tree = &second;
+    first_size = first.nodes.size();
+    second_size = second.nodes.size();
+
+    compute_parents(first, first_parent, first_depth);
+    compute_parents(second, second_parent, second_depth);
+
+    front.assign(1, NodePair{ 0, 0 });
+}
+
+size_t CollisionFront::collide(const FlatBVH& first, const glm::mat4& first_matrix, const FlatBVH& second,
+                               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings)
+{
+    out.clear();
+    tested_pairs = 0;
+
+    if ( first.empty() || second.empty() )
+    {
+        reset();
+        return 0;
+    }
+    if ( &first != first_tree || &second != second_tree || first.nodes.size() != first_size ||
+         second.nodes.size() != second_size )
+    {
+        prepare(first, second);
+    }
+
+    FlatTree firstTree{ first };
+    FlatTree secondTree{ second };
+    BoxOverlapTest overlap(first_matrix, second_matrix, settings.bounds);
+    LeafTester leaves(first_matrix, second_matrix, settings.triangle_space);
+    LeafScratch scratch(second.nodes.size());
+
+    auto overlapping = [&](const NodePair& pair) {
+        tested_pairs++;
+        return overlap(firstTree.bounds(pair.first), secondTree.bounds(pair.second));
+    };
+
+    // descend from every pair of the front, collecting the pairs where the descent stops
+    stops.clear();
+    for ( const NodePair& start : front )
+    {
+        stack.assign(1, start);
+        while ( !stack.empty() )
+        {
+            NodePair pair = stack.back();
+            stack.pop_back();
+
+            if ( !overlapping(pair) )
+            {
+                stops.push_back(Stop{ pair, false });
+                continue;
+            }
+
+            if ( out.record_node_pairs )
+            {
+                out.node_pairs.push_back(pair);
+            }
+
+            const FlatNode& firstNode = first.nodes[pair.first];
+            const FlatNode& secondNode = second.nodes[pair.second];
+
+            if ( firstNode.is_leaf() && secondNode.is_leaf() )
+            {
+                stops.push_back(Stop{ pair, true });
+
+                auto firstAt = [&](uint32_t i) -> Triangle& { return first.leaf_triangle(firstNode, i); };
+                auto secondAt = [&](uint32_t j) -> Triangle& { return second.leaf_triangle(secondNode, j); };
+                auto onHit = [&](uint32_t i, uint32_t j) {
+                    out.contacts.push_back(ContactPair{ first.triangle_indices[firstNode.offset + i],
+                                                        second.triangle_indices[secondNode.offset + j] });
+                    return true;
+                };
+                leaves.test(firstNode.count, firstAt, secondNode.count, secondAt, pair.second, scratch, onHit);
+                continue;
+            }
+
+            // pushed in reverse so that they are popped in visiting order
+            std::array<NodePair, 4> children;
+            size_t childCount = 0;
+            for_each_child_pair(firstTree, secondTree, pair.first, pair.second, Aabb(), Aabb(), DescentRule::Both,
+                                [&](uint32_t firstChild, uint32_t secondChild) {
+                                    children[childCount++] = NodePair{ firstChild, secondChild };
+                                });
+            while ( childCount > 0 )
+            {
+                stack.push_back(children[--childCount]);
+            }
+        }
+    }
+
+    // The parent of a pair in the traversal tree: both nodes descend together until one of them is a leaf, after that
+    // only the other one does, so the deeper node (or both, if equally deep) was the one split.
+    auto parentOf = [&](const NodePair& pair) {
+        uint32_t firstDepth = first_depth[pair.first];
+        uint32_t secondDepth = second_depth[pair.second];
+        return NodePair{ firstDepth >= secondDepth ? first_parent[pair.first] : pair.first,
+                         secondDepth >= firstDepth ? second_parent[pair.second] : pair.second };
+    };
+    auto childCountOf = [&](const NodePair& pair) {
+        return (firstTree.is_leaf(pair.first) ? 1u : 2u) * (secondTree.is_leaf(pair.second) ? 1u : 2u);
+    };
+    auto isRoot = [](const NodePair& pair) { return pair.first == 0 && pair.second == 0; };
+
+    // count the separated pairs per parent, a parent whose children are all separated and that is separated itself
+    // replaces them (the count is then set to 0 to mark it)
+    sibling_counts.clear();
+    for ( const Stop& stop : stops )
+    {
+        if ( !stop.overlapping && !isRoot(stop.pair) )
+        {
+            sibling_counts[pair_key(parentOf(stop.pair))]++;
+        }
+    }
+    for ( auto& entry : sibling_counts )
+    {
+        NodePair parent{ static_cast<uint32_t>(entry.first >> 32), static_cast<uint32_t>(entry.first) };
+        bool collapse = entry.second == childCountOf(parent) && !overlapping(parent);
+        entry.second = collapse ? 0 : 1;
+    }
+
+    front.clear();
+    for ( const Stop& stop : stops )
+    {
+        if ( !stop.overlapping && !isRoot(stop.pair) )
+        {
+            NodePair parent = parentOf(stop.pair);
+            auto it = sibling_counts.find(pair_key(parent));
+            if ( it->second == 0 )
+            {
+                // the first sibling emits the parent, at its position in the front
+                front.push_back(parent);
+                it->second = 2;
+                continue;
+            }
+            if ( it->second == 2 )
+            {
+                continue;
+            }
+        }
+        front.push_back(stop.pair);
+    }
+
+    return out.contacts.size();
+}
+
+} // namespace bvh
@@ -0,0 +1,88 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_flat.hpp"
+#include "bvh_query.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace bvh {
+
+/**
+ * Collision front of one pair of models, carried from frame to frame. The front is the set of node pairs at which the
+ * last query stopped descending: pairs whose boxes did not overlap and overlapping leaf pairs. Every leaf pair of the
+ * two trees lies below exactly one of them, so the next query can start from the front instead of the roots. Pairs
+ * that overlap now are descended from, and a complete group of sibling pairs that no longer overlap is replaced by its
+ * parent pair when that does not overlap either, which moves the front up by at most one level per query as the
+ * models separate.
+ *
+ * The query always descends as DescentRule::Both (that keeps the parent of every pair well defined) and ignores
+ * settings.max_hits and settings.threads. It finds the same contacts as collide, in front order.
+ */
+class CollisionFront
+{
+  public:
+    /**
+     * Finds the intersecting triangle pairs of the two models, starting from the front of the last call. The front is
+     * reset to the roots if the models differ from the last call; a tree rebuilt in place needs an explicit reset()
+     * (refitting keeps the topology and with it the front valid).
+     *
+     * @param 	first	      The first BVH.
+     * @param 	first_matrix  The model matrix applied to the first model.
+     * @param   second        The second BVH.
+     * @param   second_matrix The model matrix applied to the second model.
+     * @param   out           The buffer receiving the contacts, cleared first.
+     * @param   settings      The query options.
+     * @return	The number of contacts written to the buffer.
+     */
+    size_t collide(const FlatBVH& first, const glm::mat4& first_matrix, const FlatBVH& second,
+                   const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings = QuerySettings());
+
+    /** Forgets the front, the next query starts from the roots again. */
+    void reset();
+
+    const std::vector<NodePair>& get_pairs() const { return front; }
+
+    /** The number of node pairs whose boxes the last query tested. */
+    size_t get_tested_pairs() const { return tested_pairs; }
+
+  private:
+    struct Stop
+    {
+        NodePair pair;
+        bool overlapping;
+    };
+
+    void prepare(const FlatBVH& first, const FlatBVH& second);
+
+    const FlatBVH* first_tree = nullptr;
+    const FlatBVH* second_tree = nullptr;
+    size_t first_size = 0;
+    size_t second_size = 0;
+
+    // parent and depth of every node of both trees (the parent of the root is itself)
+    std::vector<uint32_t> first_parent;
+    std::vector<uint32_t> first_depth;
+    std::vector<uint32_t> second_parent;
+    std::vector<uint32_t> second_depth;
+
+    std::vector<NodePair> front;
+    size_t tested_pairs = 0;
+
+    // scratch of the queries
+    std::vector<Stop> stops;
+    std::vector<NodePair> stack;
+    std::unordered_map<uint64_t, uint32_t> sibling_counts;
+};
+
+} // namespace bvh
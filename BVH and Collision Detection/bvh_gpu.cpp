@@ -0,0 +1,485 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_gpu.hpp"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace bvh {
+namespace {
+
+/** Invocations per work group, local_size_x of kCollideShader. */
+constexpr GLuint kLocalSize = 64;
+
+/** Binding points of the shader storage buffers, the same as in kCollideShader. */
+enum Binding : GLuint
+{
+    FirstLeaves = 0,
+    FirstVertices = 1,
+    FirstIds = 2,
+    FirstMask = 3,
+    SecondNodes = 4,
+    SecondVertices = 5,
+    SecondIds = 6,
+    SecondMask = 7,
+    Contacts = 8,
+};
+
+/** Size of the header of the contact buffer: the counter and one uint of padding, so that the pairs are aligned. */
+constexpr GLsizeiptr kContactHeader = 2 * sizeof(uint32_t);
+
+// Node has the layout of FlatNode under std430: the vec3 members take 16 bytes with the uint after them.
+constexpr const char* kCollideShader = R"(#version 430
+
+layout(local_size_x = 64) in;
+
+struct Node
+{
+    vec3 min;
+    uint offset;
+    vec3 max;
+    uint count;
+};
+
+layout(std430, binding = 0) readonly buffer FirstLeaves { Node first_leaves[]; };
+layout(std430, binding = 1) readonly buffer FirstVertices { vec4 first_vertices[]; };
+layout(std430, binding = 2) readonly buffer FirstIds { uint first_ids[]; };
+layout(std430, binding = 3) writeonly buffer FirstMask { uint first_mask[]; };
+layout(std430, binding = 4) readonly buffer SecondNodes { Node second_nodes[]; };
+layout(std430, binding = 5) readonly buffer SecondVertices { vec4 second_vertices[]; };
+layout(std430, binding = 6) readonly buffer SecondIds { uint second_ids[]; };
+layout(std430, binding = 7) writeonly buffer SecondMask { uint second_mask[]; };
+layout(std430, binding = 8) buffer Contacts
+{
+    uint contact_count;
+    uint padding;
+    uvec2 contacts[];
+};
+
+uniform mat4 first_to_second;
+uniform uint leaf_count;
+uniform uint contact_capacity;
+
+const int kStackSize = 64;
+
+bool separated(vec3 axis, vec3 a[3], vec3 b[3])
+{
+    // parallel edges give no axis
+    if ( dot(axis, axis) < 1e-20 )
+    {
+        return false;
+    }
+    vec3 pa = vec3(dot(axis, a[0]), dot(axis, a[1]), dot(axis, a[2]));
+    vec3 pb = vec3(dot(axis, b[0]), dot(axis, b[1]), dot(axis, b[2]));
+    float aMin = min(pa.x, min(pa.y, pa.z));
+    float aMax = max(pa.x, max(pa.y, pa.z));
+    float bMin = min(pb.x, min(pb.y, pb.z));
+    float bMax = max(pb.x, max(pb.y, pb.z));
+    return aMax < bMin || bMax < aMin;
+}
+
+// Separating axes: the two normals, the nine edge cross products and, for coplanar triangles, the edge normals
+// within the planes. Touching triangles intersect.
+bool triangles_intersect(vec3 a[3], vec3 b[3])
+{
+    vec3 ea[3] = vec3[3](a[1] - a[0], a[2] - a[1], a[0] - a[2]);
+    vec3 eb[3] = vec3[3](b[1] - b[0], b[2] - b[1], b[0] - b[2]);
+    vec3 na = cross(ea[0], ea[1]);
+    vec3 nb = cross(eb[0], eb[1]);
+    if ( separated(na, a, b) || separated(nb, a, b) )
+    {
+        return false;
+    }
+    for ( int i = 0; i < 3; ++i )
+    {
+        for ( int j = 0; j < 3; ++j )
+        {
+            if ( separated(cross(ea[i], eb[j]), a, b) )
+            {
+                return false;
+            }
+        }
+    }
+    for ( int i = 0; i < 3; ++i )
+    {
+        if ( separated(cross(na, ea[i]), a, b) || separated(cross(nb, eb[i]), a, b) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void main()
+{
+    uint leafIndex = gl_GlobalInvocationID.x;
+    if ( leafIndex >= leaf_count )
+    {
+        return;
+    }
+
+    // the leaf box in the space of the second model
+    Node leaf = first_leaves[leafIndex];
+    vec3 center = (first_to_second * vec4(0.5 * (leaf.min + leaf.max), 1.0)).xyz;
+    vec3 half_extent = 0.5 * (leaf.max - leaf.min);
+    mat3 rotation = mat3(first_to_second);
+    vec3 extent = abs(rotation[0]) * half_extent.x + abs(rotation[1]) * half_extent.y
+                  + abs(rotation[2]) * half_extent.z;
+    vec3 boxMin = center - extent;
+    vec3 boxMax = center + extent;
+
+    uint stack[kStackSize];
+    int size = 0;
+    stack[size++] = 0u;
+    while ( size > 0 )
+    {
+        uint index = stack[--size];
+        Node node = second_nodes[index];
+        if ( any(greaterThan(boxMin, node.max)) || any(lessThan(boxMax, node.min)) )
+        {
+            continue;
+        }
+
+        if ( node.count == 0u )
+        {
+            stack[size++] = node.offset;
+            stack[size++] = index + 1u;
+            continue;
+        }
+
+        for ( uint i = 0u; i < leaf.count; ++i )
+        {
+            uint firstTriangle = leaf.offset + i;
+            vec3 a[3];
+            for ( int k = 0; k < 3; ++k )
+            {
+                a[k] = (first_to_second * vec4(first_vertices[3u * firstTriangle + uint(k)].xyz, 1.0)).xyz;
+            }
+
+            for ( uint j = 0u; j < node.count; ++j )
+            {
+                uint secondTriangle = node.offset + j;
+                vec3 b[3];
+                for ( int k = 0; k < 3; ++k )
+                {
+                    b[k] = second_vertices[3u * secondTriangle + uint(k)].xyz;
+                }
+
+                if ( triangles_intersect(a, b) )
+                {
+                    uint firstId = first_ids[firstTriangle];
+                    uint secondId = second_ids[secondTriangle];
+                    first_mask[firstId] = 1u;
+                    second_mask[secondId] = 1u;
+                    uint slot = atomicAdd(contact_count, 1u);
+                    if ( slot < contact_capacity )
+                    {
+                        contacts[slot] = uvec2(firstId, secondId);
+                    }
+                }
+            }
+        }
+    }
+}
+)";
+
+/** Depth of the tree, 0 for a single leaf. */
+uint32_t tree_depth(ArrayView<FlatNode> nodes)
+{
+    uint32_t depth = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, 0 } };
+    while ( !stack.empty() )
+    {
+        auto [node, nodeDepth] = stack.back();
+        stack.pop_back();
+        depth = std::max(depth, nodeDepth);
+        if ( !nodes[node].is_leaf() )
+        {
+            stack.push_back({ node + 1, nodeDepth + 1 });
+            stack.push_back({ nodes[node].offset, nodeDepth + 1 });
+        }
+    }
+    return depth;
+}
+
+void create_buffer(GLuint& buffer, GLsizeiptr size, const void* data, GLenum usage)
+{
+    if ( buffer == 0 )
+    {
+        glGenBuffers(1, &buffer);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, usage);
+}
+
+void delete_buffer(GLuint& buffer)
+{
+    if ( buffer != 0 )
+    {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+}
+
+/** Whether the shader compiled; if not, its info log is appended to log. */
+bool check_shader(GLuint shader, std::string& log)
+{
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if ( status == GL_TRUE )
+    {
+        return true;
+    }
+    GLint length = 0;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+    std::string message(static_cast<size_t>(std::max(length, 1)), '\0');
+    glGetShaderInfoLog(shader, length, nullptr, &message[0]);
+    log += message;
+    return false;
+}
+
+/** Whether the program linked; if not, its info log is appended to log. */
+bool check_program(GLuint program, std::string& log)
+{
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if ( status == GL_TRUE )
+    {
+        return true;
+    }
+    GLint length = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+    std::string message(static_cast<size_t>(std::max(length, 1)), '\0');
+    glGetProgramInfoLog(program, length, nullptr, &message[0]);
+    log += message;
+    return false;
+}
+
+} // namespace
+
+GpuBVH::~GpuBVH() { release(); }
+
+GpuBVH::GpuBVH(GpuBVH&& other) noexcept { *this = std::move(other); }
+
+GpuBVH& GpuBVH::operator=(GpuBVH&& other) noexcept
+{
+    if ( this != &other )
+    {
+        release();
+        std::swap(node_buffer, other.node_buffer);
+        std::swap(leaf_buffer, other.leaf_buffer);
+        std::swap(vertex_buffer, other.vertex_buffer);
+        std::swap(id_buffer, other.id_buffer);
+        std::swap(mask_buffer, other.mask_buffer);
+        std::swap(leaf_count, other.leaf_count);
+        std::swap(triangle_count, other.triangle_count);
+    }
+    return *this;
+}
+
+bool GpuBVH::upload(const FlatBVHView& bvh)
+{
+    if ( bvh.empty() || tree_depth(bvh.nodes) > kGpuMaxDepth )
+    {
+        return false;
+    }
+
+    std::vector<glm::vec4> vertices;
+    vertices.reserve(3 * bvh.triangle_indices.size());
+    for ( uint32_t index : bvh.triangle_indices )
+    {
+        const Triangle& triangle = *bvh.triangles[index];
+        vertices.push_back(triangle.v1);
+        vertices.push_back(triangle.v2);
+        vertices.push_back(triangle.v3);
+    }
+    std::vector<uint32_t> ids(bvh.triangle_indices.begin(), bvh.triangle_indices.end());
+
+    triangle_count = static_cast<uint32_t>(bvh.triangles.size());
+    upload(bvh.nodes, vertices, ids);
+    return true;
+}
+
+bool GpuBVH::upload(const IndexedBVH& bvh)
+{
+    if ( bvh.empty() || tree_depth(bvh.nodes) > kGpuMaxDepth )
+    {
+        return false;
+    }
+
+    std::vector<glm::vec4> vertices;
+    vertices.reserve(bvh.indices.size());
+    for ( uint32_t index : bvh.indices )
+    {
+        vertices.push_back(glm::vec4(bvh.vertices[index], 1.0f));
+    }
+
+    triangle_count = static_cast<uint32_t>(bvh.triangle_ids.size());
+    upload(bvh.nodes, vertices, bvh.triangle_ids);
+    return true;
+}
+
+void GpuBVH::upload(ArrayView<FlatNode> nodes, const std::vector<glm::vec4>& vertices,
+                    const std::vector<uint32_t>& triangle_ids)
+{
+    std::vector<FlatNode> leaves;
+    for ( const FlatNode& node : nodes )
+    {
+        if ( node.is_leaf() )
+        {
+            leaves.push_back(node);
+        }
+    }
+    leaf_count = static_cast<uint32_t>(leaves.size());
+
+    create_buffer(node_buffer, nodes.size() * sizeof(FlatNode), nodes.begin(), GL_STATIC_DRAW);
+    create_buffer(leaf_buffer, leaves.size() * sizeof(FlatNode), leaves.data(), GL_STATIC_DRAW);
+    create_buffer(vertex_buffer, vertices.size() * sizeof(glm::vec4), vertices.data(), GL_STATIC_DRAW);
+    create_buffer(id_buffer, triangle_ids.size() * sizeof(uint32_t), triangle_ids.data(), GL_STATIC_DRAW);
+    std::vector<uint32_t> mask(triangle_count, 0);
+    create_buffer(mask_buffer, mask.size() * sizeof(uint32_t), mask.data(), GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GpuBVH::release()
+{
+    delete_buffer(node_buffer);
+    delete_buffer(leaf_buffer);
+    delete_buffer(vertex_buffer);
+    delete_buffer(id_buffer);
+    delete_buffer(mask_buffer);
+    leaf_count = 0;
+    triangle_count = 0;
+}
+
+void GpuBVH::clear_mask()
+{
+    if ( mask_buffer == 0 )
+    {
+        return;
+    }
+    const uint32_t zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mask_buffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+GpuCollider::GpuCollider(size_t contact_capacity) : contact_capacity(contact_capacity) {}
+
+GpuCollider::~GpuCollider() { release(); }
+
+bool GpuCollider::initialize()
+{
+    release();
+    log.clear();
+
+    GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 1, &kCollideShader, nullptr);
+    glCompileShader(shader);
+    if ( !check_shader(shader, log) )
+    {
+        glDeleteShader(shader);
+        return false;
+    }
+
+    program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    glDeleteShader(shader);
+    if ( !check_program(program, log) )
+    {
+        glDeleteProgram(program);
+        program = 0;
+        return false;
+    }
+
+    first_to_second_location = glGetUniformLocation(program, "first_to_second");
+    leaf_count_location = glGetUniformLocation(program, "leaf_count");
+    contact_capacity_location = glGetUniformLocation(program, "contact_capacity");
+
+    create_buffer(contact_buffer, kContactHeader + contact_capacity * sizeof(ContactPair), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    reset();
+    return true;
+}
+
+void GpuCollider::release()
+{
+    if ( program != 0 )
+    {
+        glDeleteProgram(program);
+        program = 0;
+    }
+    delete_buffer(contact_buffer);
+}
+
+void GpuCollider::reset()
+{
+    if ( contact_buffer == 0 )
+    {
+        return;
+    }
+    const uint32_t header[2] = { 0, 0 };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, contact_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, kContactHeader, header);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GpuCollider::collide(const GpuBVH& first, const glm::mat4& first_matrix, const GpuBVH& second,
+                          const glm::mat4& second_matrix)
+{
+    if ( program == 0 || first.empty() || second.empty() )
+    {
+        return;
+    }
+
+    glm::mat4 firstToSecond = glm::inverse(second_matrix) * first_matrix;
+    glUseProgram(program);
+    glUniformMatrix4fv(first_to_second_location, 1, GL_FALSE, &firstToSecond[0][0]);
+    glUniform1ui(leaf_count_location, first.leaf_count);
+    glUniform1ui(contact_capacity_location, static_cast<GLuint>(contact_capacity));
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FirstLeaves, first.leaf_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FirstVertices, first.vertex_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FirstIds, first.id_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FirstMask, first.mask_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SecondNodes, second.node_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SecondVertices, second.vertex_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SecondIds, second.id_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SecondMask, second.mask_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Contacts, contact_buffer);
+
+    glDispatchCompute((first.leaf_count + kLocalSize - 1) / kLocalSize, 1, 1);
+    // the masks are read by later draw calls, the contacts by later queries or read_contacts
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    glUseProgram(0);
+}
+
+size_t GpuCollider::read_contacts(ContactBuffer& out) const
+{
+    out.clear();
+    if ( contact_buffer == 0 )
+    {
+        return 0;
+    }
+
+    uint32_t found = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, contact_buffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(found), &found);
+    out.contacts.resize(std::min<size_t>(found, contact_capacity));
+    if ( !out.contacts.empty() )
+    {
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, kContactHeader, out.contacts.size() * sizeof(ContactPair),
+                           out.contacts.data());
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return found;
+}
+
+} // namespace bvh
@@ -0,0 +1,163 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_flat.hpp"
+#include "bvh_indexed.hpp"
+#include "bvh_query.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace bvh {
+
+/**
+ * Maximum depth of a tree used as the second model of a GpuCollider query. Every shader invocation keeps its node
+ * stack in a fixed array, a tree of depth d needs d + 1 entries of it.
+ */
+constexpr uint32_t kGpuMaxDepth = 63;
+
+/**
+ * A flat BVH and the vertices of its triangles in shader storage buffers, uploaded once and used by every query of
+ * a GpuCollider. The buffers need an OpenGL 4.3 context, which must be current whenever a method is called.
+ *
+ * Besides the tree the model owns its contact mask: one uint per triangle in the order contacts refer to them
+ * (FlatBVH::triangles, or the mesh order of an IndexedBVH), nonzero if the triangle intersected anything in the
+ * queries since the last clear_mask. The mask stays on the GPU; bound as a shader storage buffer of the draw call it
+ * can drive the collision highlighting directly, for example indexed by gl_PrimitiveID, without reading anything back.
+ */
+class GpuBVH
+{
+  public:
+    GpuBVH() = default;
+    ~GpuBVH();
+
+    GpuBVH(const GpuBVH&) = delete;
+    GpuBVH& operator=(const GpuBVH&) = delete;
+    GpuBVH(GpuBVH&& other) noexcept;
+    GpuBVH& operator=(GpuBVH&& other) noexcept;
+
+    /**
+     * Uploads the tree and the vertices of its triangles (in model space), replacing the previous contents. The
+     * triangles are copied, a model whose vertices change has to be uploaded again after the refit.
+     *
+     * @return	False (and nothing is uploaded) if the tree is empty or deeper than kGpuMaxDepth.
+     */
+    bool upload(const FlatBVHView& bvh);
+    bool upload(const IndexedBVH& bvh);
+
+    /** Frees the buffers. */
+    void release();
+
+    /** Zeroes the contact mask, normally once per frame before the queries. */
+    void clear_mask();
+
+    bool empty() const { return leaf_count == 0; }
+    uint32_t get_triangle_count() const { return triangle_count; }
+
+    /** The buffer object of the contact mask, one uint per triangle. */
+    GLuint get_contact_mask() const { return mask_buffer; }
+
+  private:
+    friend class GpuCollider;
+
+    /** Uploads the prepared arrays; vertices has three entries per triangle in leaf order. */
+    void upload(ArrayView<FlatNode> nodes, const std::vector<glm::vec4>& vertices,
+                const std::vector<uint32_t>& triangle_ids);
+
+    /** All nodes in depth first order. */
+    GLuint node_buffer = 0;
+    /** Copies of the leaves only, each query invocation starts from one of them. */
+    GLuint leaf_buffer = 0;
+    /** Three vertices per triangle in leaf order. */
+    GLuint vertex_buffer = 0;
+    /** The index of every triangle in leaf order, as reported by the contacts and used by the mask. */
+    GLuint id_buffer = 0;
+    GLuint mask_buffer = 0;
+
+    uint32_t leaf_count = 0;
+    uint32_t triangle_count = 0;
+};
+
+/**
+ * Collision query running as an OpenGL compute shader. Every shader invocation takes one leaf of the first tree,
+ * transforms its box into the space of the second model and traverses the second tree with it, using a stack in
+ * registers; the triangles of overlapping leaves are tested pairwise. Found pairs are appended to a contact buffer
+ * through an atomic counter and marked in the contact masks of both models.
+ *
+ * The query does not wait for the GPU: collide only dispatches the shader (and issues the memory barrier the draw
+ * calls reading the masks need), so a frame can run the queries of all pairs, then draw with the masks. read_contacts
+ * is the only method reading results back and stalls until the dispatched work is done.
+ *
+ * The triangles are tested by separating axes in single precision, which may disagree with the CPU test on triangles
+ * that just touch. The contacts are appended in no particular order.
+ */
+class GpuCollider
+{
+  public:
+    /** @param 	contact_capacity	Maximum number of contacts stored between two calls to reset. */
+    explicit GpuCollider(size_t contact_capacity = 1 << 16);
+    ~GpuCollider();
+
+    GpuCollider(const GpuCollider&) = delete;
+    GpuCollider& operator=(const GpuCollider&) = delete;
+
+    /**
+     * Compiles the shader and creates the contact buffer. Called once with the context current.
+     *
+     * @return	False if the shader does not compile or link, get_log() then tells why.
+     */
+    bool initialize();
+
+    /** Frees the shader and the buffer. */
+    void release();
+
+    bool is_initialized() const { return program != 0; }
+    const std::string& get_log() const { return log; }
+
+    /** Empties the contact buffer. The masks of the models are cleared by GpuBVH::clear_mask. */
+    void reset();
+
+    /**
+     * Dispatches the query of a model pair. The contacts are appended to the ones of the queries since the last reset.
+     * Put the model with more leaves first, the first tree gives the number of shader invocations.
+     */
+    void collide(const GpuBVH& first, const glm::mat4& first_matrix, const GpuBVH& second,
+                 const glm::mat4& second_matrix);
+
+    /**
+     * Reads the contacts found since the last reset back into out.contacts (out.node_pairs is cleared). Waits for the
+     * GPU.
+     *
+     * @return	The number of contacts found, more than were read if the capacity did not suffice.
+     */
+    size_t read_contacts(ContactBuffer& out) const;
+
+    /**
+     * The buffer object of the contacts: a uint count, a uint of padding, then pairs of uints as in ContactPair. The
+     * count keeps growing past the capacity, only the first contact_capacity pairs are stored.
+     */
+    GLuint get_contact_buffer() const { return contact_buffer; }
+
+    size_t get_contact_capacity() const { return contact_capacity; }
+
+  private:
+    size_t contact_capacity;
+    GLuint program = 0;
+    GLuint contact_buffer = 0;
+
+    GLint first_to_second_location = -1;
+    GLint leaf_count_location = -1;
+    GLint contact_capacity_location = -1;
+
+    std::string log;
+};
+
+} // namespace bvh
@@ -0,0 +1,101 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_flat.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace bvh {
+
+/**
+ * Vertex positions owned elsewhere, three floats each and stride bytes apart, so an interleaved vertex buffer (for
+ * example a mapped GPU buffer holding normals and texture coordinates as well) is used as it is.
+ */
+struct VertexView
+{
+    const unsigned char* data = nullptr;
+    size_t count = 0;
+    size_t stride = sizeof(glm::vec3);
+
+    VertexView() = default;
+    VertexView(const void* data, size_t count, size_t stride = sizeof(glm::vec3))
+        : data(static_cast<const unsigned char*>(data)), count(count), stride(stride)
+    {
+    }
+    VertexView(const std::vector<glm::vec3>& vertices) : VertexView(vertices.data(), vertices.size()) {}
+
+    glm::vec3 operator[](size_t i) const
+    {
+        float position[3];
+        std::memcpy(position, data + i * stride, sizeof(position));
+        return glm::vec3(position[0], position[1], position[2]);
+    }
+
+    size_t size() const { return count; }
+};
+
+/** The three vertices of a triangle, as passed to the triangle tests. */
+struct TriangleVertices
+{
+    glm::vec3 v[3];
+};
+
+/** Indexed triangle mesh owned elsewhere: a shared vertex buffer and three vertex indices per triangle. */
+struct IndexedMesh
+{
+    VertexView vertices;
+    ArrayView<uint32_t> indices;
+
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    TriangleVertices triangle(size_t index) const
+    {
+        const uint32_t* corners = &indices[3 * index];
+        return TriangleVertices{ { vertices[corners[0]], vertices[corners[1]], vertices[corners[2]] } };
+    }
+};
+
+/**
+ * Flat BVH over an indexed mesh. The nodes are the same as in FlatBVH; instead of pointers to Triangle objects the
+ * tree keeps a copy of the index buffer reordered into leaf order, so the triangles of a leaf are consecutive index
+ * triples and only the vertices are read through the shared buffer. A leaf with offset o and count n holds the
+ * triangles o to o + n - 1 of that order.
+ */
+struct IndexedBVH
+{
+    /** Nodes in depth first order, the root is the first one. */
+    std::vector<FlatNode> nodes;
+    /** Three vertex indices per triangle, in leaf order. */
+    std::vector<uint32_t> indices;
+    /** The index in the mesh of every triangle in leaf order; contacts refer to triangles by these. */
+    std::vector<uint32_t> triangle_ids;
+    /** The vertices of the mesh (not owned). */
+    VertexView vertices;
+
+    bool empty() const { return nodes.empty(); }
+
+    static uint32_t left(uint32_t node) { return node + 1; }
+    uint32_t right(uint32_t node) const { return nodes[node].offset; }
+
+    /** The i-th triangle of the given leaf. */
+    TriangleVertices leaf_triangle(const FlatNode& leaf, uint32_t i) const
+    {
+        const uint32_t* corners = &indices[3 * (leaf.offset + i)];
+        return TriangleVertices{ { vertices[corners[0]], vertices[corners[1]], vertices[corners[2]] } };
+    }
+
+    /** The index in the mesh of the i-th triangle of the given leaf. */
+    uint32_t leaf_triangle_id(const FlatNode& leaf, uint32_t i) const { return triangle_ids[leaf.offset + i]; }
+};
+
+} // namespace bvh
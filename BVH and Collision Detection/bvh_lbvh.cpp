@@ -0,0 +1,628 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_lbvh.hpp"
+
+#include "bvh_bounds.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace bvh {
+namespace {
+
+// set in a child reference of the intermediate tree that points at a leaf (a position in the sorted order)
+constexpr uint32_t kLeafFlag = 0x80000000u;
+constexpr int kRadixBits = 8;
+constexpr size_t kRadixBuckets = size_t(1) << kRadixBits;
+// elements per task of the parallel passes, and chunks per thread of the radix sort
+constexpr size_t kParallelGrain = size_t(1) << 14;
+constexpr size_t kSortChunksPerThread = 4;
+constexpr int kMaxTreeletLeaves = 7;
+
+inline int leading_zeros(uint32_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return 31 - static_cast<int>(index);
+#else
+    return __builtin_clz(value);
+#endif
+}
+
+inline int leading_zeros(uint64_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return 63 - static_cast<int>(index);
+#else
+    return __builtin_clzll(value);
+#endif
+}
+
+/** Spreads the lowest 10 bits of the value so that there are two zero bits between every two of them. */
+uint32_t spread_bits(uint32_t value)
+{
+    value = (value | (value << 16)) & 0x030000FFu;
+    value = (value | (value << 8)) & 0x0300F00Fu;
+    value = (value | (value << 4)) & 0x030C30C3u;
+    value = (value | (value << 2)) & 0x09249249u;
+    return value;
+}
+
+/** The same for the lowest 21 bits. */
+uint64_t spread_bits(uint64_t value)
+{
+    value &= 0x1FFFFFull;
+    value = (value | (value << 32)) & 0x001F00000000FFFFull;
+    value = (value | (value << 16)) & 0x001F0000FF0000FFull;
+    value = (value | (value << 8)) & 0x100F00F00F00F00Full;
+    value = (value | (value << 4)) & 0x10C30C30C30C30C3ull;
+    value = (value | (value << 2)) & 0x1249249249249249ull;
+    return value;
+}
+
+/** Morton code of a point given relative to the centroid bounds, every coordinate in [0, 1]. */
+template <typename Code>
+Code morton_code(const glm::vec3& point)
+{
+    constexpr int kAxisBits = sizeof(Code) == 4 ? 10 : 21;
+    constexpr float kCells = static_cast<float>(1u << kAxisBits);
+
+    Code code = 0;
+    for ( int axis = 0; axis < 3; ++axis )
+    {
+        Code cell = static_cast<Code>(std::min(std::max(point[axis] * kCells, 0.0f), kCells - 1.0f));
+        code |= spread_bits(cell) << (2 - axis);
+    }
+    return code;
+}
+
+/** Runs body(begin, end) over [0, count), in parallel chunks if there is a pool. */
+template <typename Body>
+void for_range(ThreadPool* pool, size_t count, size_t grain, const Body& body)
+{
+    if ( pool != nullptr && count > grain )
+    {
+        parallel_for(*pool, 0, count, grain, body);
+    }
+    else
+    {
+        body(0, count);
+    }
+}
+
+/**
+ * Stable LSD radix sort of the keys and the values that go with them, one byte per pass. Every chunk of the input
+ * counts its digits, the counts give every chunk its output range per digit and the chunks then scatter their
+ * elements in parallel. Passes over a byte in which all keys agree are skipped.
+ */
+template <typename Key>
+void radix_sort(std::vector<Key>& keys, std::vector<uint32_t>& values, int key_bits, ThreadPool* pool)
+{
+    size_t count = keys.size();
+    size_t chunkCount = 1;
+    if ( pool != nullptr )
+    {
+        size_t chunksByGrain = (count + kParallelGrain - 1) / kParallelGrain;
+        chunkCount = std::max<size_t>(1, std::min(kSortChunksPerThread * pool->get_concurrency(), chunksByGrain));
+    }
+    size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+    std::vector<Key> keysOut(count);
+    std::vector<uint32_t> valuesOut(count);
+    std::vector<size_t> histograms(chunkCount * kRadixBuckets);
+
+    auto forEachChunk = [&](auto body) {
+        auto run = [&](size_t chunk) { body(chunk, chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize)); };
+        if ( chunkCount > 1 )
+        {
+            parallel_for(*pool, 0, chunkCount, 1, [&](size_t chunk, size_t) { run(chunk); });
+        }
+        else
+        {
+            run(0);
+        }
+    };
+
+    for ( int shift = 0; shift < key_bits; shift += kRadixBits )
+    {
+        std::fill(histograms.begin(), histograms.end(), size_t(0));
+        forEachChunk([&](size_t chunk, size_t begin, size_t end) {
+            size_t* histogram = &histograms[chunk * kRadixBuckets];
+            for ( size_t i = begin; i < end; ++i )
+            {
+                histogram[(keys[i] >> shift) & (kRadixBuckets - 1)]++;
+            }
+        });
+
+        // exclusive prefix sum in digit major order, so that chunk c's elements of a digit follow those of c - 1
+        size_t offset = 0;
+        bool trivial = false;
+        for ( size_t digit = 0; digit < kRadixBuckets; ++digit )
+        {
+            size_t digitStart = offset;
+            for ( size_t chunk = 0; chunk < chunkCount; ++chunk )
+            {
+                size_t& entry = histograms[chunk * kRadixBuckets + digit];
+                size_t entryCount = entry;
+                entry = offset;
+                offset += entryCount;
+            }
+            trivial |= offset - digitStart == count;
+        }
+        if ( trivial )
+        {
+            continue;
+        }
+
+        forEachChunk([&](size_t chunk, size_t begin, size_t end) {
+            size_t* next = &histograms[chunk * kRadixBuckets];
+            for ( size_t i = begin; i < end; ++i )
+            {
+                size_t position = next[(keys[i] >> shift) & (kRadixBuckets - 1)]++;
+                keysOut[position] = keys[i];
+                valuesOut[position] = values[i];
+            }
+        });
+        keys.swap(keysOut);
+        values.swap(valuesOut);
+    }
+}
+
+/**
+ * Intermediate binary tree with n - 1 interior nodes and n single triangle leaves, the leaves being the positions in
+ * the sorted order. The interior nodes are emitted by Karras's method, optimized in place and finally laid out depth
+ * first into the FlatBVH.
+ */
+class LinearBuilder
+{
+  public:
+    LinearBuilder(const std::vector<Triangle*>& triangles, const LbvhSettings& settings, ThreadPool* pool)
+        : triangles(triangles), settings(settings), pool(pool)
+    {
+    }
+
+    FlatBVH build()
+    {
+        size_t count = triangles.size();
+        leaf_bounds.resize(count);
+
+        for_range(pool, count, kParallelGrain, [&](size_t begin, size_t end) {
+            for ( size_t i = begin; i < end; ++i )
+            {
+                leaf_bounds[i] = triangle_bounds(*triangles[i]);
+            }
+        });
+
+        if ( settings.morton_bits > 32 )
+        {
+            sort_and_emit<uint64_t>(63);
+        }
+        else
+        {
+            sort_and_emit<uint32_t>(30);
+        }
+
+        if ( count > 1 )
+        {
+            compute_bounds();
+            for ( int pass = 0; pass < settings.treelet_passes; ++pass )
+            {
+                optimize_treelets();
+            }
+        }
+        return layout();
+    }
+
+  private:
+    template <typename Code>
+    void sort_and_emit(int bits)
+    {
+        size_t count = triangles.size();
+
+        // the centroid bounds, reduced over the chunks of the parallel pass
+        size_t chunkCount = (count + kParallelGrain - 1) / kParallelGrain;
+        std::vector<Aabb> partial(chunkCount);
+        for_range(pool, count, kParallelGrain, [&](size_t begin, size_t end) {
+            Aabb& bounds = partial[begin / kParallelGrain];
+            for ( size_t i = begin; i < end; ++i )
+            {
+                bounds.grow(leaf_bounds[i].center());
+            }
+        });
+        Aabb centroidBounds;
+        for ( const Aabb& bounds : partial )
+        {
+            centroidBounds.grow(bounds);
+        }
+
+        glm::vec3 extent = centroidBounds.extent();
+        glm::vec3 scale(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                        extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+        std::vector<Code> codes(count);
+        sorted.resize(count);
+        for_range(pool, count, kParallelGrain, [&](size_t begin, size_t end) {
+            for ( size_t i = begin; i < end; ++i )
+            {
+                codes[i] = morton_code<Code>((leaf_bounds[i].center() - centroidBounds.min) * scale);
+                sorted[i] = static_cast<uint32_t>(i);
+            }
+        });
+        radix_sort(codes, sorted, bits, pool);
+
+        // the leaf boxes are needed in sorted order from here on
+        std::vector<Aabb> sortedBounds(count);
+        for_range(pool, count, kParallelGrain, [&](size_t begin, size_t end) {
+            for ( size_t i = begin; i < end; ++i )
+            {
+                sortedBounds[i] = leaf_bounds[sorted[i]];
+            }
+        });
+        leaf_bounds.swap(sortedBounds);
+
+        if ( count > 1 )
+        {
+            emit_nodes(codes);
+        }
+    }
+
+    /**
+     * Finds the range of leaves and the split of every interior node from the sorted codes alone (Karras 2012,
+     * Figure 4), so that all nodes can be emitted in parallel. Equal codes are told apart by their positions.
+     */
+    template <typename Code>
+    void emit_nodes(const std::vector<Code>& codes)
+    {
+        constexpr int kCodeBits = 8 * sizeof(Code);
+        int64_t count = static_cast<int64_t>(codes.size());
+
+        // length of the common prefix of the codes at i and j, -1 if j is out of range
+        auto delta = [&](int64_t i, int64_t j) {
+            if ( j < 0 || j >= count )
+            {
+                return -1;
+            }
+            Code difference = codes[i] ^ codes[j];
+            if ( difference != 0 )
+            {
+                return leading_zeros(difference);
+            }
+            return kCodeBits + leading_zeros(static_cast<uint32_t>(i ^ j));
+        };
+
+        children.resize(2 * (codes.size() - 1));
+        for_range(pool, codes.size() - 1, kParallelGrain, [&](size_t begin, size_t end) {
+            for ( int64_t i = static_cast<int64_t>(begin); i < static_cast<int64_t>(end); ++i )
+            {
+                // the direction of the range and its far end
+                int64_t direction = delta(i, i + 1) - delta(i, i - 1) >= 0 ? 1 : -1;
+                int minDelta = delta(i, i - direction);
+
+                int64_t maxLength = 2;
+                while ( delta(i, i + maxLength * direction) > minDelta )
+                {
+                    maxLength *= 2;
+                }
+                int64_t length = 0;
+                for ( int64_t step = maxLength / 2; step >= 1; step /= 2 )
+                {
+                    if ( delta(i, i + (length + step) * direction) > minDelta )
+                    {
+                        length += step;
+                    }
+                }
+                int64_t j = i + length * direction;
+
+                // the split is where the common prefix of the range ends
+                int nodeDelta = delta(i, j);
+                int64_t offset = 0;
+                for ( int64_t divisor = 2;; divisor *= 2 )
+                {
+                    int64_t step = (length + divisor - 1) / divisor;
+                    if ( delta(i, i + (offset + step) * direction) > nodeDelta )
+                    {
+                        offset += step;
+                    }
+                    if ( step == 1 )
+                    {
+                        break;
+                    }
+                }
+                int64_t split = i + offset * direction + std::min<int64_t>(direction, 0);
+
+                uint32_t left = static_cast<uint32_t>(split);
+                uint32_t right = static_cast<uint32_t>(split + 1);
+                children[2 * i] = std::min(i, j) == split ? (kLeafFlag | left) : left;
+                children[2 * i + 1] = std::max(i, j) == split + 1 ? (kLeafFlag | right) : right;
+            }
+        });
+    }
+
+    /** The interior nodes in post-order, children before their parents. */
+    void collect_post_order()
+    {
+        post_order.clear();
+        std::vector<std::pair<uint32_t, bool>> stack{ { 0u, false } };
+        while ( !stack.empty() )
+        {
+            auto entry = stack.back();
+            stack.pop_back();
+            if ( entry.second )
+            {
+                post_order.push_back(entry.first);
+                continue;
+            }
+
+            stack.push_back({ entry.first, true });
+            for ( int side = 1; side >= 0; --side )
+            {
+                uint32_t child = children[2 * entry.first + side];
+                if ( (child & kLeafFlag) == 0 )
+                {
+                    stack.push_back({ child, false });
+                }
+            }
+        }
+    }
+
+    Aabb bounds_of(uint32_t ref) const { return (ref & kLeafFlag) ? leaf_bounds[ref & ~kLeafFlag] : inner_bounds[ref]; }
+    float cost_of(uint32_t ref) const
+    {
+        return (ref & kLeafFlag) ? settings.intersection_cost * leaf_bounds[ref & ~kLeafFlag].surface_area()
+                                 : inner_cost[ref];
+    }
+
+    /** Boxes and SAH costs of the interior nodes, bottom up. */
+    void compute_bounds()
+    {
+        size_t innerCount = children.size() / 2;
+        inner_bounds.resize(innerCount);
+        inner_cost.resize(innerCount);
+
+        collect_post_order();
+        for ( uint32_t node : post_order )
+        {
+            update_node(node);
+        }
+    }
+
+    void update_node(uint32_t node)
+    {
+        uint32_t left = children[2 * node];
+        uint32_t right = children[2 * node + 1];
+        Aabb bounds = bounds_of(left);
+        bounds.grow(bounds_of(right));
+        inner_bounds[node] = bounds;
+        inner_cost[node] = settings.traversal_cost * bounds.surface_area() + cost_of(left) + cost_of(right);
+    }
+
+    /**
+     * One treelet optimization pass (Karras and Aila 2013). Bottom up, every interior node roots a treelet that is
+     * grown by repeatedly opening its largest interior leaf; the topology of the treelet over its leaves with the
+     * lowest SAH cost is then found by dynamic programming over all subsets of the leaves, and the treelet is rebuilt
+     * in it if that is cheaper, reusing the treelet's interior nodes.
+     */
+    void optimize_treelets()
+    {
+        int maxLeaves = std::min(std::max(settings.treelet_leaves, 3), kMaxTreeletLeaves);
+        collect_post_order();
+
+        for ( uint32_t root : post_order )
+        {
+            uint32_t leaves[kMaxTreeletLeaves] = { children[2 * root], children[2 * root + 1] };
+            uint32_t interiors[kMaxTreeletLeaves - 1] = { root };
+            int leafCount = 2;
+            int interiorCount = 1;
+
+            while ( leafCount < maxLeaves )
+            {
+                int largest = -1;
+                float largestArea = -1.0f;
+                for ( int i = 0; i < leafCount; ++i )
+                {
+                    if ( (leaves[i] & kLeafFlag) == 0 && inner_bounds[leaves[i]].surface_area() > largestArea )
+                    {
+                        largest = i;
+                        largestArea = inner_bounds[leaves[i]].surface_area();
+                    }
+                }
+                if ( largest < 0 )
+                {
+                    break;
+                }
+
+                uint32_t opened = leaves[largest];
+                interiors[interiorCount++] = opened;
+                leaves[largest] = children[2 * opened];
+                leaves[leafCount++] = children[2 * opened + 1];
+            }
+            if ( leafCount < 3 )
+            {
+                continue;
+            }
+
+            // cheapest topology of every subset of the leaves, built from the cheapest ones of its two parts
+            int subsetCount = 1 << leafCount;
+            for ( int i = 0; i < leafCount; ++i )
+            {
+                subset_bounds[1 << i] = bounds_of(leaves[i]);
+                subset_cost[1 << i] = cost_of(leaves[i]);
+            }
+            for ( int subset = 1; subset < subsetCount; ++subset )
+            {
+                if ( (subset & (subset - 1)) == 0 )
+                {
+                    continue;
+                }
+
+                int lowest = subset & -subset;
+                subset_bounds[subset] = subset_bounds[lowest];
+                subset_bounds[subset].grow(subset_bounds[subset ^ lowest]);
+
+                // every partition once: the part holding the lowest leaf, which cannot be the whole subset
+                float best = std::numeric_limits<float>::max();
+                for ( int part = (subset - 1) & subset; part != 0; part = (part - 1) & subset )
+                {
+                    if ( (part & lowest) == 0 )
+                    {
+                        continue;
+                    }
+                    float cost = subset_cost[part] + subset_cost[subset ^ part];
+                    if ( cost < best )
+                    {
+                        best = cost;
+                        subset_split[subset] = part;
+                    }
+                }
+                subset_cost[subset] = settings.traversal_cost * subset_bounds[subset].surface_area() + best;
+            }
+
+            update_node(root);
+            if ( subset_cost[subsetCount - 1] >= inner_cost[root] * (1.0f - 1e-6f) )
+            {
+                continue;
+            }
+
+            // rebuild the treelet top down, the root keeps its index and so its place in the parent
+            int nextInterior = 1;
+            rebuild(root, subsetCount - 1, leaves, interiors, nextInterior);
+        }
+    }
+
+    void rebuild(uint32_t node, int subset, const uint32_t* leaves, const uint32_t* interiors, int& next_interior)
+    {
+        int parts[2] = { subset_split[subset], subset ^ subset_split[subset] };
+        for ( int side = 0; side < 2; ++side )
+        {
+            int part = parts[side];
+            if ( (part & (part - 1)) == 0 )
+            {
+                int leaf = 0;
+                while ( (1 << leaf) != part )
+                {
+                    leaf++;
+                }
+                children[2 * node + side] = leaves[leaf];
+                continue;
+            }
+
+            uint32_t child = interiors[next_interior++];
+            children[2 * node + side] = child;
+            rebuild(child, part, leaves, interiors, next_interior);
+        }
+        inner_bounds[node] = subset_bounds[subset];
+        inner_cost[node] = subset_cost[subset];
+    }
+
+    /** Writes the intermediate tree depth first into the flat layout. */
+    FlatBVH layout() const
+    {
+        FlatBVH bvh;
+        bvh.triangles = triangles;
+        bvh.nodes.reserve(2 * triangles.size() - 1);
+        bvh.triangle_indices.reserve(triangles.size());
+
+        // the root is leaf 0 if there is a single triangle
+        struct Entry
+        {
+            uint32_t ref;
+            uint32_t parent;
+        };
+        constexpr uint32_t kNoParent = std::numeric_limits<uint32_t>::max();
+        std::vector<Entry> stack{ Entry{ triangles.size() > 1 ? 0u : kLeafFlag, kNoParent } };
+
+        while ( !stack.empty() )
+        {
+            Entry entry = stack.back();
+            stack.pop_back();
+
+            uint32_t index = static_cast<uint32_t>(bvh.nodes.size());
+            if ( entry.parent != kNoParent )
+            {
+                // only right children are popped with their parent, a left child is simply the next node
+                bvh.nodes[entry.parent].offset = index;
+            }
+
+            Aabb bounds = bounds_of(entry.ref);
+            FlatNode node;
+            node.min = bounds.min;
+            node.max = bounds.max;
+            if ( entry.ref & kLeafFlag )
+            {
+                node.offset = static_cast<uint32_t>(bvh.triangle_indices.size());
+                node.count = 1;
+                bvh.triangle_indices.push_back(sorted[entry.ref & ~kLeafFlag]);
+            }
+            else
+            {
+                node.offset = 0;
+                node.count = 0;
+                stack.push_back(Entry{ children[2 * entry.ref + 1], index });
+                stack.push_back(Entry{ children[2 * entry.ref], kNoParent });
+            }
+            bvh.nodes.push_back(node);
+        }
+        return bvh;
+    }
+
+    const std::vector<Triangle*>& triangles;
+    const LbvhSettings& settings;
+    ThreadPool* pool;
+
+    /** Triangle index of every sorted position, and the leaf boxes in sorted order. */
+    std::vector<uint32_t> sorted;
+    std::vector<Aabb> leaf_bounds;
+    /** Left and right child references of every interior node, node 0 is the root. */
+    std::vector<uint32_t> children;
+    std::vector<Aabb> inner_bounds;
+    std::vector<float> inner_cost;
+    std::vector<uint32_t> post_order;
+
+    // scratch of the treelet optimization
+    Aabb subset_bounds[1 << kMaxTreeletLeaves];
+    float subset_cost[1 << kMaxTreeletLeaves];
+    int subset_split[1 << kMaxTreeletLeaves];
+};
+
+} // namespace
+
+FlatBVH construct_lbvh(const std::vector<Triangle*>& triangles, const LbvhSettings& settings)
+{
+    unsigned threads = ThreadPool::resolve_thread_count(settings.threads);
+    if ( threads > 1 )
+    {
+        ThreadPool pool(threads - 1);
+        return construct_lbvh(triangles, settings, pool);
+    }
+
+    if ( triangles.empty() )
+    {
+        throw std::invalid_argument("bvh::construct_lbvh: cannot build a BVH without triangles");
+    }
+    return LinearBuilder(triangles, settings, nullptr).build();
+}
+
+FlatBVH construct_lbvh(const std::vector<Triangle*>& triangles, const LbvhSettings& settings, ThreadPool& pool)
+{
+    if ( triangles.empty() )
+    {
+        throw std::invalid_argument("bvh::construct_lbvh: cannot build a BVH without triangles");
+    }
+    return LinearBuilder(triangles, settings, &pool).build();
+}
+
+} // namespace bvh
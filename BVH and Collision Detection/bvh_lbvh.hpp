@@ -0,0 +1,54 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_flat.hpp"
+#include "bvh_thread_pool.hpp"
+
+#include <vector>
+
+namespace bvh {
+
+/** Options of the linear BVH builder. */
+struct LbvhSettings
+{
+    /** Length of the Morton codes: 30 (10 bits per axis) or 63 (21 bits per axis, for large or dense models). */
+    int morton_bits = 30;
+    /**
+     * Number of treelet optimization passes run over the tree, 0 skips the optimization. Every pass restructures
+     * each treelet of up to treelet_leaves subtrees into the topology with the lowest SAH cost.
+     */
+    int treelet_passes = 0;
+    /** Subtrees per treelet, between 3 and 7; the cost of a pass grows as 3^treelet_leaves. */
+    int treelet_leaves = 7;
+    /** SAH costs used by the treelet optimization. */
+    float traversal_cost = 1.0f;
+    float intersection_cost = 1.0f;
+    /** Threads used by the build, as BuildSettings::threads. */
+    unsigned threads = 1;
+};
+
+/**
+ * Builds a flat BVH from the Morton order of the triangle centroids (Karras, "Maximizing Parallelism in the
+ * Construction of BVHs, Octrees, and k-d Trees", 2012). The codes are radix sorted and every interior node is then
+ * found independently from the sorted codes, so the build is linear in the triangle count and parallel all along
+ * except for two sweeps over the finished tree. Every leaf holds a single triangle. The trees cost somewhat more to
+ * traverse than the SAH ones, which the treelet optimization (Karras and Aila, "Fast Parallel Construction of
+ * High-Quality Bounding Volume Hierarchies", 2013) mostly makes up for at the price of a slower build.
+ *
+ * @param 	triangles	The triangles of the model, at least one.
+ * @param 	settings 	The build options.
+ * @return	The tree, in the same layout as the one from construct_flat.
+ */
+FlatBVH construct_lbvh(const std::vector<Triangle*>& triangles, const LbvhSettings& settings = LbvhSettings());
+
+/** The same build running on the given pool (settings.threads is ignored). */
+FlatBVH construct_lbvh(const std::vector<Triangle*>& triangles, const LbvhSettings& settings, ThreadPool& pool);
+
+} // namespace bvh
@@ -0,0 +1,121 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_quantized.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace bvh {
+namespace {
+
+template <typename Code>
+class Quantizer
+{
+  public:
+    using Grid = QuantizationGrid<Code>;
+
+    Quantizer(const FlatBVH& flat, QuantizedBVH<Code>& quantized) : flat(flat), quantized(quantized) {}
+
+    /** Emits the given flat node, whose box as the traversal will decode it is given. Returns its reference. */
+    uint32_t emit(uint32_t flat_node, const Aabb& decoded)
+    {
+        const FlatNode& node = flat.nodes[flat_node];
+        if ( node.is_leaf() )
+        {
+            quantized.leaves.push_back(QuantizedLeaf{ node.offset, node.count });
+            return kQuantizedLeafBit | static_cast<uint32_t>(quantized.leaves.size() - 1);
+        }
+
+        uint32_t index = static_cast<uint32_t>(quantized.nodes.size());
+        quantized.nodes.emplace_back();
+
+        uint32_t children[2] = { FlatBVH::left(flat_node), flat.right(flat_node) };
+        for ( int slot = 0; slot < 2; ++slot )
+        {
+            const FlatNode& child = flat.nodes[children[slot]];
+            for ( int axis = 0; axis < 3; ++axis )
+            {
+                Grid grid(decoded.min[axis], decoded.max[axis]);
+                quantized.nodes[index].min[slot][axis] = static_cast<Code>(encode_min(grid, child.min[axis]));
+                quantized.nodes[index].max[slot][axis] = static_cast<Code>(encode_max(grid, child.max[axis]));
+            }
+        }
+
+        // the children are encoded relative to the boxes the traversal will decode, not to the exact ones
+        for ( int slot = 0; slot < 2; ++slot )
+        {
+            Aabb childBox = decode_child(decoded, quantized.nodes[index], slot);
+            uint32_t child = emit(children[slot], childBox);
+            quantized.nodes[index].child[slot] = child;
+        }
+        return index;
+    }
+
+  private:
+    /** The largest grid point not above value. */
+    static uint32_t encode_min(const Grid& grid, float value)
+    {
+        if ( grid.step <= 0.0f )
+        {
+            return 0;
+        }
+        float steps = std::floor((value - grid.min) / grid.step);
+        uint32_t code = static_cast<uint32_t>(std::min(std::max(steps, 0.0f), static_cast<float>(Grid::kMaxCode)));
+        // float rounding may still put the decoded point above the value
+        while ( code > 0 && grid.decode(code) > value )
+        {
+            code--;
+        }
+        return code;
+    }
+
+    /** The smallest grid point not below value. */
+    static uint32_t encode_max(const Grid& grid, float value)
+    {
+        if ( grid.step <= 0.0f )
+        {
+            return Grid::kMaxCode;
+        }
+        float steps = std::ceil((value - grid.min) / grid.step);
+        uint32_t code = static_cast<uint32_t>(std::min(std::max(steps, 0.0f), static_cast<float>(Grid::kMaxCode)));
+        while ( code < Grid::kMaxCode && grid.decode(code) < value )
+        {
+            code++;
+        }
+        return code;
+    }
+
+    const FlatBVH& flat;
+    QuantizedBVH<Code>& quantized;
+};
+
+} // namespace
+
+template <typename Code>
+QuantizedBVH<Code> quantize(const FlatBVH& bvh)
+{
+    QuantizedBVH<Code> quantized;
+    if ( bvh.empty() )
+    {
+        return quantized;
+    }
+
+    quantized.triangle_indices = bvh.triangle_indices;
+    quantized.triangles = bvh.triangles;
+    quantized.bounds = Aabb(bvh.nodes[0].min, bvh.nodes[0].max);
+    quantized.nodes.reserve(bvh.nodes.size() / 2);
+    quantized.leaves.reserve(bvh.nodes.size() / 2 + 1);
+
+    quantized.root = Quantizer<Code>(bvh, quantized).emit(0, quantized.bounds);
+    return quantized;
+}
+
+template QuantizedBVH<uint8_t> quantize<uint8_t>(const FlatBVH& bvh);
+template QuantizedBVH<uint16_t> quantize<uint16_t>(const FlatBVH& bvh);
+
+} // namespace bvh
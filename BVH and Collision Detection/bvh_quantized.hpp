@@ -0,0 +1,147 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_bounds.hpp"
+#include "bvh_flat.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace bvh {
+
+/** Set in a child reference that points into QuantizedBVH::leaves instead of QuantizedBVH::nodes. */
+constexpr uint32_t kQuantizedLeafBit = 0x80000000u;
+
+/**
+ * Interior node of a quantized BVH. The boxes of both children are stored as integer grid coordinates within the
+ * node's own box, which itself is only known from its parent; the grid has 2^bits - 1 steps per axis. Minimums are
+ * rounded down and maximums up, so the decoded boxes always contain the exact ones.
+ */
+template <typename Code>
+struct QuantizedNode
+{
+    Code min[2][3];
+    Code max[2][3];
+    /** Index of the child node, or kQuantizedLeafBit | index of the child leaf. */
+    uint32_t child[2];
+};
+
+static_assert(sizeof(QuantizedNode<uint8_t>) == 20, "8-bit quantized nodes are expected to take 20 bytes");
+static_assert(sizeof(QuantizedNode<uint16_t>) == 32, "16-bit quantized nodes are expected to take 32 bytes");
+
+/** Triangle range of a leaf, the same as the one of the corresponding FlatNode. */
+struct QuantizedLeaf
+{
+    uint32_t offset;
+    uint32_t count;
+};
+
+/**
+ * BVH with quantized child boxes. Only the box of the root is stored as floats; the boxes of all other nodes are
+ * decoded on the fly from their parent's while the tree is traversed. The triangle arrays have the same meaning as in
+ * FlatBVH.
+ */
+template <typename Code>
+struct QuantizedBVH
+{
+    std::vector<QuantizedNode<Code>> nodes;
+    std::vector<QuantizedLeaf> leaves;
+    /** Indices into triangles, in leaf order. */
+    std::vector<uint32_t> triangle_indices;
+    /** The triangles of the model in their original order (not owned). */
+    std::vector<Triangle*> triangles;
+
+    Aabb bounds;
+    /** Reference to the root, a leaf if the whole model is a single leaf. */
+    uint32_t root = 0;
+
+    bool empty() const { return leaves.empty(); }
+
+    /** Memory taken by the tree itself, without the triangle arrays. */
+    size_t get_node_bytes() const
+    {
+        return nodes.size() * sizeof(QuantizedNode<Code>) + leaves.size() * sizeof(QuantizedLeaf);
+    }
+};
+
+using QuantizedBVH8 = QuantizedBVH<uint8_t>;
+using QuantizedBVH16 = QuantizedBVH<uint16_t>;
+
+/** Grid along one axis of a node's box. The last grid point is the box maximum itself, so it never falls short. */
+template <typename Code>
+struct QuantizationGrid
+{
+    static constexpr uint32_t kMaxCode = std::numeric_limits<Code>::max();
+
+    float min;
+    float max;
+    float step;
+
+    QuantizationGrid(float min, float max) : min(min), max(max), step((max - min) / kMaxCode) {}
+
+    float decode(uint32_t code) const { return code == kMaxCode ? max : min + code * step; }
+};
+
+/** The box of a child of the node, computed from the node's own box. */
+template <typename Code>
+inline Aabb decode_child(const Aabb& parent, const QuantizedNode<Code>& node, int slot)
+{
+    Aabb box;
+    for ( int axis = 0; axis < 3; ++axis )
+    {
+        QuantizationGrid<Code> grid(parent.min[axis], parent.max[axis]);
+        box.min[axis] = grid.decode(node.min[slot][axis]);
+        box.max[axis] = grid.decode(node.max[slot][axis]);
+    }
+    return box;
+}
+
+/**
+ * Converts a flat tree into the quantized format, rounding every box outward on the grid of its decoded parent box.
+ *
+ * @param 	bvh	The tree, for example from construct_flat.
+ * @return	The quantized copy, sharing the triangle order of the flat one.
+ */
+template <typename Code>
+QuantizedBVH<Code> quantize(const FlatBVH& bvh);
+
+extern template QuantizedBVH<uint8_t> quantize<uint8_t>(const FlatBVH& bvh);
+extern template QuantizedBVH<uint16_t> quantize<uint16_t>(const FlatBVH& bvh);
+
+/** Traversal adapter for quantized trees; a handle carries the decoded box of its node. */
+template <typename Code>
+struct QuantizedTree
+{
+    struct Handle
+    {
+        uint32_t ref;
+        Aabb box;
+    };
+
+    const QuantizedBVH<Code>& bvh;
+
+    Handle root() const { return Handle{ bvh.root, bvh.bounds }; }
+    static bool is_leaf(const Handle& node) { return (node.ref & kQuantizedLeafBit) != 0; }
+    Handle left(const Handle& node) const { return child(node, 0); }
+    Handle right(const Handle& node) const { return child(node, 1); }
+    static Aabb bounds(const Handle& node) { return node.box; }
+
+    const QuantizedLeaf& leaf(const Handle& node) const { return bvh.leaves[node.ref & ~kQuantizedLeafBit]; }
+
+    Handle child(const Handle& node, int slot) const
+    {
+        const QuantizedNode<Code>& quantized = bvh.nodes[node.ref];
+        return Handle{ quantized.child[slot], decode_child(node.box, quantized, slot) };
+    }
+};
+
+} // namespace bvh
@@ -0,0 +1,732 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_query.hpp"
+
+#include <atomic>
+
+namespace bvh {
+namespace {
+
+// the parallel query splits the traversal into at least this many tasks per thread to balance the load
+constexpr size_t kTasksPerThread = 8;
+
+/** Node pair of the parallel task split: a pair already visited while splitting, or the start pair of a task. */
+struct FrontierItem
+{
+    uint32_t first;
+    uint32_t second;
+    bool visited;
+};
+
+/**
+ * Runs query(stats) with the counter policy selected by QuerySettings::stats, after resetting the counters. The two
+ * policies are separate instantiations of the query, so the choice is made once per query.
+ */
+template <typename Query>
+size_t with_stats(const QuerySettings& settings, Query query)
+{
+    if ( settings.stats != nullptr )
+    {
+        *settings.stats = QueryStats();
+        return query(CountStats{ settings.stats });
+    }
+    return query(NoStats());
+}
+
+/** Query policies: AllContacts finds every intersecting triangle pair, HitLimit stops after max_hits of them. */
+struct AllContacts
+{
+    static constexpr bool kLimited = false;
+
+    bool done(size_t) const { return false; }
+};
+
+struct HitLimit
+{
+    static constexpr bool kLimited = true;
+
+    size_t max_hits;
+
+    bool done(size_t hits) const { return hits >= max_hits; }
+};
+
+/** Runs query(limit) with the query policy selected by QuerySettings::max_hits. */
+template <typename Query>
+size_t with_hit_limit(const QuerySettings& settings, Query query)
+{
+    if ( settings.max_hits != 0 )
+    {
+        return query(HitLimit{ settings.max_hits });
+    }
+    return query(AllContacts());
+}
+
+/**
+ * Runs query(overlap, leaves) with the BoxOverlap and the leaf kernel selected by the settings. Together with the query
+ * and counter policies every box test and kernel gets a traversal of its own, with no switch left in the loop over the
+ * node pairs. World and FirstLocal share the batched kernel, which keeps it at two kernels per box test.
+ */
+template <typename Query>
+size_t with_kernels(const glm::mat4& first_matrix, const glm::mat4& second_matrix, const QuerySettings& settings,
+                    Query query)
+{
+    return with_box_overlap(first_matrix, second_matrix, settings.bounds, [&](const auto& overlap) {
+        return with_leaf_kernel(first_matrix, second_matrix, settings.triangle_space,
+                                [&](const auto& leaves) { return query(overlap, leaves); });
+    });
+}
+
+/**
+ * Collision test over two BVHNode trees. Counts the intersecting triangle pairs, marks the colliding nodes and
+ * triangles if Mark is set and stops once the query policy is done.
+ */
+template <bool Mark, typename Overlap, typename Leaves, typename Limit, typename Stats>
+size_t traverse_nodes(BVHNode& first_node, BVHNode& second_node, DescentRule descent, const Overlap& overlap,
+                      const Leaves& leaves, Limit limit, Stats stats)
+{
+    size_t hits = 0;
+
+    auto visit = [&](BVHNode* first, BVHNode* second) {
+        // mark nodes as colliding
+        if constexpr ( Mark )
+        {
+            first->collision = true;
+            second->collision = true;
+        }
+        return true;
+    };
+
+    // the nodes have no index to key the packed leaves by, every leaf pair packs its second leaf anew
+    LeafScratch scratch;
+    auto testLeaves = [&](BVHNode* first, BVHNode* second) {
+        std::vector<Triangle*> first_triangles = first->get_triangles();
+        std::vector<Triangle*> second_triangles = second->get_triangles();
+
+        return leaves.test(
+            static_cast<uint32_t>(first_triangles.size()), [&](uint32_t i) -> Triangle& { return *first_triangles[i]; },
+            static_cast<uint32_t>(second_triangles.size()), [&](uint32_t j) -> Triangle& { return *second_triangles[j]; },
+            LeafScratch::kNoKey, scratch, [&](uint32_t i, uint32_t j) {
+                if constexpr ( Mark )
+                {
+                    first_triangles[i]->collision = true;
+                    second_triangles[j]->collision = true;
+                }
+                hits++;
+                return !limit.done(hits);
+            },
+            stats);
+    };
+
+    traverse(NodeTree{ first_node }, NodeTree{ second_node }, overlap, descent, visit, testLeaves, stats);
+    return hits;
+}
+
+template <bool Mark, typename Limit>
+size_t collide_nodes(BVHNode& first_node, const glm::mat4& first_matrix, BVHNode& second_node,
+                     const glm::mat4& second_matrix, const QuerySettings& settings, Limit limit)
+{
+    return with_stats(settings, [&](auto stats) {
+        return with_kernels(first_matrix, second_matrix, settings, [&](const auto& overlap, const auto& leaves) {
+            return traverse_nodes<Mark>(first_node, second_node, settings.descent, overlap, leaves, limit, stats);
+        });
+    });
+}
+
+/**
+ * The same test over two flat trees. Nothing is marked, the intersecting triangle pairs (and optionally the
+ * overlapping node pairs) are appended to the output buffer if there is one. The collider only reads its inputs, so
+ * one instance can run on several threads at once, each thread traversing from its own start pair into its own
+ * buffer.
+ */
+template <typename Overlap, typename Leaves, typename Limit>
+class FlatCollider
+{
+  public:
+    FlatCollider(const FlatBVHView& first, const FlatBVHView& second, const QuerySettings& settings,
+                 const Overlap& overlap, const Leaves& leaves, Limit limit)
+        : first(first), second(second), settings(settings), overlap(overlap), leaves(leaves), limit(limit)
+    {
+    }
+
+    /**
+     * Traverses from the given node pair. When shared_hits is given the hit limit applies to the sum over all threads
+     * counting into it; it is only touched if there is a limit. The counters are added to stats if it is given.
+     */
+    size_t run(uint32_t first_start, uint32_t second_start, ContactBuffer* out,
+               std::atomic<size_t>* shared_hits = nullptr, QueryStats* stats = nullptr) const
+    {
+        if ( stats != nullptr )
+        {
+            return traverse_from(first_start, second_start, out, shared_hits, CountStats{ stats });
+        }
+        return traverse_from(first_start, second_start, out, shared_hits, NoStats());
+    }
+
+    /**
+     * Splits the traversal into independent subtraversals for the parallel query. The pairs near the roots are
+     * expanded level by level, in place, until there are at least task_count pairs left to traverse. The result lists
+     * the node pairs already visited by the expansion and the start pairs of the tasks in the serial visiting order,
+     * so concatenating the task outputs in this order reproduces the serial output.
+     */
+    std::vector<FrontierItem> split(size_t task_count, QueryStats* stats = nullptr) const
+    {
+        FlatViewTree firstTree{ first };
+        FlatViewTree secondTree{ second };
+
+        std::vector<FrontierItem> items{ FrontierItem{ 0, 0, false } };
+        std::vector<FrontierItem> next;
+        size_t tasks = 1;
+
+        while ( tasks > 0 && tasks < task_count )
+        {
+            next.clear();
+            bool expanded = false;
+            tasks = 0;
+
+            for ( const FrontierItem& item : items )
+            {
+                if ( item.visited || (firstTree.is_leaf(item.first) && secondTree.is_leaf(item.second)) )
+                {
+                    // leaf pairs are left to a task, which does the overlap test itself
+                    next.push_back(item);
+                    tasks += item.visited ? 0 : 1;
+                    continue;
+                }
+
+                Aabb firstBounds = firstTree.bounds(item.first);
+                Aabb secondBounds = secondTree.bounds(item.second);
+                if ( stats != nullptr )
+                {
+                    stats->box_tests++;
+                }
+                if ( !overlap(firstBounds, secondBounds) )
+                {
+                    continue;
+                }
+
+                if ( stats != nullptr )
+                {
+                    stats->node_pairs++;
+                }
+                expanded = true;
+                next.push_back(FrontierItem{ item.first, item.second, true });
+                for_each_child_pair(firstTree, secondTree, item.first, item.second, firstBounds, secondBounds,
+                                    settings.descent, [&](uint32_t firstChild, uint32_t secondChild) {
+                                        next.push_back(FrontierItem{ firstChild, secondChild, false });
+                                        tasks++;
+                                    });
+            }
+
+            items.swap(next);
+            if ( !expanded )
+            {
+                break;
+            }
+        }
+
+        return items;
+    }
+
+  private:
+    template <typename Stats>
+    size_t traverse_from(uint32_t first_start, uint32_t second_start, ContactBuffer* out,
+                         std::atomic<size_t>* shared_hits, Stats stats) const
+    {
+        size_t hits = 0;
+
+        auto done = [&]() {
+            if constexpr ( Limit::kLimited )
+            {
+                return limit.done(shared_hits != nullptr ? shared_hits->load(std::memory_order_relaxed) : hits);
+            }
+            return false;
+        };
+
+        auto visit = [&](uint32_t first_index, uint32_t second_index) {
+            if ( out != nullptr && out->record_node_pairs )
+            {
+                out->node_pairs.push_back(NodePair{ first_index, second_index });
+            }
+            return !done();
+        };
+
+        LeafScratch scratch(second.nodes.size());
+        auto testLeaves = [&](uint32_t first_index, uint32_t second_index) {
+            const FlatNode& firstNode = first.nodes[first_index];
+            const FlatNode& secondNode = second.nodes[second_index];
+
+            auto firstAt = [&](uint32_t i) -> Triangle& { return first.leaf_triangle(firstNode, i); };
+            auto secondAt = [&](uint32_t j) -> Triangle& { return second.leaf_triangle(secondNode, j); };
+
+            auto onHit = [&](uint32_t i, uint32_t j) {
+                if ( out != nullptr )
+                {
+                    out->contacts.push_back(ContactPair{ first.triangle_indices[firstNode.offset + i],
+                                                         second.triangle_indices[secondNode.offset + j] });
+                }
+                hits++;
+                if constexpr ( Limit::kLimited )
+                {
+                    if ( shared_hits != nullptr )
+                    {
+                        shared_hits->fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                return !done();
+            };
+            return leaves.test(firstNode.count, firstAt, secondNode.count, secondAt, second_index, scratch, onHit,
+                               stats);
+        };
+
+        traverse(FlatViewTree{ first }, FlatViewTree{ second }, first_start, second_start, overlap, settings.descent,
+                 visit, testLeaves, stats);
+        return hits;
+    }
+
+    FlatBVHView first;
+    FlatBVHView second;
+    const QuerySettings& settings;
+    Overlap overlap;
+    Leaves leaves;
+    Limit limit;
+};
+
+/** Runs query(collider) with the FlatCollider for the kernels selected by the settings and the given policy. */
+template <typename Limit, typename Query>
+size_t with_flat_collider(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+                          const glm::mat4& second_matrix, const QuerySettings& settings, Limit limit, Query query)
+{
+    return with_kernels(first_matrix, second_matrix, settings, [&](const auto& overlap, const auto& leaves) {
+        FlatCollider collider(first, second, settings, overlap, leaves, limit);
+        return query(collider);
+    });
+}
+
+template <typename Limit>
+size_t collide_flat(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+                    const glm::mat4& second_matrix, const QuerySettings& settings, Limit limit, ContactBuffer* out)
+{
+    if ( settings.stats != nullptr )
+    {
+        *settings.stats = QueryStats();
+    }
+    if ( first.empty() || second.empty() )
+    {
+        return 0;
+    }
+    return with_flat_collider(first, first_matrix, second, second_matrix, settings, limit, [&](const auto& collider) {
+        return collider.run(0, 0, out, nullptr, settings.stats);
+    });
+}
+
+/**
+ * Parallel collide. Every task traverses from its start pair into a buffer of its own, so the workers share nothing
+ * but the read-only trees (and the hit counter if there is a hit limit); the buffers are appended to the output in
+ * visiting order at the end.
+ */
+template <typename Collider>
+size_t collide_flat(const Collider& collider, const QuerySettings& settings, ContactBuffer& out, ThreadPool& pool)
+{
+    std::vector<FrontierItem> items = collider.split(kTasksPerThread * pool.get_concurrency(), settings.stats);
+
+    std::vector<ContactBuffer> partial(items.size());
+    std::vector<QueryStats> partialStats(settings.stats != nullptr ? items.size() : 0);
+    std::atomic<size_t> sharedHits{ 0 };
+
+    parallel_for(pool, 0, items.size(), 1, [&](size_t index, size_t) {
+        const FrontierItem& item = items[index];
+        if ( !item.visited )
+        {
+            partial[index].record_node_pairs = out.record_node_pairs;
+            QueryStats* stats = settings.stats != nullptr ? &partialStats[index] : nullptr;
+            collider.run(item.first, item.second, &partial[index], &sharedHits, stats);
+        }
+    });
+
+    for ( const QueryStats& stats : partialStats )
+    {
+        settings.stats->merge(stats);
+    }
+
+    for ( size_t index = 0; index < items.size(); ++index )
+    {
+        const FrontierItem& item = items[index];
+        if ( item.visited )
+        {
+            if ( out.record_node_pairs )
+            {
+                out.node_pairs.push_back(NodePair{ item.first, item.second });
+            }
+            continue;
+        }
+
+        const ContactBuffer& buffer = partial[index];
+        out.contacts.insert(out.contacts.end(), buffer.contacts.begin(), buffer.contacts.end());
+        out.node_pairs.insert(out.node_pairs.end(), buffer.node_pairs.begin(), buffer.node_pairs.end());
+    }
+
+    // the tasks stop once the limit is reached, but the last hits of concurrently running tasks may overshoot it
+    if ( settings.max_hits != 0 && out.contacts.size() > settings.max_hits )
+    {
+        out.contacts.resize(settings.max_hits);
+    }
+    return out.contacts.size();
+}
+
+/**
+ * Collision test over two wide trees. A pair of entries is either two leaves, which are tested triangle by triangle,
+ * or contains a wide node that is opened: the box of the other entry is moved into the node's space and tested
+ * against all of its children with one overlap_mask call. The larger of two interior entries is opened first.
+ */
+template <int Width, typename Leaves, typename Limit, typename Stats>
+size_t collide_wide(const WideBVH<Width>& first, const glm::mat4& first_matrix, const WideBVH<Width>& second,
+                    const glm::mat4& second_matrix, const Leaves& leaves, Limit limit, ContactBuffer& out,
+                    Stats stats)
+{
+    if ( first.empty() || second.empty() )
+    {
+        return 0;
+    }
+
+    // either a wide node (count 0) or the triangle range of a leaf, with its box in the space of its own model
+    struct Entry
+    {
+        uint32_t child;
+        uint32_t count;
+        Aabb bounds;
+    };
+
+    struct Pair
+    {
+        Entry first;
+        Entry second;
+    };
+
+    glm::mat4 secondToFirst = glm::inverse(first_matrix) * second_matrix;
+    glm::mat4 firstToSecond = glm::inverse(secondToFirst);
+    size_t hits = 0;
+
+    Entry firstRoot{ 0, 0, first.bounds };
+    Entry secondRoot{ 0, 0, second.bounds };
+    stats.box_tests(1);
+    if ( !overlaps(transform(secondToFirst, secondRoot.bounds), firstRoot.bounds) )
+    {
+        return 0;
+    }
+
+    // a root that is a single leaf is stored as the only slot of the root node
+    if ( first.nodes[0].is_leaf(0) )
+    {
+        firstRoot = Entry{ first.nodes[0].child[0], first.nodes[0].count[0], first.bounds };
+    }
+    if ( second.nodes[0].is_leaf(0) )
+    {
+        secondRoot = Entry{ second.nodes[0].child[0], second.nodes[0].count[0], second.bounds };
+    }
+
+    // wide leaves have no node of their own, their triangle ranges are disjoint and keyed by where they start
+    LeafScratch scratch(second.triangle_indices.size());
+    TraversalStack<Pair> stack;
+    stack.push(Pair{ firstRoot, secondRoot });
+    stats.stack_depth(1);
+
+    while ( !stack.empty() )
+    {
+        // every pair on the stack passed its box test when it was pushed
+        Pair pair = stack.pop();
+        stats.node_pair();
+
+        if ( pair.first.count > 0 && pair.second.count > 0 )
+        {
+            stats.leaf_pair();
+            auto firstAt = [&](uint32_t i) -> Triangle& {
+                return *first.triangles[first.triangle_indices[pair.first.child + i]];
+            };
+            auto secondAt = [&](uint32_t j) -> Triangle& {
+                return *second.triangles[second.triangle_indices[pair.second.child + j]];
+            };
+
+            auto onHit = [&](uint32_t i, uint32_t j) {
+                out.contacts.push_back(ContactPair{ first.triangle_indices[pair.first.child + i],
+                                                    second.triangle_indices[pair.second.child + j] });
+                hits++;
+                return !limit.done(hits);
+            };
+            bool goOn = leaves.test(pair.first.count, firstAt, pair.second.count, secondAt, pair.second.child, scratch,
+                                    onHit, stats);
+            if ( !goOn )
+            {
+                break;
+            }
+            continue;
+        }
+
+        // open the interior entry, or the larger one if both are interior
+        Aabb firstInSecond = transform(firstToSecond, pair.first.bounds);
+        bool openFirst = pair.second.count > 0 ||
+                         (pair.first.count == 0 && firstInSecond.surface_area() >= pair.second.bounds.surface_area());
+
+        if ( openFirst )
+        {
+            const WideNode<Width>& node = first.nodes[pair.first.child];
+            uint32_t mask = overlap_mask(node, transform(secondToFirst, pair.second.bounds));
+            stats.box_tests(Width);
+            // pushed in reverse so that the children are visited in slot order
+            for ( int slot = Width - 1; slot >= 0; --slot )
+            {
+                if ( mask & (1u << slot) )
+                {
+                    stack.push(Pair{ Entry{ node.child[slot], node.count[slot], node.bounds(slot) }, pair.second });
+                }
+            }
+        }
+        else
+        {
+            const WideNode<Width>& node = second.nodes[pair.second.child];
+            uint32_t mask = overlap_mask(node, firstInSecond);
+            stats.box_tests(Width);
+            for ( int slot = Width - 1; slot >= 0; --slot )
+            {
+                if ( mask & (1u << slot) )
+                {
+                    stack.push(Pair{ pair.first, Entry{ node.child[slot], node.count[slot], node.bounds(slot) } });
+                }
+            }
+        }
+        stats.stack_depth(stack.depth());
+    }
+
+    return hits;
+}
+
+/** collide over quantized trees, the traversal decodes the child boxes as it descends. */
+template <typename Code, typename Overlap, typename Leaves, typename Limit, typename Stats>
+size_t collide_quantized(const QuantizedBVH<Code>& first, const QuantizedBVH<Code>& second, DescentRule descent,
+                         const Overlap& overlap, const Leaves& leaves, Limit limit, ContactBuffer& out, Stats stats)
+{
+    if ( first.empty() || second.empty() )
+    {
+        return 0;
+    }
+
+    using Handle = typename QuantizedTree<Code>::Handle;
+
+    QuantizedTree<Code> firstTree{ first };
+    QuantizedTree<Code> secondTree{ second };
+    size_t hits = 0;
+
+    auto visit = [&](const Handle&, const Handle&) { return !limit.done(hits); };
+
+    LeafScratch scratch(second.leaves.size());
+
+    auto testLeaves = [&](const Handle& first_node, const Handle& second_node) {
+        const QuantizedLeaf& firstLeaf = firstTree.leaf(first_node);
+        const QuantizedLeaf& secondLeaf = secondTree.leaf(second_node);
+
+        auto firstAt = [&](uint32_t i) -> Triangle& {
+            return *first.triangles[first.triangle_indices[firstLeaf.offset + i]];
+        };
+        auto secondAt = [&](uint32_t j) -> Triangle& {
+            return *second.triangles[second.triangle_indices[secondLeaf.offset + j]];
+        };
+
+        auto onHit = [&](uint32_t i, uint32_t j) {
+            out.contacts.push_back(ContactPair{ first.triangle_indices[firstLeaf.offset + i],
+                                                second.triangle_indices[secondLeaf.offset + j] });
+            hits++;
+            return !limit.done(hits);
+        };
+        uint32_t secondKey = second_node.ref & ~kQuantizedLeafBit;
+        return leaves.test(firstLeaf.count, firstAt, secondLeaf.count, secondAt, secondKey, scratch, onHit, stats);
+    };
+
+    traverse(firstTree, secondTree, overlap, descent, visit, testLeaves, stats);
+    return hits;
+}
+
+/** collide over indexed trees, the leaf kernels read the vertices through the shared vertex buffers. */
+template <typename Overlap, typename Leaves, typename Limit, typename Stats>
+size_t collide_indexed(const IndexedBVH& first, const IndexedBVH& second, DescentRule descent, const Overlap& overlap,
+                       const Leaves& leaves, Limit limit, ContactBuffer& out, Stats stats)
+{
+    if ( first.empty() || second.empty() )
+    {
+        return 0;
+    }
+
+    size_t hits = 0;
+
+    auto visit = [&](uint32_t first_index, uint32_t second_index) {
+        if ( out.record_node_pairs )
+        {
+            out.node_pairs.push_back(NodePair{ first_index, second_index });
+        }
+        return !limit.done(hits);
+    };
+
+    LeafScratch scratch(second.nodes.size());
+    auto testLeaves = [&](uint32_t first_index, uint32_t second_index) {
+        const FlatNode& firstNode = first.nodes[first_index];
+        const FlatNode& secondNode = second.nodes[second_index];
+
+        auto firstAt = [&](uint32_t i) { return first.leaf_triangle(firstNode, i); };
+        auto secondAt = [&](uint32_t j) { return second.leaf_triangle(secondNode, j); };
+
+        auto onHit = [&](uint32_t i, uint32_t j) {
+            out.contacts.push_back(
+                ContactPair{ first.leaf_triangle_id(firstNode, i), second.leaf_triangle_id(secondNode, j) });
+            hits++;
+            return !limit.done(hits);
+        };
+        return leaves.test(firstNode.count, firstAt, secondNode.count, secondAt, second_index, scratch, onHit, stats);
+    };
+
+    traverse(IndexedTree{ first }, IndexedTree{ second }, overlap, descent, visit, testLeaves, stats);
+    return hits;
+}
+
+} // namespace
+
+size_t test_collision(BVHNode& first_node, const glm::mat4& first_matrix, BVHNode& second_node,
+                      const glm::mat4& second_matrix, const QuerySettings& settings)
+{
+    return with_hit_limit(settings, [&](auto limit) {
+        return collide_nodes<true>(first_node, first_matrix, second_node, second_matrix, settings, limit);
+    });
+}
+
+size_t test_collision(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+                      const glm::mat4& second_matrix, const QuerySettings& settings)
+{
+    ContactBuffer contacts;
+    collide(first, first_matrix, second, second_matrix, contacts, settings);
+    mark_collisions(contacts, first, second);
+    return contacts.contacts.size();
+}
+
+size_t collide(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings)
+{
+    unsigned threads = ThreadPool::resolve_thread_count(settings.threads);
+    if ( threads > 1 )
+    {
+        ThreadPool pool(threads - 1);
+        return collide(first, first_matrix, second, second_matrix, out, pool, settings);
+    }
+
+    out.clear();
+    return with_hit_limit(settings, [&](auto limit) {
+        return collide_flat(first, first_matrix, second, second_matrix, settings, limit, &out);
+    });
+}
+
+size_t collide(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, ThreadPool& pool, const QuerySettings& settings)
+{
+    out.clear();
+    if ( settings.stats != nullptr )
+    {
+        *settings.stats = QueryStats();
+    }
+    if ( first.empty() || second.empty() )
+    {
+        return 0;
+    }
+    return with_hit_limit(settings, [&](auto limit) {
+        return with_flat_collider(first, first_matrix, second, second_matrix, settings, limit,
+                                  [&](const auto& collider) { return collide_flat(collider, settings, out, pool); });
+    });
+}
+
+size_t collide(const WideBVH4& first, const glm::mat4& first_matrix, const WideBVH4& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings)
+{
+    out.clear();
+    return with_stats(settings, [&](auto stats) {
+        return with_leaf_kernel(first_matrix, second_matrix, settings.triangle_space, [&](const auto& leaves) {
+            return with_hit_limit(settings, [&](auto limit) {
+                return collide_wide(first, first_matrix, second, second_matrix, leaves, limit, out, stats);
+            });
+        });
+    });
+}
+
+size_t collide(const WideBVH8& first, const glm::mat4& first_matrix, const WideBVH8& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings)
+{
+    out.clear();
+    return with_stats(settings, [&](auto stats) {
+        return with_leaf_kernel(first_matrix, second_matrix, settings.triangle_space, [&](const auto& leaves) {
+            return with_hit_limit(settings, [&](auto limit) {
+                return collide_wide(first, first_matrix, second, second_matrix, leaves, limit, out, stats);
+            });
+        });
+    });
+}
+
+size_t collide(const QuantizedBVH8& first, const glm::mat4& first_matrix, const QuantizedBVH8& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings)
+{
+    out.clear();
+    return with_stats(settings, [&](auto stats) {
+        return with_kernels(first_matrix, second_matrix, settings, [&](const auto& overlap, const auto& leaves) {
+            return with_hit_limit(settings, [&](auto limit) {
+                return collide_quantized(first, second, settings.descent, overlap, leaves, limit, out, stats);
+            });
+        });
+    });
+}
+
+size_t collide(const QuantizedBVH16& first, const glm::mat4& first_matrix, const QuantizedBVH16& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings)
+{
+    out.clear();
+    return with_stats(settings, [&](auto stats) {
+        return with_kernels(first_matrix, second_matrix, settings, [&](const auto& overlap, const auto& leaves) {
+            return with_hit_limit(settings, [&](auto limit) {
+                return collide_quantized(first, second, settings.descent, overlap, leaves, limit, out, stats);
+            });
+        });
+    });
+}
+
+size_t collide(const IndexedBVH& first, const glm::mat4& first_matrix, const IndexedBVH& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings)
+{
+    out.clear();
+    return with_stats(settings, [&](auto stats) {
+        return with_kernels(first_matrix, second_matrix, settings, [&](const auto& overlap, const auto& leaves) {
+            return with_hit_limit(settings, [&](auto limit) {
+                return collide_indexed(first, second, settings.descent, overlap, leaves, limit, out, stats);
+            });
+        });
+    });
+}
+
+void mark_collisions(const ContactBuffer& contacts, const FlatBVHView& first, const FlatBVHView& second)
+{
+    for ( const ContactPair& contact : contacts.contacts )
+    {
+        first.triangles[contact.first]->collision = true;
+        second.triangles[contact.second]->collision = true;
+    }
+}
+
+bool any_hit(BVHNode& first_node, const glm::mat4& first_matrix, BVHNode& second_node, const glm::mat4& second_matrix,
+             const QuerySettings& settings)
+{
+    return collide_nodes<false>(first_node, first_matrix, second_node, second_matrix, settings, HitLimit{ 1 }) > 0;
+}
+
+bool any_hit(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+             const glm::mat4& second_matrix, const QuerySettings& settings)
+{
+    return collide_flat(first, first_matrix, second, second_matrix, settings, HitLimit{ 1 }, nullptr) > 0;
+}
+
+} // namespace bvh
@@ -0,0 +1,188 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_bounds.hpp"
+#include "bvh_flat.hpp"
+#include "bvh_indexed.hpp"
+#include "bvh_quantized.hpp"
+#include "bvh_thread_pool.hpp"
+#include "bvh_traversal.hpp"
+#include "bvh_wide.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bvh {
+
+/** Options shared by the collision queries. */
+struct QuerySettings
+{
+    /** How node boxes of the two models are compared. */
+    BoundsMode bounds = BoundsMode::TransformedAabb;
+    /** How the triangles of two colliding leaves are tested. */
+    TriangleSpace triangle_space = TriangleSpace::PerPair;
+    /** Which node of an overlapping pair is descended into. */
+    DescentRule descent = DescentRule::Both;
+    /**
+     * The traversal stops as soon as this many intersecting triangle pairs were found, which bounds the cost of the
+     * query regardless of how deep the models overlap. 0 finds all of them.
+     */
+    size_t max_hits = 0;
+    /**
+     * Threads used by collide on flat trees, including the calling one; 1 runs serially, 0 uses all hardware threads.
+     * The contacts come out in the serial order, except that with max_hits set the parallel query may find a
+     * different subset of the same size.
+     */
+    unsigned threads = 1;
+    /**
+     * Receives the counters of the query if set; they are reset at its start, FrameStats adds them up over a frame.
+     * Queries without it run a traversal instantiated without any counting, so they pay nothing for the option.
+     */
+    QueryStats* stats = nullptr;
+};
+
+/** Pair of intersecting triangles, given by their indices in FlatBVH::triangles of the first and second model. */
+struct ContactPair
+{
+    uint32_t first;
+    uint32_t second;
+};
+
+/** Pair of overlapping nodes, given by their indices in FlatBVH::nodes of the first and second model. */
+struct NodePair
+{
+    uint32_t first;
+    uint32_t second;
+};
+
+/**
+ * Caller owned output of collide. The buffer is cleared (but keeps its capacity) at the start of every query, so one
+ * buffer per query can be reused frame after frame without allocating.
+ */
+struct ContactBuffer
+{
+    std::vector<ContactPair> contacts;
+    /** The overlapping node pairs in visiting order, filled only if record_node_pairs is set (for debug drawing). */
+    std::vector<NodePair> node_pairs;
+    bool record_node_pairs = false;
+
+    void clear()
+    {
+        contacts.clear();
+        node_pairs.clear();
+    }
+};
+
+/**
+ * Tests what nodes and their respective triangles of two BVH trees are in collision, marking them directly. This is
+ * Application::test_collision with selectable bounding volume and triangle tests.
+ *
+ * @param 	first_node	  The first BVH root.
+ * @param 	first_matrix  The model matrix applied to the first model.
+ * @param   second_node   The second BVH root.
+ * @param   second_matrix The model matrix applied to the second model.
+ * @param   settings      The query options.
+ * @return	The number of intersecting triangle pairs found (at most settings.max_hits if that is set).
+ */
+size_t test_collision(BVHNode& first_node, const glm::mat4& first_matrix, BVHNode& second_node,
+                    const glm::mat4& second_matrix, const QuerySettings& settings = QuerySettings());
+
+/**
+ * The flat counterpart of the test above, implemented as collide followed by mark_collisions. Flat nodes carry no
+ * collision flag, so only Triangle::collision is set.
+ *
+ * @param 	first	      The first BVH.
+ * @param 	first_matrix  The model matrix applied to the first model.
+ * @param   second        The second BVH.
+ * @param   second_matrix The model matrix applied to the second model.
+ * @param   settings      The query options.
+ * @return	The number of intersecting triangle pairs found (at most settings.max_hits if that is set).
+ */
+size_t test_collision(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+                      const glm::mat4& second_matrix, const QuerySettings& settings = QuerySettings());
+
+/**
+ * Finds the intersecting triangle pairs of two models without modifying them, so any number of queries can run on the
+ * same models at the same time. The flat queries take a FlatBVHView, so they run on a FlatBVH and on a memory mapped
+ * cache file (see MappedCache) alike.
+ *
+ * @param 	first	      The first BVH.
+ * @param 	first_matrix  The model matrix applied to the first model.
+ * @param   second        The second BVH.
+ * @param   second_matrix The model matrix applied to the second model.
+ * @param   out           The buffer receiving the contacts, cleared first.
+ * @param   settings      The query options.
+ * @return	The number of contacts written to the buffer.
+ */
+size_t collide(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings = QuerySettings());
+
+/**
+ * Parallel version of collide running on the given pool (settings.threads is ignored). The node pairs near the roots
+ * are split into tasks, each of which traverses its part of the trees into a contact buffer of its own; the buffers
+ * are merged once all tasks have finished. Reusing one pool across queries avoids starting threads every frame.
+ */
+size_t collide(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, ThreadPool& pool,
+               const QuerySettings& settings = QuerySettings());
+
+/**
+ * collide over wide trees. One box is tested against all children of a node at once; the boxes are always compared
+ * as transformed AABBs (settings.bounds, settings.descent and settings.threads are ignored) and no node pairs are
+ * recorded. The contacts are the same as for the binary trees, only their order may differ.
+ */
+size_t collide(const WideBVH4& first, const glm::mat4& first_matrix, const WideBVH4& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings = QuerySettings());
+size_t collide(const WideBVH8& first, const glm::mat4& first_matrix, const WideBVH8& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings = QuerySettings());
+
+/**
+ * collide over quantized trees (settings.threads is ignored and no node pairs are recorded). The decoded boxes are
+ * slightly larger than the exact ones, which can only add overlapping node pairs and never lose contacts; the
+ * contacts are the same as for the flat trees, with DescentRule::Both even in the same order.
+ */
+size_t collide(const QuantizedBVH8& first, const glm::mat4& first_matrix, const QuantizedBVH8& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings = QuerySettings());
+size_t collide(const QuantizedBVH16& first, const glm::mat4& first_matrix, const QuantizedBVH16& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings = QuerySettings());
+
+/**
+ * collide over trees of indexed meshes (settings.threads is ignored). The contacts give the triangles by their index
+ * in the meshes (see IndexedBVH::triangle_ids). Without Triangle objects for triangle_triangle_intersection,
+ * TriangleSpace::PerPair transforms the triangles of every pair and tests them with triangles_intersect. As the trees
+ * have the nodes of the flat trees over the same triangles, the contacts are otherwise the same as for those, in the
+ * same order.
+ */
+size_t collide(const IndexedBVH& first, const glm::mat4& first_matrix, const IndexedBVH& second,
+               const glm::mat4& second_matrix, ContactBuffer& out, const QuerySettings& settings = QuerySettings());
+
+/**
+ * Visualization pass setting Triangle::collision for every triangle referenced by the contacts. Flags are only ever
+ * set, clearing them is up to the caller.
+ */
+void mark_collisions(const ContactBuffer& contacts, const FlatBVHView& first, const FlatBVHView& second);
+
+/**
+ * Returns whether the two models collide, stopping the traversal at the first intersecting triangle pair. Nothing is
+ * marked, so the query can run on models that are being drawn. settings.max_hits is ignored.
+ *
+ * @param 	first	      The first BVH.
+ * @param 	first_matrix  The model matrix applied to the first model.
+ * @param   second        The second BVH.
+ * @param   second_matrix The model matrix applied to the second model.
+ * @param   settings      The query options.
+ */
+bool any_hit(const FlatBVHView& first, const glm::mat4& first_matrix, const FlatBVHView& second,
+             const glm::mat4& second_matrix, const QuerySettings& settings = QuerySettings());
+bool any_hit(BVHNode& first_node, const glm::mat4& first_matrix, BVHNode& second_node, const glm::mat4& second_matrix,
+             const QuerySettings& settings = QuerySettings());
+
+} // namespace bvh
@@ -0,0 +1,345 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_ray.hpp"
+
+#include "bvh_bounds.hpp"
+#include "bvh_traversal.hpp"
+#include "triangle_tests.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace bvh {
+namespace {
+
+constexpr float kInfinity = std::numeric_limits<float>::infinity();
+
+/** A ray in the model space of the queried tree, together with its inverse direction for the slab tests. */
+struct LocalRay
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+    glm::vec3 inverse;
+    float t_min;
+    float t_max;
+};
+
+LocalRay to_model_space(const Ray& ray, const glm::mat4& inverse_matrix)
+{
+    LocalRay local;
+    local.origin = glm::vec3(inverse_matrix * glm::vec4(ray.origin, 1.0f));
+    local.direction = glm::vec3(inverse_matrix * glm::vec4(ray.direction, 0.0f));
+    // zero components give infinities, for which the slab comparisons still come out right
+    local.inverse = glm::vec3(1.0f / local.direction.x, 1.0f / local.direction.y, 1.0f / local.direction.z);
+    local.t_min = ray.t_min;
+    local.t_max = ray.t_max;
+    return local;
+}
+
+/** Slab test (Kay and Kajiya). Returns whether the ray enters the box before t_max, and the entry parameter. */
+bool slab_test(const LocalRay& ray, const Aabb& box, float t_max, float& entry)
+{
+    glm::vec3 t0 = (box.min - ray.origin) * ray.inverse;
+    glm::vec3 t1 = (box.max - ray.origin) * ray.inverse;
+    float enter = std::max({ ray.t_min, std::min(t0.x, t1.x), std::min(t0.y, t1.y), std::min(t0.z, t1.z) });
+    float leave = std::min({ t_max, std::max(t0.x, t1.x), std::max(t0.y, t1.y), std::max(t0.z, t1.z) });
+    entry = enter;
+    return enter <= leave;
+}
+
+/** Tests a triangle up to the given parameter and records the hit if there is one. */
+bool intersect_triangle(Triangle& triangle, const LocalRay& ray, float t_max, RayHit& hit)
+{
+    glm::vec3 vertices[3] = { glm::vec3(triangle.v1), glm::vec3(triangle.v2), glm::vec3(triangle.v3) };
+    float t, u, v;
+    if ( !ray_triangle_intersection(ray.origin, ray.direction, vertices, ray.t_min, t_max, t, u, v) )
+    {
+        return false;
+    }
+    hit.hit = true;
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    hit.triangle = &triangle;
+    return true;
+}
+
+template <typename Tree>
+RayHit trace(const Tree& tree, const LocalRay& ray, bool any)
+{
+    using Handle = typename Tree::Handle;
+
+    struct Entry
+    {
+        Handle node;
+        float entry;
+    };
+
+    RayHit hit;
+    float limit = ray.t_max;
+    float entry;
+    if ( !slab_test(ray, tree.bounds(tree.root()), limit, entry) )
+    {
+        return hit;
+    }
+
+    TraversalStack<Entry> stack;
+    stack.push(Entry{ tree.root(), entry });
+
+    while ( !stack.empty() )
+    {
+        Entry current = stack.pop();
+        if ( current.entry > limit )
+        {
+            // a closer hit was found since the node was pushed
+            continue;
+        }
+
+        if ( tree.is_leaf(current.node) )
+        {
+            for_each_leaf_triangle(tree, current.node, [&](Triangle& triangle) {
+                if ( intersect_triangle(triangle, ray, limit, hit) )
+                {
+                    limit = hit.t;
+                    return !any;
+                }
+                return true;
+            });
+            if ( any && hit.hit )
+            {
+                return hit;
+            }
+            continue;
+        }
+
+        Handle left = tree.left(current.node);
+        Handle right = tree.right(current.node);
+        float leftEntry, rightEntry;
+        bool hitsLeft = slab_test(ray, tree.bounds(left), limit, leftEntry);
+        bool hitsRight = slab_test(ray, tree.bounds(right), limit, rightEntry);
+
+        // the nearer child is pushed last, so that it is visited first
+        if ( hitsLeft && hitsRight )
+        {
+            if ( leftEntry <= rightEntry )
+            {
+                stack.push(Entry{ right, rightEntry });
+                stack.push(Entry{ left, leftEntry });
+            }
+            else
+            {
+                stack.push(Entry{ left, leftEntry });
+                stack.push(Entry{ right, rightEntry });
+            }
+        }
+        else if ( hitsLeft )
+        {
+            stack.push(Entry{ left, leftEntry });
+        }
+        else if ( hitsRight )
+        {
+            stack.push(Entry{ right, rightEntry });
+        }
+    }
+
+    return hit;
+}
+
+/**
+ * kRayPacketWidth rays in model space, the parts used by the slab test in structure of arrays layout. Unused lanes
+ * and finished any hit rays have an empty interval and miss every box.
+ */
+struct RayPacket
+{
+    float origin_x[kRayPacketWidth];
+    float origin_y[kRayPacketWidth];
+    float origin_z[kRayPacketWidth];
+    float inverse_x[kRayPacketWidth];
+    float inverse_y[kRayPacketWidth];
+    float inverse_z[kRayPacketWidth];
+    float t_min[kRayPacketWidth];
+    float t_max[kRayPacketWidth];
+    LocalRay rays[kRayPacketWidth];
+    int count = 0;
+};
+
+void load_packet(RayPacket& packet, const Ray* rays, int count, const glm::mat4& inverse_matrix)
+{
+    for ( int lane = 0; lane < kRayPacketWidth; ++lane )
+    {
+        LocalRay ray = to_model_space(rays[std::min(lane, count - 1)], inverse_matrix);
+        if ( lane >= count )
+        {
+            ray.t_min = kInfinity;
+            ray.t_max = -kInfinity;
+        }
+        packet.rays[lane] = ray;
+        packet.origin_x[lane] = ray.origin.x;
+        packet.origin_y[lane] = ray.origin.y;
+        packet.origin_z[lane] = ray.origin.z;
+        packet.inverse_x[lane] = ray.inverse.x;
+        packet.inverse_y[lane] = ray.inverse.y;
+        packet.inverse_z[lane] = ray.inverse.z;
+        packet.t_min[lane] = ray.t_min;
+        packet.t_max[lane] = ray.t_max;
+    }
+    packet.count = count;
+}
+
+/** The slab test for every lane of the packet, bit i of the result is set if ray i enters the box. */
+uint32_t slab_test(const RayPacket& packet, const Aabb& box)
+{
+    bool hits[kRayPacketWidth];
+    for ( int lane = 0; lane < kRayPacketWidth; ++lane )
+    {
+        float x0 = (box.min.x - packet.origin_x[lane]) * packet.inverse_x[lane];
+        float x1 = (box.max.x - packet.origin_x[lane]) * packet.inverse_x[lane];
+        float y0 = (box.min.y - packet.origin_y[lane]) * packet.inverse_y[lane];
+        float y1 = (box.max.y - packet.origin_y[lane]) * packet.inverse_y[lane];
+        float z0 = (box.min.z - packet.origin_z[lane]) * packet.inverse_z[lane];
+        float z1 = (box.max.z - packet.origin_z[lane]) * packet.inverse_z[lane];
+        float enter =
+            std::max(std::max(packet.t_min[lane], std::min(x0, x1)), std::max(std::min(y0, y1), std::min(z0, z1)));
+        float leave =
+            std::min(std::min(packet.t_max[lane], std::max(x0, x1)), std::min(std::max(y0, y1), std::max(z0, z1)));
+        hits[lane] = enter <= leave;
+    }
+
+    uint32_t mask = 0;
+    for ( int lane = 0; lane < kRayPacketWidth; ++lane )
+    {
+        mask |= static_cast<uint32_t>(hits[lane]) << lane;
+    }
+    return mask;
+}
+
+template <typename Tree>
+void trace_packet(const Tree& tree, RayPacket& packet, bool any, RayHit* hits)
+{
+    using Handle = typename Tree::Handle;
+
+    uint32_t active = (1u << packet.count) - 1;
+    TraversalStack<Handle> stack;
+    stack.push(tree.root());
+
+    while ( !stack.empty() && active != 0 )
+    {
+        Handle node = stack.pop();
+        // the limits of the lanes shrink with every hit, so the test is repeated on every visit
+        uint32_t mask = slab_test(packet, tree.bounds(node)) & active;
+        if ( mask == 0 )
+        {
+            continue;
+        }
+
+        if ( tree.is_leaf(node) )
+        {
+            for ( int lane = 0; lane < packet.count; ++lane )
+            {
+                if ( (mask >> lane & 1) == 0 )
+                {
+                    continue;
+                }
+                for_each_leaf_triangle(tree, node, [&](Triangle& triangle) {
+                    if ( intersect_triangle(triangle, packet.rays[lane], packet.t_max[lane], hits[lane]) )
+                    {
+                        packet.t_max[lane] = hits[lane].t;
+                        return !any;
+                    }
+                    return true;
+                });
+                if ( any && hits[lane].hit )
+                {
+                    active &= ~(1u << lane);
+                    packet.t_min[lane] = kInfinity;
+                    packet.t_max[lane] = -kInfinity;
+                }
+            }
+            continue;
+        }
+
+        // the nearer child along the direction of the first ray entering the node is visited first
+        int lead = 0;
+        while ( (mask >> lead & 1) == 0 )
+        {
+            lead++;
+        }
+        Handle left = tree.left(node);
+        Handle right = tree.right(node);
+        float order = glm::dot(tree.bounds(left).center() - tree.bounds(right).center(), packet.rays[lead].direction);
+        if ( order <= 0.0f )
+        {
+            stack.push(right);
+            stack.push(left);
+        }
+        else
+        {
+            stack.push(left);
+            stack.push(right);
+        }
+    }
+}
+
+void trace_rays(const FlatBVHView& bvh, const glm::mat4& matrix, ArrayView<Ray> rays, std::vector<RayHit>& hits,
+                bool any)
+{
+    hits.assign(rays.size(), RayHit());
+    if ( bvh.empty() )
+    {
+        return;
+    }
+
+    FlatViewTree tree{ bvh };
+    glm::mat4 inverse = glm::inverse(matrix);
+    RayPacket packet;
+    for ( size_t first = 0; first < rays.size(); first += kRayPacketWidth )
+    {
+        int count = static_cast<int>(std::min<size_t>(kRayPacketWidth, rays.size() - first));
+        load_packet(packet, &rays[first], count, inverse);
+        trace_packet(tree, packet, any, &hits[first]);
+    }
+}
+
+} // namespace
+
+RayHit closest_hit(BVHNode& root, const glm::mat4& matrix, const Ray& ray)
+{
+    return trace(NodeTree{ root }, to_model_space(ray, glm::inverse(matrix)), false);
+}
+
+RayHit closest_hit(const FlatBVHView& bvh, const glm::mat4& matrix, const Ray& ray)
+{
+    if ( bvh.empty() )
+    {
+        return RayHit();
+    }
+    return trace(FlatViewTree{ bvh }, to_model_space(ray, glm::inverse(matrix)), false);
+}
+
+bool any_hit(BVHNode& root, const glm::mat4& matrix, const Ray& ray)
+{
+    return trace(NodeTree{ root }, to_model_space(ray, glm::inverse(matrix)), true).hit;
+}
+
+bool any_hit(const FlatBVHView& bvh, const glm::mat4& matrix, const Ray& ray)
+{
+    return !bvh.empty() && trace(FlatViewTree{ bvh }, to_model_space(ray, glm::inverse(matrix)), true).hit;
+}
+
+void closest_hit(const FlatBVHView& bvh, const glm::mat4& matrix, ArrayView<Ray> rays, std::vector<RayHit>& hits)
+{
+    trace_rays(bvh, matrix, rays, hits, false);
+}
+
+void any_hit(const FlatBVHView& bvh, const glm::mat4& matrix, ArrayView<Ray> rays, std::vector<RayHit>& hits)
+{
+    trace_rays(bvh, matrix, rays, hits, true);
+}
+
+} // namespace bvh
@@ -0,0 +1,94 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_flat.hpp"
+
+#include <limits>
+#include <vector>
+
+namespace bvh {
+
+/** Ray, or segment, in world space. The points origin + t * direction with t in [t_min, t_max] are tested. */
+struct Ray
+{
+    glm::vec3 origin = glm::vec3(0.0f);
+    /** Not necessarily normalized; t is measured in multiples of it. */
+    glm::vec3 direction = glm::vec3(0.0f, 0.0f, 1.0f);
+    float t_min = 0.0f;
+    float t_max = std::numeric_limits<float>::infinity();
+};
+
+/** The segment from start to end as a ray, with t running from 0 at start to 1 at end. */
+inline Ray segment_ray(const glm::vec3& start, const glm::vec3& end)
+{
+    Ray ray;
+    ray.origin = start;
+    ray.direction = end - start;
+    ray.t_max = 1.0f;
+    return ray;
+}
+
+/** Outcome of a ray query. */
+struct RayHit
+{
+    bool hit = false;
+    /** Ray parameter of the hit; the same in world and model space, since the ray is transformed as a whole. */
+    float t = std::numeric_limits<float>::infinity();
+    /** Barycentric coordinates of the hit belonging to the second and third vertex of the triangle. */
+    float u = 0.0f;
+    float v = 0.0f;
+    /** The triangle hit, nullptr if there is none. */
+    Triangle* triangle = nullptr;
+};
+
+/** Number of rays traced together by the batch queries. */
+constexpr int kRayPacketWidth = 8;
+
+/**
+ * Finds the closest triangle of the model hit by the ray. The ray is transformed into model space once, so the
+ * same tree serves picking and line of sight tests for any pose of the model. Node boxes are tested with the slab
+ * test on the precomputed inverse direction; the nearer child is visited first and nodes beyond the closest hit so
+ * far are skipped.
+ *
+ * @param 	root  	The BVH root.
+ * @param 	matrix	The model matrix applied to the model.
+ * @param 	ray   	The ray in world space.
+ * @return	The closest hit, RayHit::hit is false if the ray misses the model.
+ */
+RayHit closest_hit(BVHNode& root, const glm::mat4& matrix, const Ray& ray);
+RayHit closest_hit(const FlatBVHView& bvh, const glm::mat4& matrix, const Ray& ray);
+
+/**
+ * Returns whether the ray hits any triangle of the model, stopping at the first one found (line of sight tests).
+ *
+ * @param 	root  	The BVH root.
+ * @param 	matrix	The model matrix applied to the model.
+ * @param 	ray   	The ray in world space.
+ */
+bool any_hit(BVHNode& root, const glm::mat4& matrix, const Ray& ray);
+bool any_hit(const FlatBVHView& bvh, const glm::mat4& matrix, const Ray& ray);
+
+/**
+ * closest_hit for many rays. The rays are traced in packets of kRayPacketWidth that traverse the tree together: a
+ * node is tested against all rays of the packet at once, with fixed width loops over structure of arrays that the
+ * compiler turns into SIMD code, and visited if any of them hits it. Packets of coherent rays (from one camera or
+ * one emitter) share most of their nodes, incoherent ones visit the union of their nodes.
+ *
+ * @param 	bvh   	The BVH.
+ * @param 	matrix	The model matrix applied to the model.
+ * @param 	rays  	The rays in world space.
+ * @param 	hits  	Receives the hit of every ray, in the order of the rays; resized to their count.
+ */
+void closest_hit(const FlatBVHView& bvh, const glm::mat4& matrix, ArrayView<Ray> rays, std::vector<RayHit>& hits);
+
+/** any_hit for many rays, traced in packets as above. The hit of every ray is the first one found, not the closest. */
+void any_hit(const FlatBVHView& bvh, const glm::mat4& matrix, ArrayView<Ray> rays, std::vector<RayHit>& hits);
+
+} // namespace bvh
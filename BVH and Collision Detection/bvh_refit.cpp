@@ -0,0 +1,182 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_refit.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace bvh {
+namespace {
+
+float node_area(const FlatNode& node)
+{
+    return Aabb(node.min, node.max).surface_area();
+}
+
+/** Index of the last node of the subtree, which is its rightmost leaf in depth first order. */
+uint32_t last_node(const FlatBVH& bvh, uint32_t node)
+{
+    while ( !bvh.nodes[node].is_leaf() )
+    {
+        node = bvh.right(node);
+    }
+    return node;
+}
+
+/** First entry of the subtree's triangle range in triangle_indices, the range of its leftmost leaf. */
+uint32_t first_triangle(const FlatBVH& bvh, uint32_t node)
+{
+    while ( !bvh.nodes[node].is_leaf() )
+    {
+        node = FlatBVH::left(node);
+    }
+    return bvh.nodes[node].offset;
+}
+
+} // namespace
+
+void refit(FlatBVH& bvh)
+{
+    // children always follow their parent, so a reverse sweep sees them first
+    for ( size_t i = bvh.nodes.size(); i-- > 0; )
+    {
+        FlatNode& node = bvh.nodes[i];
+        Aabb bounds;
+
+        if ( node.is_leaf() )
+        {
+            for ( uint32_t j = 0; j < node.count; ++j )
+            {
+                bounds.grow(triangle_bounds(bvh.leaf_triangle(node, j)));
+            }
+        }
+        else
+        {
+            const FlatNode& left = bvh.nodes[FlatBVH::left(static_cast<uint32_t>(i))];
+            const FlatNode& right = bvh.nodes[node.offset];
+            bounds = Aabb(glm::min(left.min, right.min), glm::max(left.max, right.max));
+        }
+
+        node.min = bounds.min;
+        node.max = bounds.max;
+    }
+}
+
+RefitMonitor::RefitMonitor(const FlatBVH& bvh, const RefitSettings& settings) : settings(settings)
+{
+    reference_area.reserve(bvh.nodes.size());
+    for ( const FlatNode& node : bvh.nodes )
+    {
+        reference_area.push_back(node_area(node));
+    }
+}
+
+RefitReport RefitMonitor::update(FlatBVH& bvh)
+{
+    RefitReport report;
+    refit(bvh);
+    report.refit_nodes = bvh.nodes.size();
+
+    if ( settings.max_area_growth <= 0.0f || bvh.empty() )
+    {
+        return report;
+    }
+
+    // the topmost degraded subtrees, found in depth first order and so with increasing node indices
+    std::vector<uint32_t> degraded;
+    std::vector<uint32_t> stack{ 0 };
+    while ( !stack.empty() )
+    {
+        uint32_t index = stack.back();
+        stack.pop_back();
+
+        const FlatNode& node = bvh.nodes[index];
+        if ( node.is_leaf() )
+        {
+            continue;
+        }
+
+        uint32_t last = last_node(bvh, index);
+        size_t triangleCount = bvh.nodes[last].offset + bvh.nodes[last].count - first_triangle(bvh, index);
+        if ( triangleCount < settings.min_rebuild_triangles )
+        {
+            continue;
+        }
+
+        if ( node_area(node) > settings.max_area_growth * reference_area[index] )
+        {
+            degraded.push_back(index);
+            report.rebuilt_triangles += triangleCount;
+            continue;
+        }
+
+        stack.push_back(bvh.right(index));
+        stack.push_back(FlatBVH::left(index));
+    }
+
+    // rebuilding from the back keeps the indices of the subtrees still waiting valid
+    for ( auto it = degraded.rbegin(); it != degraded.rend(); ++it )
+    {
+        rebuild(bvh, *it);
+    }
+    report.rebuilt_subtrees = degraded.size();
+    return report;
+}
+
+void RefitMonitor::rebuild(FlatBVH& bvh, uint32_t node)
+{
+    uint32_t end = last_node(bvh, node) + 1;
+    uint32_t first = first_triangle(bvh, node);
+    uint32_t last = bvh.nodes[end - 1].offset + bvh.nodes[end - 1].count;
+
+    std::vector<Triangle*> triangles;
+    triangles.reserve(last - first);
+    for ( uint32_t i = first; i < last; ++i )
+    {
+        triangles.push_back(bvh.triangles[bvh.triangle_indices[i]]);
+    }
+
+    FlatBVH subtree = construct_flat(triangles, settings.build);
+
+    // the subtree's triangle indices refer to the local list, map them back to the model
+    std::vector<uint32_t> original(bvh.triangle_indices.begin() + first, bvh.triangle_indices.begin() + last);
+    for ( uint32_t i = 0; i < subtree.triangle_indices.size(); ++i )
+    {
+        bvh.triangle_indices[first + i] = original[subtree.triangle_indices[i]];
+    }
+
+    for ( FlatNode& child : subtree.nodes )
+    {
+        child.offset += child.is_leaf() ? first : node;
+    }
+
+    // every right child index behind the old subtree moves by the change in node count
+    int64_t delta = static_cast<int64_t>(subtree.nodes.size()) - static_cast<int64_t>(end - node);
+    for ( size_t i = 0; i < bvh.nodes.size(); ++i )
+    {
+        FlatNode& other = bvh.nodes[i];
+        if ( (i < node || i >= end) && !other.is_leaf() && other.offset >= end )
+        {
+            other.offset = static_cast<uint32_t>(other.offset + delta);
+        }
+    }
+
+    std::vector<float> areas;
+    areas.reserve(subtree.nodes.size());
+    for ( const FlatNode& child : subtree.nodes )
+    {
+        areas.push_back(node_area(child));
+    }
+
+    bvh.nodes.erase(bvh.nodes.begin() + node, bvh.nodes.begin() + end);
+    bvh.nodes.insert(bvh.nodes.begin() + node, subtree.nodes.begin(), subtree.nodes.end());
+    reference_area.erase(reference_area.begin() + node, reference_area.begin() + end);
+    reference_area.insert(reference_area.begin() + node, areas.begin(), areas.end());
+}
+
+} // namespace bvh
@@ -0,0 +1,81 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_build.hpp"
+#include "bvh_flat.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace bvh {
+
+/**
+ * Recomputes all node boxes of a flat tree from the current triangle vertices, bottom up in a single pass over the
+ * nodes. The topology and the triangle order stay untouched, so the tree remains valid but loses quality as the mesh
+ * deforms away from the shape it was built for.
+ *
+ * @param 	bvh	The tree whose triangles have moved.
+ */
+void refit(FlatBVH& bvh);
+
+/** Options of the RefitMonitor. */
+struct RefitSettings
+{
+    /**
+     * An interior node whose surface area has grown to more than this multiple of its area at the time it was built
+     * gets its subtree rebuilt. 0 disables the rebuilds and makes update a plain refit.
+     */
+    float max_area_growth = 2.0f;
+    /** Subtrees with fewer triangles are never rebuilt, their refit boxes are good enough. */
+    size_t min_rebuild_triangles = 64;
+    /** The settings the rebuilt subtrees are constructed with. */
+    BuildSettings build;
+};
+
+/** What the last RefitMonitor::update did. */
+struct RefitReport
+{
+    size_t refit_nodes = 0;
+    size_t rebuilt_subtrees = 0;
+    size_t rebuilt_triangles = 0;
+};
+
+/**
+ * Keeps a deforming model's flat tree usable from frame to frame. Every update refits the tree and then rebuilds
+ * only the largest subtrees whose boxes have degraded past RefitSettings::max_area_growth, which keeps the per frame
+ * cost linear while the mesh only moves a little and still repairs the tree once it is stretched. A rebuilt root is
+ * a full rebuild.
+ */
+class RefitMonitor
+{
+  public:
+    /**
+     * @param 	bvh     	The tree to watch, its current boxes are the reference for the growth threshold.
+     * @param 	settings	The monitor options.
+     */
+    RefitMonitor(const FlatBVH& bvh, const RefitSettings& settings = RefitSettings());
+
+    /**
+     * Refits the tree to the moved triangles and rebuilds the degraded subtrees. The tree must be the one the monitor
+     * was created for (or updated last).
+     */
+    RefitReport update(FlatBVH& bvh);
+
+    const RefitSettings& get_settings() const { return settings; }
+
+  private:
+    void rebuild(FlatBVH& bvh, uint32_t node);
+
+    RefitSettings settings;
+    /** Surface area of every node when it was last built. */
+    std::vector<float> reference_area;
+};
+
+} // namespace bvh
@@ -0,0 +1,219 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_scene.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace bvh {
+namespace {
+
+Aabb flat_bounds(const FlatNode& node)
+{
+    return Aabb(node.min, node.max);
+}
+
+} // namespace
+
+Scene::Scene(const BuildSettings& settings) : settings(settings) {}
+
+uint32_t Scene::add_mesh(const std::vector<Triangle*>& triangles)
+{
+    return add_mesh(construct_flat(triangles, settings));
+}
+
+uint32_t Scene::add_mesh(FlatBVH blas)
+{
+    meshes.push_back(std::make_unique<FlatBVH>(std::move(blas)));
+    return static_cast<uint32_t>(meshes.size() - 1);
+}
+
+uint32_t Scene::add_instance(uint32_t mesh, const glm::mat4& matrix)
+{
+    instances.push_back(Instance{ mesh, matrix });
+    world_bounds.emplace_back();
+    return static_cast<uint32_t>(instances.size() - 1);
+}
+
+void Scene::set_matrix(uint32_t instance, const glm::mat4& matrix)
+{
+    instances[instance].matrix = matrix;
+}
+
+void Scene::update(bool rebuild)
+{
+    for ( size_t i = 0; i < instances.size(); ++i )
+    {
+        const FlatBVH& blas = *meshes[instances[i].mesh];
+        world_bounds[i] = blas.empty() ? Aabb() : transform(instances[i].matrix, flat_bounds(blas.nodes[0]));
+    }
+
+    if ( instances.empty() )
+    {
+        top_level = FlatBVH();
+        top_level_instances = 0;
+        return;
+    }
+
+    if ( rebuild || top_level_instances != instances.size() )
+    {
+        top_level = construct_flat(world_bounds, settings);
+        top_level_instances = instances.size();
+    }
+    else
+    {
+        refit_top_level();
+    }
+}
+
+void Scene::refit_top_level()
+{
+    // the same reverse sweep as refit(FlatBVH&), with the instance bounds as the leaf contents
+    for ( size_t i = top_level.nodes.size(); i-- > 0; )
+    {
+        FlatNode& node = top_level.nodes[i];
+        Aabb bounds;
+
+        if ( node.is_leaf() )
+        {
+            for ( uint32_t j = 0; j < node.count; ++j )
+            {
+                bounds.grow(world_bounds[top_level.triangle_indices[node.offset + j]]);
+            }
+        }
+        else
+        {
+            bounds = flat_bounds(top_level.nodes[i + 1]);
+            bounds.grow(flat_bounds(top_level.nodes[node.offset]));
+        }
+
+        node.min = bounds.min;
+        node.max = bounds.max;
+    }
+}
+
+void Scene::find_pairs(std::vector<InstancePair>& out) const
+{
+    out.clear();
+    if ( top_level.empty() )
+    {
+        return;
+    }
+
+    auto addPair = [&](uint32_t first, uint32_t second) {
+        if ( overlaps(world_bounds[first], world_bounds[second]) )
+        {
+            out.push_back(InstancePair{ std::min(first, second), std::max(first, second) });
+        }
+    };
+
+    // the TLAS is tested against itself: a self task looks for pairs inside one subtree, a pair task between two
+    struct Task
+    {
+        uint32_t first;
+        uint32_t second;
+        bool self;
+    };
+
+    FlatTree tree{ top_level };
+    std::vector<Task> stack{ Task{ 0, 0, true } };
+
+    while ( !stack.empty() )
+    {
+        Task task = stack.back();
+        stack.pop_back();
+
+        const FlatNode& first = top_level.nodes[task.first];
+        const FlatNode& second = top_level.nodes[task.second];
+
+        if ( task.self )
+        {
+            if ( first.is_leaf() )
+            {
+                for ( uint32_t i = 0; i < first.count; ++i )
+                {
+                    for ( uint32_t j = i + 1; j < first.count; ++j )
+                    {
+                        addPair(top_level.triangle_indices[first.offset + i],
+                                top_level.triangle_indices[first.offset + j]);
+                    }
+                }
+                continue;
+            }
+
+            uint32_t left = FlatBVH::left(task.first);
+            uint32_t right = top_level.right(task.first);
+            stack.push_back(Task{ left, right, false });
+            stack.push_back(Task{ right, right, true });
+            stack.push_back(Task{ left, left, true });
+            continue;
+        }
+
+        Aabb firstBounds = flat_bounds(first);
+        Aabb secondBounds = flat_bounds(second);
+        if ( !overlaps(firstBounds, secondBounds) )
+        {
+            continue;
+        }
+
+        if ( first.is_leaf() && second.is_leaf() )
+        {
+            for ( uint32_t i = 0; i < first.count; ++i )
+            {
+                for ( uint32_t j = 0; j < second.count; ++j )
+                {
+                    addPair(top_level.triangle_indices[first.offset + i],
+                            top_level.triangle_indices[second.offset + j]);
+                }
+            }
+            continue;
+        }
+
+        for_each_child_pair(tree, tree, task.first, task.second, firstBounds, secondBounds, DescentRule::Larger,
+                            [&](uint32_t firstChild, uint32_t secondChild) {
+                                stack.push_back(Task{ firstChild, secondChild, false });
+                            });
+    }
+
+    std::sort(out.begin(), out.end(), [](const InstancePair& a, const InstancePair& b) {
+        return a.first != b.first ? a.first < b.first : a.second < b.second;
+    });
+}
+
+size_t Scene::collide(SceneContacts& out, const QuerySettings& settings)
+{
+    out.clear();
+    out.offsets.push_back(0);
+
+    find_pairs(pairs);
+    batch.clear();
+    for ( const InstancePair& pair : pairs )
+    {
+        const Instance& first = instances[pair.first];
+        const Instance& second = instances[pair.second];
+        batch.push_back(CollisionPair{ *meshes[first.mesh], first.matrix, *meshes[second.mesh], second.matrix });
+    }
+    collide_batch(batch, batch_contacts, settings);
+
+    for ( size_t i = 0; i < pairs.size(); ++i )
+    {
+        if ( batch_contacts.contact_count(i) == 0 )
+        {
+            continue;
+        }
+
+        const ContactPair* contacts = batch_contacts.pair_contacts(i);
+        out.pairs.push_back(pairs[i]);
+        out.contacts.insert(out.contacts.end(), contacts, contacts + batch_contacts.contact_count(i));
+        out.offsets.push_back(out.contacts.size());
+    }
+
+    return out.contacts.size();
+}
+
+} // namespace bvh
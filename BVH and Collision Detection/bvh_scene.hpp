@@ -0,0 +1,133 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_batch.hpp"
+#include "bvh_bounds.hpp"
+#include "bvh_build.hpp"
+#include "bvh_flat.hpp"
+#include "bvh_query.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace bvh {
+
+/** Pair of instances whose world bounds overlap, given by their indices in the scene (first < second). */
+struct InstancePair
+{
+    uint32_t first;
+    uint32_t second;
+};
+
+/**
+ * Output of Scene::collide. The contacts of all colliding instance pairs are stored in one array; the contacts of
+ * pairs[i] are contacts[offsets[i]] to contacts[offsets[i + 1]] (exclusive). Only pairs with contacts are listed. The
+ * buffer keeps its capacity from one query to the next.
+ */
+struct SceneContacts
+{
+    std::vector<InstancePair> pairs;
+    std::vector<size_t> offsets;
+    std::vector<ContactPair> contacts;
+
+    void clear()
+    {
+        pairs.clear();
+        offsets.clear();
+        contacts.clear();
+    }
+};
+
+/**
+ * Two-level collision structure over many placed models. Every mesh gets its bottom level tree (BLAS) built once,
+ * any number of instances can share it with their own model matrices. The top level tree (TLAS) is built over the
+ * world bounds of the instances and is rebuilt or refit on update(); it finds the instance pairs whose bounds overlap,
+ * and only those reach the per pair collide over the two BLASes.
+ */
+class Scene
+{
+  public:
+    explicit Scene(const BuildSettings& settings = BuildSettings());
+
+    /**
+     * Builds the BLAS of a mesh.
+     *
+     * @param 	triangles	The triangles of the mesh (must not be empty).
+     * @return	The index of the mesh, used by add_instance.
+     */
+    uint32_t add_mesh(const std::vector<Triangle*>& triangles);
+
+    /** Adds a mesh whose BLAS has been built (or loaded) already. */
+    uint32_t add_mesh(FlatBVH blas);
+
+    /**
+     * Places a mesh in the scene. The instance takes part in the queries after the next update().
+     *
+     * @return	The index of the instance.
+     */
+    uint32_t add_instance(uint32_t mesh, const glm::mat4& matrix);
+
+    void set_matrix(uint32_t instance, const glm::mat4& matrix);
+
+    /**
+     * Recomputes the world bounds of all instances and the TLAS over them. A refit keeps the TLAS topology and only
+     * adapts its boxes, which is enough while the instances move little relative to each other; the TLAS is rebuilt
+     * anyway if instances were added since the last rebuild.
+     *
+     * @param 	rebuild	Whether to rebuild the TLAS from scratch instead of refitting it.
+     */
+    void update(bool rebuild = true);
+
+    /** Appends the instance pairs whose world bounds overlap to out, which is cleared first. */
+    void find_pairs(std::vector<InstancePair>& out) const;
+
+    /**
+     * Runs collide on the BLASes of every overlapping instance pair, all pairs at once through collide_batch: with
+     * settings.threads other than 1 the threads share the pairs and split the expensive ones further.
+     *
+     * @param 	out     	The contacts of all pairs, cleared first.
+     * @param 	settings	The options of the per pair queries; settings.stats receives the sum over all pairs.
+     * @return	The total number of contacts.
+     */
+    size_t collide(SceneContacts& out, const QuerySettings& settings = QuerySettings());
+
+    const FlatBVH& get_mesh(uint32_t mesh) const { return *meshes[mesh]; }
+    uint32_t get_instance_mesh(uint32_t instance) const { return instances[instance].mesh; }
+    const glm::mat4& get_matrix(uint32_t instance) const { return instances[instance].matrix; }
+    const Aabb& get_world_bounds(uint32_t instance) const { return world_bounds[instance]; }
+    size_t get_instance_count() const { return instances.size(); }
+
+  private:
+    struct Instance
+    {
+        uint32_t mesh;
+        glm::mat4 matrix;
+    };
+
+    void refit_top_level();
+
+    BuildSettings settings;
+    // the BLASes are held by pointer so that references to them stay valid while meshes are added
+    std::vector<std::unique_ptr<FlatBVH>> meshes;
+    std::vector<Instance> instances;
+    std::vector<Aabb> world_bounds;
+    FlatBVH top_level;
+    /** The number of instances covered by top_level. */
+    size_t top_level_instances = 0;
+
+    // scratch of the queries
+    std::vector<InstancePair> pairs;
+    std::vector<CollisionPair> batch;
+    BatchContacts batch_contacts;
+};
+
+} // namespace bvh
@@ -0,0 +1,557 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_stream.hpp"
+
+#include "bvh_bounds.hpp"
+#include "bvh_cache.hpp"
+#include "bvh_flat.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <utility>
+
+namespace bvh {
+namespace {
+
+/** A triangle in a bucket file, which also has to carry the index of the triangle in the triangle file. */
+struct Record
+{
+    uint32_t index;
+    glm::vec3 vertices[3];
+};
+
+static_assert(sizeof(Record) == 40, "bucket file records are expected to be packed");
+
+constexpr size_t kTriangleBytes = 9 * sizeof(float);
+// rough peak memory of construct_flat per box, including the records and boxes of the bucket and the built nodes
+constexpr size_t kInCoreBytesPerTriangle = 256;
+// a distribution pass writes at most this many buckets, through buffers of at least kMinBufferBytes each
+constexpr size_t kMaxBuckets = 4096;
+constexpr size_t kMinBufferBytes = 4096;
+
+static_assert(kMinStreamMemoryBudget >= 2 * 8 * kMinBufferBytes, "a pass into eight buckets must fit into the budget");
+
+/** Records per read chunk, a quarter of the budget including the floats read from a triangle file. */
+size_t read_chunk_records(size_t memory_budget)
+{
+    return std::max<size_t>(memory_budget / 4 / (sizeof(Record) + kTriangleBytes), 1);
+}
+
+Aabb record_bounds(const Record& record)
+{
+    Aabb bounds;
+    for ( const glm::vec3& v : record.vertices )
+    {
+        bounds.grow(v);
+    }
+    return bounds;
+}
+
+/** Spreads the lowest 10 bits of the value so that there are two zero bits between every two of them. */
+uint32_t spread_bits(uint32_t value)
+{
+    value = (value | (value << 16)) & 0x030000FFu;
+    value = (value | (value << 8)) & 0x0300F00Fu;
+    value = (value | (value << 4)) & 0x030C30C3u;
+    value = (value | (value << 2)) & 0x09249249u;
+    return value;
+}
+
+/** 30-bit Morton code of the point within the box. */
+uint32_t morton_code(const glm::vec3& point, const Aabb& box)
+{
+    uint32_t code = 0;
+    glm::vec3 extent = box.extent();
+    for ( int axis = 0; axis < 3; ++axis )
+    {
+        float t = extent[axis] > 0.0f ? (point[axis] - box.min[axis]) / extent[axis] : 0.0f;
+        uint32_t cell = static_cast<uint32_t>(std::min(std::max(t * 1024.0f, 0.0f), 1023.0f));
+        code |= spread_bits(cell) << (2 - axis);
+    }
+    return code;
+}
+
+/** A temporary file of records, or the triangle file itself. */
+struct Bucket
+{
+    std::string path;
+    bool is_triangle_file = false;
+    uint64_t count = 0;
+    Aabb centroid_bounds;
+};
+
+/** Reads the records of a bucket in chunks. */
+class BucketReader
+{
+  public:
+    explicit BucketReader(const Bucket& bucket)
+        : file(bucket.path, std::ios::binary), is_triangle_file(bucket.is_triangle_file)
+    {
+    }
+
+    bool is_open() const { return static_cast<bool>(file); }
+
+    /** Reads up to max_count records, fewer only at the end of the file. */
+    size_t read(std::vector<Record>& records, size_t max_count)
+    {
+        records.resize(max_count);
+        size_t count = 0;
+
+        if ( is_triangle_file )
+        {
+            floats.resize(9 * max_count);
+            file.read(reinterpret_cast<char*>(floats.data()),
+                      static_cast<std::streamsize>(max_count * kTriangleBytes));
+            count = static_cast<size_t>(file.gcount()) / kTriangleBytes;
+            for ( size_t i = 0; i < count; ++i )
+            {
+                records[i].index = next_index++;
+                for ( int v = 0; v < 3; ++v )
+                {
+                    records[i].vertices[v] = glm::vec3(floats[9 * i + 3 * v], floats[9 * i + 3 * v + 1],
+                                                       floats[9 * i + 3 * v + 2]);
+                }
+            }
+        }
+        else
+        {
+            file.read(reinterpret_cast<char*>(records.data()),
+                      static_cast<std::streamsize>(max_count * sizeof(Record)));
+            count = static_cast<size_t>(file.gcount()) / sizeof(Record);
+        }
+
+        records.resize(count);
+        return count;
+    }
+
+  private:
+    std::ifstream file;
+    bool is_triangle_file;
+    std::vector<float> floats;
+    uint32_t next_index = 0;
+};
+
+/** Distributes records into bucket files through a buffer per bucket. */
+class BucketWriter
+{
+  public:
+    BucketWriter(std::vector<Bucket>& buckets, size_t buffer_records)
+        : buckets(buckets), buffers(buckets.size()), created(buckets.size(), false),
+          buffer_records(std::max<size_t>(buffer_records, 1))
+    {
+        // allocated up front, so that the buffers take exactly what the budget gives them
+        for ( std::vector<Record>& buffer : buffers )
+        {
+            buffer.reserve(this->buffer_records);
+        }
+    }
+
+    void add(size_t bucket, const Record& record)
+    {
+        buckets[bucket].count++;
+        glm::vec3 centroid = record_bounds(record).center();
+        buckets[bucket].centroid_bounds.grow(centroid);
+
+        buffers[bucket].push_back(record);
+        if ( buffers[bucket].size() >= buffer_records )
+        {
+            flush(bucket);
+        }
+    }
+
+    /** Writes out all buffers, returns whether all writes succeeded. */
+    bool finish()
+    {
+        for ( size_t bucket = 0; bucket < buckets.size(); ++bucket )
+        {
+            flush(bucket);
+        }
+        return !failed;
+    }
+
+  private:
+    void flush(size_t bucket)
+    {
+        if ( buffers[bucket].empty() )
+        {
+            return;
+        }
+
+        // opened per flush, so that the number of buckets is not limited by the number of open files
+        std::ofstream file(buckets[bucket].path,
+                           std::ios::binary | (created[bucket] ? std::ios::app : std::ios::trunc));
+        file.write(reinterpret_cast<const char*>(buffers[bucket].data()),
+                   static_cast<std::streamsize>(buffers[bucket].size() * sizeof(Record)));
+        failed |= !file;
+        created[bucket] = true;
+        buffers[bucket].clear();
+    }
+
+    std::vector<Bucket>& buckets;
+    std::vector<std::vector<Record>> buffers;
+    std::vector<bool> created;
+    size_t buffer_records;
+    bool failed = false;
+};
+
+class StreamBuilder
+{
+  public:
+    StreamBuilder(const std::string& cache_path, const StreamBuildSettings& settings, StreamBuildReport& report)
+        : cache_path(cache_path), settings(settings), report(report)
+    {
+        capacity = std::max<size_t>(settings.memory_budget / kInCoreBytesPerTriangle, 2);
+        chunk_records = read_chunk_records(settings.memory_budget);
+
+        std::string directory = settings.temp_directory;
+        std::string name = cache_path;
+        size_t slash = cache_path.find_last_of("/\\");
+        if ( !directory.empty() && slash != std::string::npos )
+        {
+            name = cache_path.substr(slash + 1);
+        }
+        temp_prefix = directory.empty() ? cache_path : directory + "/" + name;
+    }
+
+    bool run(const Bucket& input, uint64_t key)
+    {
+        out.open(cache_path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+        indices.open(indices_path(), std::ios::binary | std::ios::trunc);
+        if ( !out || !indices )
+        {
+            return cleanup(false);
+        }
+
+        const char blank[kCacheHeaderBytes] = {};
+        out.write(blank, kCacheHeaderBytes);
+
+        Aabb bounds;
+        if ( !emit(input, bounds) )
+        {
+            return cleanup(false);
+        }
+
+        // the triangle indices follow the nodes, copied through a buffer of a quarter of the budget
+        records = std::vector<Record>();
+        boxes = std::vector<Aabb>();
+        indices.close();
+        std::ifstream indexFile(indices_path(), std::ios::binary);
+        std::vector<char> buffer(settings.memory_budget / 4);
+        while ( indexFile )
+        {
+            indexFile.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            out.write(buffer.data(), indexFile.gcount());
+        }
+        indexFile.close();
+
+        out.seekp(0);
+        write_cache_header(out, key, node_count, index_count, input.count);
+        out.flush();
+
+        report.nodes = node_count;
+        report.key = key;
+        return cleanup(static_cast<bool>(out) && index_count == input.count);
+    }
+
+  private:
+    /** Appends the subtree of the bucket to the output, the bucket file is removed once it is no longer needed. */
+    bool emit(const Bucket& bucket, Aabb& bounds)
+    {
+        if ( bucket.count <= capacity )
+        {
+            bool built = build_in_memory(bucket, bounds);
+            remove(bucket);
+            return built;
+        }
+
+        std::vector<Bucket> parts;
+        bool distributed = distribute(bucket, parts);
+        remove(bucket);
+        return distributed && emit(parts, 0, parts.size(), bounds);
+    }
+
+    /** Appends the subtree over the given range of buckets, halving the range at every interior node. */
+    bool emit(std::vector<Bucket>& buckets, size_t first, size_t last, Aabb& bounds)
+    {
+        if ( last - first == 1 )
+        {
+            return emit(buckets[first], bounds);
+        }
+
+        uint64_t index = node_count++;
+        FlatNode node = {};
+        out.write(reinterpret_cast<const char*>(&node), sizeof(node));
+
+        size_t middle = first + (last - first) / 2;
+        Aabb leftBounds, rightBounds;
+        if ( !emit(buckets, first, middle, leftBounds) )
+        {
+            return false;
+        }
+        uint64_t right = node_count;
+        if ( !emit(buckets, middle, last, rightBounds) )
+        {
+            return false;
+        }
+
+        bounds = leftBounds;
+        bounds.grow(rightBounds);
+        node.min = bounds.min;
+        node.max = bounds.max;
+        node.offset = static_cast<uint32_t>(right);
+        node.count = 0;
+
+        out.seekp(static_cast<std::streamoff>(kCacheHeaderBytes + index * sizeof(FlatNode)));
+        out.write(reinterpret_cast<const char*>(&node), sizeof(node));
+        out.seekp(0, std::ios::end);
+        return static_cast<bool>(out);
+    }
+
+    bool build_in_memory(const Bucket& bucket, Aabb& bounds)
+    {
+        BucketReader reader(bucket);
+        if ( !reader.is_open() || reader.read(records, static_cast<size_t>(bucket.count)) != bucket.count )
+        {
+            return false;
+        }
+
+        boxes.resize(records.size());
+        for ( size_t i = 0; i < records.size(); ++i )
+        {
+            boxes[i] = record_bounds(records[i]);
+        }
+        FlatBVH local = construct_flat(boxes, settings.build);
+
+        // the local indices become indices of the output arrays
+        uint32_t nodeBase = static_cast<uint32_t>(node_count);
+        uint32_t indexBase = static_cast<uint32_t>(index_count);
+        for ( FlatNode& node : local.nodes )
+        {
+            node.offset += node.is_leaf() ? indexBase : nodeBase;
+        }
+        out.write(reinterpret_cast<const char*>(local.nodes.data()),
+                  static_cast<std::streamsize>(local.nodes.size() * sizeof(FlatNode)));
+
+        for ( uint32_t& index : local.triangle_indices )
+        {
+            index = records[index].index;
+        }
+        indices.write(reinterpret_cast<const char*>(local.triangle_indices.data()),
+                      static_cast<std::streamsize>(local.triangle_indices.size() * sizeof(uint32_t)));
+
+        node_count += local.nodes.size();
+        index_count += local.triangle_indices.size();
+        bounds = Aabb(local.nodes[0].min, local.nodes[0].max);
+
+        report.buckets++;
+        report.max_bucket_triangles = std::max(report.max_bucket_triangles, records.size());
+        return out && indices;
+    }
+
+    /**
+     * Distributes the records of the bucket by the leading bits of their Morton codes, leaving out empty buckets. If
+     * all centroids coincide, the records are split in halves in file order instead.
+     */
+    bool distribute(const Bucket& bucket, std::vector<Bucket>& parts)
+    {
+        bool byOrder = bucket.centroid_bounds.extent() == glm::vec3(0.0f);
+
+        // the scratch of the last in-memory build is not needed until the next one
+        records = std::vector<Record>();
+        boxes = std::vector<Aabb>();
+
+        // with at least one bit per axis, any axis along which the centroids differ separates two buckets; more bits
+        // while the parts would not fit into memory, as long as their write buffers fit into half of the budget
+        size_t maxParts = std::min(settings.memory_budget / (2 * kMinBufferBytes), kMaxBuckets);
+        int bits = 3;
+        while ( (size_t(1) << (bits + 1)) <= maxParts && (uint64_t(1) << bits) * capacity / 2 < bucket.count )
+        {
+            bits++;
+        }
+        size_t partCount = byOrder ? 2 : size_t(1) << bits;
+
+        parts.resize(partCount);
+        for ( Bucket& part : parts )
+        {
+            part.path = temp_prefix + ".part" + std::to_string(temp_count++);
+        }
+
+        size_t bufferRecords = std::max(settings.memory_budget / 2 / partCount, kMinBufferBytes) / sizeof(Record);
+        BucketWriter writer(parts, bufferRecords);
+        BucketReader reader(bucket);
+        if ( !reader.is_open() )
+        {
+            return false;
+        }
+
+        uint64_t position = 0;
+        while ( reader.read(records, chunk_records) > 0 )
+        {
+            for ( const Record& record : records )
+            {
+                size_t part = byOrder ? (2 * position >= bucket.count ? 1 : 0)
+                                      : morton_code(record_bounds(record).center(), bucket.centroid_bounds) >>
+                                            (30 - bits);
+                writer.add(part, record);
+                position++;
+            }
+        }
+        if ( !writer.finish() || position != bucket.count )
+        {
+            return false;
+        }
+
+        parts.erase(std::remove_if(parts.begin(), parts.end(), [](const Bucket& part) { return part.count == 0; }),
+                    parts.end());
+        return true;
+    }
+
+    void remove(const Bucket& bucket)
+    {
+        if ( !bucket.is_triangle_file )
+        {
+            std::remove(bucket.path.c_str());
+        }
+    }
+
+    std::string indices_path() const { return temp_prefix + ".indices"; }
+
+    bool cleanup(bool success)
+    {
+        indices.close();
+        std::remove(indices_path().c_str());
+        out.close();
+        if ( !success )
+        {
+            std::remove(cache_path.c_str());
+        }
+        return success;
+    }
+
+    const std::string& cache_path;
+    const StreamBuildSettings& settings;
+    StreamBuildReport& report;
+
+    size_t capacity;
+    size_t chunk_records;
+    std::string temp_prefix;
+    size_t temp_count = 0;
+
+    std::fstream out;
+    std::ofstream indices;
+    uint64_t node_count = 0;
+    uint64_t index_count = 0;
+
+    // scratch of the in-memory builds and distribution passes
+    std::vector<Record> records;
+    std::vector<Aabb> boxes;
+};
+
+} // namespace
+
+bool save_triangles(const std::string& path, const std::vector<Triangle*>& triangles)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    for ( const Triangle* tr : triangles )
+    {
+        for ( const glm::vec4& v : { tr->v1, tr->v2, tr->v3 } )
+        {
+            float xyz[3] = { v.x, v.y, v.z };
+            file.write(reinterpret_cast<const char*>(xyz), sizeof(xyz));
+        }
+    }
+    file.flush();
+    return static_cast<bool>(file);
+}
+
+bool cache_key(const std::string& triangle_path, const BuildSettings& settings, uint64_t& key)
+{
+    std::ifstream file(triangle_path, std::ios::binary | std::ios::ate);
+    if ( !file )
+    {
+        return false;
+    }
+    uint64_t size = static_cast<uint64_t>(file.tellg());
+    file.close();
+    if ( size % kTriangleBytes != 0 )
+    {
+        return false;
+    }
+
+    Bucket input{ triangle_path, true, size / kTriangleBytes, Aabb() };
+    BucketReader reader(input);
+    std::vector<Record> records;
+    CacheKey hash(input.count);
+    uint64_t count = 0;
+
+    while ( reader.read(records, 1 << 16) > 0 )
+    {
+        for ( const Record& record : records )
+        {
+            hash.add_triangle(record.vertices[0], record.vertices[1], record.vertices[2]);
+        }
+        count += records.size();
+    }
+    if ( count != input.count )
+    {
+        return false;
+    }
+
+    key = hash.finish(settings);
+    return true;
+}
+
+bool build_streamed(const std::string& triangle_path, const std::string& cache_path,
+                    const StreamBuildSettings& settings, StreamBuildReport* report)
+{
+    StreamBuildReport localReport;
+    StreamBuildReport& stats = report != nullptr ? *report : localReport;
+    stats = StreamBuildReport();
+
+    std::ifstream file(triangle_path, std::ios::binary | std::ios::ate);
+    if ( !file )
+    {
+        return false;
+    }
+    uint64_t size = static_cast<uint64_t>(file.tellg());
+    file.close();
+    if ( size == 0 || size % kTriangleBytes != 0 || size / kTriangleBytes > UINT32_MAX / 2 ||
+         settings.memory_budget < kMinStreamMemoryBudget )
+    {
+        return false;
+    }
+
+    // the first pass finds the centroid bounds of the whole file and computes the key on the way
+    Bucket input{ triangle_path, true, size / kTriangleBytes, Aabb() };
+    BucketReader reader(input);
+    std::vector<Record> records;
+    CacheKey hash(input.count);
+    size_t chunk = read_chunk_records(settings.memory_budget);
+    uint64_t count = 0;
+
+    while ( reader.read(records, chunk) > 0 )
+    {
+        for ( const Record& record : records )
+        {
+            hash.add_triangle(record.vertices[0], record.vertices[1], record.vertices[2]);
+            input.centroid_bounds.grow(record_bounds(record).center());
+        }
+        count += records.size();
+    }
+    if ( count != input.count )
+    {
+        return false;
+    }
+    records = std::vector<Record>();
+
+    stats.triangles = input.count;
+    return StreamBuilder(cache_path, settings, stats).run(input, hash.finish(settings.build));
+}
+
+} // namespace bvh
@@ -0,0 +1,95 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_build.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bvh {
+
+/*
+ * Triangle files are plain arrays of triangles, nine native floats each (x, y, z of the three vertices). The index of
+ * a triangle is its position in the file, which makes it the order the built tree refers to.
+ */
+
+/** The smallest memory budget of the streaming build, enough for the write buffers of a pass into eight buckets. */
+constexpr size_t kMinStreamMemoryBudget = size_t(64) << 10;
+
+/** Options of the streaming build. */
+struct StreamBuildSettings
+{
+    /** Settings of the in-memory builds of the buckets, max_depth counts from the bucket roots. */
+    BuildSettings build;
+    /**
+     * Upper bound of the memory the build uses at any time, in bytes, at least kMinStreamMemoryBudget. The read
+     * chunks take a quarter of it and the bucket write buffers half; the buckets built in memory are sized by an
+     * estimate of the peak memory of construct_flat per triangle, so the bound holds up to that estimate (and the
+     * small fixed overhead of the file streams).
+     */
+    size_t memory_budget = size_t(256) << 20;
+    /** Directory of the temporary bucket files; empty puts them next to the output file. */
+    std::string temp_directory;
+};
+
+/** Statistics of a streaming build. */
+struct StreamBuildReport
+{
+    uint64_t triangles = 0;
+    uint64_t nodes = 0;
+    /** The number of buckets built in memory, and the number of triangles of the largest one. */
+    size_t buckets = 0;
+    size_t max_bucket_triangles = 0;
+    /** The key written to the cache file, the one to pass to MappedCache::open. */
+    uint64_t key = 0;
+};
+
+/**
+ * Writes the triangles in the triangle file format, for example to convert a model for build_streamed.
+ *
+ * @param 	path     	The file to write, replaced if it exists.
+ * @param 	triangles	The triangles.
+ * @return	Whether the whole file was written.
+ */
+bool save_triangles(const std::string& path, const std::vector<Triangle*>& triangles);
+
+/**
+ * The cache_key of the triangles of a triangle file, read in chunks. The key equals cache_key of the same triangles
+ * in memory, so a file built either way can be opened by the other.
+ *
+ * @param 	triangle_path	The triangle file.
+ * @param 	settings     	The build settings.
+ * @param 	key          	Receives the key.
+ * @return	Whether the file could be read.
+ */
+bool cache_key(const std::string& triangle_path, const BuildSettings& settings, uint64_t& key);
+
+/**
+ * Builds the BVH of a triangle file that need not fit in memory and writes it as a cache file for MappedCache.
+ *
+ * The triangles are streamed in chunks and distributed into bucket files by the Morton code of their centroids, a
+ * bucket holding more triangles than fit into the budget is distributed again over its own centroid bounds. Every
+ * bucket is then built in memory with construct_flat, and its nodes are appended to the output as soon as it is
+ * done; the buckets, which follow the Morton curve, are joined by halving their list. Nothing but the bucket being
+ * built and the write buffers is held in memory.
+ *
+ * @param 	triangle_path	The triangle file.
+ * @param 	cache_path   	The cache file to write, replaced if it exists.
+ * @param 	settings     	The build options.
+ * @param 	report       	Receives the statistics of the build, if given.
+ * @return	Whether the cache file was written; false if a file could not be read or written, the triangle file is
+ *			empty or not a whole number of triangles, or the memory budget is below kMinStreamMemoryBudget.
+ */
+bool build_streamed(const std::string& triangle_path, const std::string& cache_path,
+                    const StreamBuildSettings& settings = StreamBuildSettings(), StreamBuildReport* report = nullptr);
+
+} // namespace bvh
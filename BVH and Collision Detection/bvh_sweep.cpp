@@ -0,0 +1,227 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_sweep.hpp"
+
+#include "bvh_bounds.hpp"
+#include "bvh_traversal.hpp"
+#include "triangle_tests.hpp"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <vector>
+
+namespace bvh {
+namespace {
+
+glm::mat4 blend(const glm::mat4& start, const glm::mat4& end, float t)
+{
+    return start * (1.0f - t) + end * t;
+}
+
+/** World space vertices of the triangles of a leaf at time 0 and time 1. */
+struct SweptLeaf
+{
+    std::vector<glm::vec3> start;
+    std::vector<glm::vec3> end;
+
+    void load(const FlatBVHView& bvh, const FlatNode& leaf, const glm::mat4& start_matrix, const glm::mat4& end_matrix)
+    {
+        start.resize(3 * leaf.count);
+        end.resize(3 * leaf.count);
+        for ( uint32_t i = 0; i < leaf.count; ++i )
+        {
+            const Triangle& tr = bvh.leaf_triangle(leaf, i);
+            const glm::vec4* vertices[3] = { &tr.v1, &tr.v2, &tr.v3 };
+            for ( int v = 0; v < 3; ++v )
+            {
+                start[3 * i + v] = glm::vec3(start_matrix * *vertices[v]);
+                end[3 * i + v] = glm::vec3(end_matrix * *vertices[v]);
+            }
+        }
+    }
+};
+
+float max_displacement(const glm::vec3* start, const glm::vec3* end)
+{
+    float longest = 0.0f;
+    for ( int v = 0; v < 3; ++v )
+    {
+        longest = std::max(longest, glm::length(end[v] - start[v]));
+    }
+    return longest;
+}
+
+class Sweeper
+{
+  public:
+    Sweeper(const FlatBVHView& first, const glm::mat4& first_start, const glm::mat4& first_end,
+            const FlatBVHView& second, const glm::mat4& second_start, const glm::mat4& second_end,
+            const SweepSettings& settings)
+        : first(first), second(second), first_start(first_start), first_end(first_end), second_start(second_start),
+          second_end(second_end), settings(settings)
+    {
+        update_limit(1.0f);
+    }
+
+    SweepResult run()
+    {
+        FlatViewTree firstTree{ first };
+        FlatViewTree secondTree{ second };
+
+        TraversalStack<NodePair> stack;
+        stack.push(NodePair{ 0, 0 });
+
+        while ( !stack.empty() )
+        {
+            NodePair pair = stack.pop();
+
+            Aabb firstBounds = swept_bounds(firstTree.bounds(pair.first), first_start, first_limit);
+            Aabb secondBounds = swept_bounds(secondTree.bounds(pair.second), second_start, second_limit);
+            if ( !overlaps(firstBounds, secondBounds) )
+            {
+                continue;
+            }
+
+            if ( firstTree.is_leaf(pair.first) && secondTree.is_leaf(pair.second) )
+            {
+                test_leaves(pair.first, pair.second);
+                continue;
+            }
+
+            // pushed in reverse so that they are popped in visiting order
+            std::array<NodePair, 2> children;
+            size_t childCount = 0;
+            for_each_child_pair(firstTree, secondTree, pair.first, pair.second, firstBounds, secondBounds,
+                                DescentRule::Larger, [&](uint32_t firstChild, uint32_t secondChild) {
+                                    children[childCount++] = NodePair{ firstChild, secondChild };
+                                });
+            while ( childCount > 0 )
+            {
+                stack.push(children[--childCount]);
+            }
+        }
+
+        return result;
+    }
+
+  private:
+    /** The box of a node over the time interval [0, limit], given the blended matrix at the limit. */
+    static Aabb swept_bounds(const Aabb& local, const glm::mat4& start, const glm::mat4& limit)
+    {
+        Aabb bounds = transform(start, local);
+        bounds.grow(transform(limit, local));
+        return bounds;
+    }
+
+    /** Only hits before the limit matter from now on, the swept boxes shrink to that interval. */
+    void update_limit(float limit)
+    {
+        time_limit = limit;
+        first_limit = blend(first_start, first_end, limit);
+        second_limit = blend(second_start, second_end, limit);
+    }
+
+    void test_leaves(uint32_t first_index, uint32_t second_index)
+    {
+        const FlatNode& firstNode = first.nodes[first_index];
+        const FlatNode& secondNode = second.nodes[second_index];
+        first_leaf.load(first, firstNode, first_start, first_end);
+        second_leaf.load(second, secondNode, second_start, second_end);
+
+        for ( uint32_t i = 0; i < firstNode.count; ++i )
+        {
+            for ( uint32_t j = 0; j < secondNode.count; ++j )
+            {
+                float time = advance(&first_leaf.start[3 * i], &first_leaf.end[3 * i], &second_leaf.start[3 * j],
+                                     &second_leaf.end[3 * j]);
+                if ( result.hit ? time < result.time : time <= time_limit )
+                {
+                    result.hit = true;
+                    result.time = time;
+                    result.pair = ContactPair{ first.triangle_indices[firstNode.offset + i],
+                                               second.triangle_indices[secondNode.offset + j] };
+                    update_limit(time);
+                }
+            }
+        }
+    }
+
+    /**
+     * Conservative advancement of one triangle pair. No point of a triangle moves faster than its fastest vertex, so
+     * the distance of the pair shrinks by at most the sum of the fastest displacements of both per unit of time.
+     * Returns the time of contact, or infinity if there is none before the limit.
+     */
+    float advance(const glm::vec3* first_start_vertices, const glm::vec3* first_end_vertices,
+                  const glm::vec3* second_start_vertices, const glm::vec3* second_end_vertices) const
+    {
+        constexpr float kNever = std::numeric_limits<float>::infinity();
+        float speed = max_displacement(first_start_vertices, first_end_vertices) +
+                      max_displacement(second_start_vertices, second_end_vertices);
+
+        float time = 0.0f;
+        for ( int iteration = 0; iteration < settings.max_iterations; ++iteration )
+        {
+            glm::vec3 firstNow[3];
+            glm::vec3 secondNow[3];
+            for ( int v = 0; v < 3; ++v )
+            {
+                firstNow[v] = glm::mix(first_start_vertices[v], first_end_vertices[v], time);
+                secondNow[v] = glm::mix(second_start_vertices[v], second_end_vertices[v], time);
+            }
+
+            float distance = triangle_distance(firstNow, secondNow);
+            if ( distance <= settings.tolerance )
+            {
+                return time;
+            }
+            if ( speed <= 0.0f )
+            {
+                return kNever;
+            }
+
+            time += distance / speed;
+            if ( time > time_limit )
+            {
+                return kNever;
+            }
+        }
+        return time;
+    }
+
+    const FlatBVHView& first;
+    const FlatBVHView& second;
+    const glm::mat4& first_start;
+    const glm::mat4& first_end;
+    const glm::mat4& second_start;
+    const glm::mat4& second_end;
+    const SweepSettings& settings;
+
+    float time_limit = 1.0f;
+    glm::mat4 first_limit;
+    glm::mat4 second_limit;
+    SweepResult result;
+
+    SweptLeaf first_leaf;
+    SweptLeaf second_leaf;
+};
+
+} // namespace
+
+SweepResult sweep(const FlatBVHView& first, const glm::mat4& first_start, const glm::mat4& first_end,
+                  const FlatBVHView& second, const glm::mat4& second_start, const glm::mat4& second_end,
+                  const SweepSettings& settings)
+{
+    if ( first.empty() || second.empty() )
+    {
+        return SweepResult();
+    }
+    return Sweeper(first, first_start, first_end, second, second_start, second_end, settings).run();
+}
+
+} // namespace bvh
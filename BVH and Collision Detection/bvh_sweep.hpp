@@ -0,0 +1,59 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_flat.hpp"
+#include "bvh_query.hpp"
+
+namespace bvh {
+
+/** Options of the swept query. */
+struct SweepSettings
+{
+    /** Triangles closer than this (in world units) are in contact. */
+    float tolerance = 1e-4f;
+    /**
+     * Conservative advancement steps per triangle pair. A pair that has not reached the tolerance by then is reported
+     * as in contact at the time reached, so that fast pairs can end early but never tunnel.
+     */
+    int max_iterations = 64;
+};
+
+/** Outcome of a swept query. */
+struct SweepResult
+{
+    bool hit = false;
+    /** Time of impact in [0, 1] (the start and end pose), 1 if there is no hit. */
+    float time = 1.0f;
+    /** The pair of triangles that touch first. */
+    ContactPair pair{ 0, 0 };
+};
+
+/**
+ * Continuous collision test of two moving models, finding the first time at which they touch. Every vertex moves on
+ * the straight line between its world positions under the start and end matrix, so the pose at time t is given by
+ * the blended matrix (1 - t) * start + t * end; for rotations this is the usual linear approximation of the motion.
+ *
+ * The traversal tests node boxes swept over [0, time of the earliest hit found so far] against each other, and every
+ * triangle pair of overlapping leaves is advanced in conservative steps: by its current distance divided by the
+ * fastest a vertex of the pair can close in on the other triangle, which can never step past the contact.
+ *
+ * @param 	first	      The first BVH.
+ * @param 	first_start   The model matrix of the first model at time 0.
+ * @param 	first_end     The model matrix of the first model at time 1.
+ * @param   second        The second BVH.
+ * @param 	second_start  The model matrix of the second model at time 0.
+ * @param 	second_end    The model matrix of the second model at time 1.
+ * @param   settings      The query options.
+ */
+SweepResult sweep(const FlatBVHView& first, const glm::mat4& first_start, const glm::mat4& first_end,
+                  const FlatBVHView& second, const glm::mat4& second_start, const glm::mat4& second_end,
+                  const SweepSettings& settings = SweepSettings());
+
+} // namespace bvh
@@ -0,0 +1,168 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_thread_pool.hpp"
+
+namespace bvh {
+namespace {
+
+// the pool and queue of the worker running on this thread (nullptr outside of any pool)
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local unsigned currentQueue = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(unsigned worker_count)
+{
+    for ( unsigned i = 0; i <= worker_count; ++i )
+    {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for ( unsigned i = 0; i < worker_count; ++i )
+    {
+        workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for ( std::thread& worker : workers )
+    {
+        worker.join();
+    }
+}
+
+unsigned ThreadPool::own_queue_index() const
+{
+    return currentPool == this ? currentQueue : static_cast<unsigned>(workers.size());
+}
+
+void ThreadPool::submit(Task task)
+{
+    Queue& queue = *queues[own_queue_index()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    queued.fetch_add(1, std::memory_order_release);
+    {
+        // taking the lock orders the notification after a worker's check of the queued count
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::take_task(unsigned own_queue, Task& task)
+{
+    if ( queued.load(std::memory_order_acquire) == 0 )
+    {
+        return false;
+    }
+
+    // newest own task first
+    {
+        Queue& queue = *queues[own_queue];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if ( !queue.tasks.empty() )
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // then the oldest task of somebody else, which is usually the largest one
+    for ( size_t offset = 1; offset < queues.size(); ++offset )
+    {
+        Queue& queue = *queues[(own_queue + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if ( !queue.tasks.empty() )
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ThreadPool::run_pending_task()
+{
+    Task task;
+    if ( !take_task(own_queue_index(), task) )
+    {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::worker_loop(unsigned index)
+{
+    currentPool = this;
+    currentQueue = index;
+
+    while ( true )
+    {
+        Task task;
+        if ( take_task(index, task) )
+        {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake.wait(lock, [this]() { return stopping || queued.load(std::memory_order_acquire) > 0; });
+        if ( stopping )
+        {
+            return;
+        }
+    }
+}
+
+TaskGroup::~TaskGroup()
+{
+    try
+    {
+        wait();
+    }
+    catch ( ... )
+    {
+        // the exception was not collected by an explicit wait, there is nobody left to report it to
+    }
+}
+
+void TaskGroup::wait()
+{
+    while ( pending.load(std::memory_order_acquire) > 0 )
+    {
+        if ( !pool.run_pending_task() )
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if ( error )
+    {
+        std::exception_ptr rethrown = error;
+        error = nullptr;
+        std::rethrow_exception(rethrown);
+    }
+}
+
+} // namespace bvh
@@ -0,0 +1,144 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bvh {
+
+/**
+ * Work-stealing thread pool used by the parallel builders and queries. Every worker owns a task deque: it pushes and
+ * pops its own tasks at the back (depth first, cache friendly) and steals from the front of the other deques when it
+ * runs dry. Threads outside the pool submit into a shared deque. Threads waiting for a TaskGroup keep running
+ * queued tasks, so tasks may freely spawn and wait for further tasks.
+ */
+class ThreadPool
+{
+  public:
+    using Task = std::function<void()>;
+
+    /**
+     * @param 	worker_count	The number of worker threads. The thread waiting for the tasks helps as well, so a pool
+     *                          with n workers keeps n + 1 threads busy. 0 is valid and runs everything on the waiting
+     *                          thread.
+     */
+    explicit ThreadPool(unsigned worker_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned get_worker_count() const { return static_cast<unsigned>(workers.size()); }
+
+    /** The number of threads working on the tasks, including the waiting one. */
+    unsigned get_concurrency() const { return get_worker_count() + 1; }
+
+    void submit(Task task);
+
+    /** Runs one queued task on the calling thread, returns false if there was none. */
+    bool run_pending_task();
+
+    /** Total thread count for a requested number of threads, 0 meaning all hardware threads. */
+    static unsigned resolve_thread_count(unsigned threads)
+    {
+        return threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+  private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void worker_loop(unsigned index);
+    bool take_task(unsigned own_queue, Task& task);
+    unsigned own_queue_index() const;
+
+    // one queue per worker, the last one is shared by all threads outside the pool
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{ 0 };
+    bool stopping = false;
+};
+
+/**
+ * A set of tasks that can be waited for. Tasks of one group may run groups of their own. The first exception thrown
+ * by a task is rethrown from wait().
+ */
+class TaskGroup
+{
+  public:
+    explicit TaskGroup(ThreadPool& pool) : pool(pool) {}
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    template <typename Function>
+    void run(Function&& function)
+    {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        pool.submit([this, task = std::forward<Function>(function)]() mutable {
+            try
+            {
+                task();
+            }
+            catch ( ... )
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if ( !error )
+                {
+                    error = std::current_exception();
+                }
+            }
+            pending.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    /** Runs queued tasks on the calling thread until every task of the group has finished. */
+    void wait();
+
+  private:
+    ThreadPool& pool;
+    std::atomic<size_t> pending{ 0 };
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};
+
+/**
+ * Calls body(chunk_begin, chunk_end) for consecutive chunks of [begin, end) of at most grain elements, in parallel.
+ * The chunks only depend on the range and the grain, never on the thread count.
+ */
+template <typename Body>
+void parallel_for(ThreadPool& pool, size_t begin, size_t end, size_t grain, const Body& body)
+{
+    grain = std::max<size_t>(grain, 1);
+    TaskGroup group(pool);
+    for ( size_t chunk = begin; chunk < end; chunk += grain )
+    {
+        size_t chunkEnd = std::min(end, chunk + grain);
+        group.run([&body, chunk, chunkEnd]() { body(chunk, chunkEnd); });
+    }
+    group.wait();
+}
+
+} // namespace bvh
@@ -0,0 +1,611 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_bounds.hpp"
+#include "bvh_flat.hpp"
+#include "bvh_indexed.hpp"
+#include "triangle_tests.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bvh {
+
+/** The space in which the triangles of two colliding leaves are tested against each other. */
+enum class TriangleSpace
+{
+    /** triangle_triangle_intersection with both model matrices, every triangle is transformed once per tested pair. */
+    PerPair,
+    /** Both leaves are transformed to world space once per leaf pair and tested with triangles_intersect. */
+    World,
+    /** Only the second leaf is moved into the first model's local space, the first leaf needs no transform at all. */
+    FirstLocal
+};
+
+/** Which node of an overlapping pair of interior nodes the traversal descends into. */
+enum class DescentRule
+{
+    /** Both nodes are split, up to four child pairs are visited (the original test_collision order). */
+    Both,
+    /**
+     * Only the node with the larger surface area is split, so every pair adds at most two pairs to the stack and the
+     * stack never holds more than the sum of the tree depths.
+     */
+    Larger
+};
+
+/** Counters of one collision query, see QuerySettings::stats. */
+struct QueryStats
+{
+    /** Node pairs whose boxes were compared; for wide trees every child box counts. */
+    size_t box_tests = 0;
+    /** Node pairs whose boxes overlap, the pairs the traversal descends through. */
+    size_t node_pairs = 0;
+    /** Overlapping pairs of two leaves. */
+    size_t leaf_pairs = 0;
+    /** Triangle pairs tested for intersection. */
+    size_t triangle_tests = 0;
+    /** Intersecting triangle pairs found. */
+    size_t hits = 0;
+    /** The most node pairs the traversal stack ever held. */
+    size_t max_stack_depth = 0;
+
+    /** Adds up the counters of two parts of a query (the stack depth is the larger of both). */
+    void merge(const QueryStats& other)
+    {
+        box_tests += other.box_tests;
+        node_pairs += other.node_pairs;
+        leaf_pairs += other.leaf_pairs;
+        triangle_tests += other.triangle_tests;
+        hits += other.hits;
+        max_stack_depth = std::max(max_stack_depth, other.max_stack_depth);
+    }
+};
+
+/** The counters of all queries of a frame: their sum and the largest value of every counter in a single query. */
+struct FrameStats
+{
+    size_t queries = 0;
+    QueryStats total;
+    QueryStats peak;
+
+    void add(const QueryStats& query)
+    {
+        queries++;
+        total.merge(query);
+        peak.box_tests = std::max(peak.box_tests, query.box_tests);
+        peak.node_pairs = std::max(peak.node_pairs, query.node_pairs);
+        peak.leaf_pairs = std::max(peak.leaf_pairs, query.leaf_pairs);
+        peak.triangle_tests = std::max(peak.triangle_tests, query.triangle_tests);
+        peak.hits = std::max(peak.hits, query.hits);
+        peak.max_stack_depth = std::max(peak.max_stack_depth, query.max_stack_depth);
+    }
+
+    void clear() { *this = FrameStats(); }
+};
+
+/**
+ * Counter policies of the traversals. The traversals are templates over the policy, so with NoStats every counter
+ * call is an empty inline function and compiles away; the queries only instantiate CountStats when stats are asked
+ * for.
+ */
+struct NoStats
+{
+    void box_tests(size_t) {}
+    void node_pair() {}
+    void leaf_pair() {}
+    void triangle_tests(size_t) {}
+    void hit() {}
+    void stack_depth(size_t) {}
+};
+
+struct CountStats
+{
+    QueryStats* stats;
+
+    void box_tests(size_t count) { stats->box_tests += count; }
+    void node_pair() { stats->node_pairs++; }
+    void leaf_pair() { stats->leaf_pairs++; }
+    void triangle_tests(size_t count) { stats->triangle_tests += count; }
+    void hit() { stats->hits++; }
+    void stack_depth(size_t depth) { stats->max_stack_depth = std::max(stats->max_stack_depth, depth); }
+};
+
+/**
+ * Working memory of the leaf kernels, owned by one serial traversal (a query, or one task of a parallel query) and
+ * freed with it. Besides the vertices of the leaf pair being tested it caches the second leaves of the traversal
+ * packed into SoA batches, by a leaf key below key_count: a leaf is transformed and packed on its first visit and every
+ * later first leaf it meets reuses the batches. The cache holds each second leaf the traversal reaches once, so it
+ * stays below 420 bytes per 8 triangles of the second model plus a uint32_t per key, and only while the traversal is
+ * running.
+ */
+struct LeafScratch
+{
+    /** The key of a second leaf that is not cached but packed on every visit. */
+    static constexpr uint32_t kNoKey = UINT32_MAX;
+
+    /** @param 	key_count	Number of leaf keys of the second tree, 0 caches nothing. */
+    explicit LeafScratch(size_t key_count = 0) : key_count(key_count) {}
+
+    std::vector<glm::vec3> first;
+    std::vector<glm::vec3> second;
+    /** The second leaf of a test without a leaf key, repacked into SoA batches for the batched triangle test. */
+    std::vector<TriangleBatch> second_batches;
+
+    size_t key_count;
+    /** One past the first batch of every key's leaf in blocks, 0 if not packed yet; allocated on the first use. */
+    std::vector<uint32_t> leaf_blocks;
+    std::vector<TriangleBatch> blocks;
+};
+
+/**
+ * The vertices of a triangle given to the leaf kernels, which take framework Triangles and the triangles of indexed
+ * meshes alike, transformed by the matrix unless it is nullptr.
+ */
+inline void load_vertices(const Triangle& triangle, const glm::mat4* matrix, glm::vec3* out)
+{
+    if ( matrix != nullptr )
+    {
+        out[0] = glm::vec3(*matrix * triangle.v1);
+        out[1] = glm::vec3(*matrix * triangle.v2);
+        out[2] = glm::vec3(*matrix * triangle.v3);
+    }
+    else
+    {
+        out[0] = glm::vec3(triangle.v1);
+        out[1] = glm::vec3(triangle.v2);
+        out[2] = glm::vec3(triangle.v3);
+    }
+}
+
+inline void load_vertices(const TriangleVertices& triangle, const glm::mat4* matrix, glm::vec3* out)
+{
+    for ( int v = 0; v < 3; ++v )
+    {
+        out[v] = matrix != nullptr ? glm::vec3(*matrix * glm::vec4(triangle.v[v], 1.0f)) : triangle.v[v];
+    }
+}
+
+/** The test of a single triangle pair of TriangleSpace::PerPair, each triangle with its own model matrix. */
+inline bool intersect_pair(Triangle& first, const glm::mat4& first_matrix, Triangle& second,
+                           const glm::mat4& second_matrix)
+{
+    return triangle_triangle_intersection( first, first_matrix, second, second_matrix );
+}
+
+inline bool intersect_pair(const TriangleVertices& first, const glm::mat4& first_matrix,
+                           const TriangleVertices& second, const glm::mat4& second_matrix)
+{
+    glm::vec3 firstVertices[3];
+    glm::vec3 secondVertices[3];
+    load_vertices(first, &first_matrix, firstVertices);
+    load_vertices(second, &second_matrix, secondVertices);
+    return triangles_intersect(firstVertices, secondVertices);
+}
+
+/**
+ * The leaf kernels test all triangle pairs of two leaves. The leaves are given as a triangle count and a function
+ * returning the i-th Triangle (or TriangleVertices), on_hit(i, j) is called for every intersecting pair and returns
+ * whether the test should go on; test returns false if on_hit stopped it.
+ *
+ * The second leaf is also given by a key unique within its tree (the index of its node, for example) and the traversal
+ * passes its LeafScratch to every test. The batched kernel packs a keyed leaf into the SoA blocks of the scratch once
+ * and reuses them for every first leaf it meets, so the matrices and the trees must not change while a scratch is
+ * used. LeafScratch::kNoKey packs the leaf on every visit.
+ *
+ * PairKernel is the scalar kernel of TriangleSpace::PerPair, testing one pair at a time with the model matrices of
+ * both triangles.
+ */
+class PairKernel
+{
+  public:
+    PairKernel(const glm::mat4& first_matrix, const glm::mat4& second_matrix)
+        : first_matrix(first_matrix), second_matrix(second_matrix)
+    {
+    }
+
+    template <typename FirstAt, typename SecondAt, typename OnHit, typename Stats = NoStats>
+    bool test(uint32_t first_count, FirstAt first_at, uint32_t second_count, SecondAt second_at, uint32_t,
+              LeafScratch&, OnHit on_hit, Stats stats = Stats()) const
+    {
+        for ( uint32_t i = 0; i < first_count; ++i )
+        {
+            for ( uint32_t j = 0; j < second_count; ++j )
+            {
+                stats.triangle_tests(1);
+                if ( intersect_pair(first_at(i), first_matrix, second_at(j), second_matrix) )
+                {
+                    stats.hit();
+                    if ( !on_hit(i, j) )
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+  private:
+    glm::mat4 first_matrix;
+    glm::mat4 second_matrix;
+};
+
+/**
+ * The batched kernel of TriangleSpace::World and FirstLocal: both leaves are transformed once for the leaf pair and
+ * every triangle of the first one is tested against the second leaf a whole SoA batch at a time. The two spaces only
+ * differ in the matrices, World moves both leaves to world space, FirstLocal moves the second leaf into the space of
+ * the first one and leaves the first as it is.
+ */
+class BatchKernel
+{
+  public:
+    BatchKernel(const glm::mat4& first_matrix, const glm::mat4& second_matrix, TriangleSpace space)
+        : transform_first(space != TriangleSpace::FirstLocal), first_transform(first_matrix),
+          second_transform(space == TriangleSpace::FirstLocal ? glm::inverse(first_matrix) * second_matrix
+                                                              : second_matrix)
+    {
+    }
+
+    template <typename FirstAt, typename SecondAt, typename OnHit, typename Stats = NoStats>
+    bool test(uint32_t first_count, FirstAt first_at, uint32_t second_count, SecondAt second_at,
+              uint32_t second_leaf, LeafScratch& scratch, OnHit on_hit, Stats stats = Stats()) const
+    {
+        // every triangle of the first leaf is transformed once for the leaf pair, the second leaf once per traversal
+        load(first_count, first_at, transform_first ? &first_transform : nullptr, scratch.first);
+
+        uint32_t batchCount = (second_count + kTriangleBatchWidth - 1) / kTriangleBatchWidth;
+        const TriangleBatch* batches;
+        if ( second_leaf >= scratch.key_count )
+        {
+            scratch.second_batches.resize(batchCount);
+            pack(second_count, second_at, scratch, scratch.second_batches.data());
+            batches = scratch.second_batches.data();
+        }
+        else
+        {
+            if ( scratch.leaf_blocks.empty() )
+            {
+                scratch.leaf_blocks.assign(scratch.key_count, 0);
+            }
+            uint32_t& end = scratch.leaf_blocks[second_leaf];
+            if ( end == 0 )
+            {
+                scratch.blocks.resize(scratch.blocks.size() + batchCount);
+                end = static_cast<uint32_t>(scratch.blocks.size());
+                pack(second_count, second_at, scratch, &scratch.blocks[end - batchCount]);
+            }
+            batches = &scratch.blocks[end - batchCount];
+        }
+
+        // each triangle of the first leaf is tested against the second leaf a whole batch at a time
+        for ( uint32_t i = 0; i < first_count; ++i )
+        {
+            for ( uint32_t b = 0; b < batchCount; ++b )
+            {
+                stats.triangle_tests(static_cast<size_t>(batches[b].count));
+                uint32_t hits = triangles_intersect(&scratch.first[3 * i], batches[b]);
+                for ( int lane = 0; hits != 0; ++lane, hits >>= 1 )
+                {
+                    if ( hits & 1u )
+                    {
+                        stats.hit();
+                        if ( !on_hit(i, b * kTriangleBatchWidth + lane) )
+                        {
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+  private:
+    template <typename TriangleAt>
+    static void load(uint32_t count, TriangleAt triangle_at, const glm::mat4* matrix, std::vector<glm::vec3>& out)
+    {
+        out.resize(3 * count);
+        for ( uint32_t i = 0; i < count; ++i )
+        {
+            load_vertices(triangle_at(i), matrix, &out[3 * i]);
+        }
+    }
+
+    /** Transforms the second leaf into the space of the test and packs it into batches, which must have room. */
+    template <typename SecondAt>
+    void pack(uint32_t second_count, SecondAt second_at, LeafScratch& scratch, TriangleBatch* batches) const
+    {
+        load(second_count, second_at, &second_transform, scratch.second);
+        for ( uint32_t b = 0; b * kTriangleBatchWidth < second_count; ++b )
+        {
+            uint32_t first = b * kTriangleBatchWidth;
+            int count = static_cast<int>(std::min<uint32_t>(kTriangleBatchWidth, second_count - first));
+            load_batch(batches[b], &scratch.second[3 * first], count);
+        }
+    }
+
+    bool transform_first;
+    glm::mat4 first_transform;
+    glm::mat4 second_transform;
+};
+
+/**
+ * Runs query(kernel) with the leaf kernel of the triangle space. The queries take the kernel as a template parameter,
+ * so the choice is made once per query and no branch on the space is left in the leaf tests.
+ */
+template <typename Query>
+auto with_leaf_kernel(const glm::mat4& first_matrix, const glm::mat4& second_matrix, TriangleSpace space, Query query)
+{
+    if ( space == TriangleSpace::PerPair )
+    {
+        return query(PairKernel(first_matrix, second_matrix));
+    }
+    return query(BatchKernel(first_matrix, second_matrix, space));
+}
+
+/**
+ * The kernels above with the space chosen at run time, once per leaf pair. Only the collision front uses this one,
+ * it tests its node pairs one at a time anyway; the collide queries take the kernel from with_leaf_kernel.
+ */
+class LeafTester
+{
+  public:
+    LeafTester(const glm::mat4& first_matrix, const glm::mat4& second_matrix, TriangleSpace space)
+        : batched(space != TriangleSpace::PerPair), pair(first_matrix, second_matrix),
+          batch(first_matrix, second_matrix, batched ? space : TriangleSpace::World)
+    {
+    }
+
+    template <typename FirstAt, typename SecondAt, typename OnHit, typename Stats = NoStats>
+    bool test(uint32_t first_count, FirstAt first_at, uint32_t second_count, SecondAt second_at,
+              uint32_t second_leaf, LeafScratch& scratch, OnHit on_hit, Stats stats = Stats()) const
+    {
+        if ( batched )
+        {
+            return batch.test(first_count, first_at, second_count, second_at, second_leaf, scratch, on_hit, stats);
+        }
+        return pair.test(first_count, first_at, second_count, second_at, second_leaf, scratch, on_hit, stats);
+    }
+
+  private:
+    bool batched;
+    PairKernel pair;
+    BatchKernel batch;
+};
+
+/**
+ * Explicit stack of node pairs for the iterative traversal. The fixed part lives on the call stack and covers trees
+ * deeper than anything construct produces in practice; if it still fills up, further pairs spill into a heap vector
+ * instead of failing.
+ */
+template <typename Pair, size_t Capacity = 256>
+class TraversalStack
+{
+  public:
+    bool empty() const { return size == 0; }
+    size_t depth() const { return size; }
+
+    void push(const Pair& pair)
+    {
+        if ( size < Capacity )
+        {
+            fixed[size] = pair;
+        }
+        else
+        {
+            overflow.push_back(pair);
+        }
+        size++;
+    }
+
+    Pair pop()
+    {
+        size--;
+        if ( size < Capacity )
+        {
+            return fixed[size];
+        }
+        Pair pair = overflow.back();
+        overflow.pop_back();
+        return pair;
+    }
+
+  private:
+    std::array<Pair, Capacity> fixed;
+    std::vector<Pair> overflow;
+    size_t size = 0;
+};
+
+/** Traversal adapter for the framework's BVHNode trees. */
+struct NodeTree
+{
+    using Handle = BVHNode*;
+
+    BVHNode& root_node;
+
+    Handle root() const { return &root_node; }
+    static bool is_leaf(Handle node) { return &node->get_left() == nullptr; }
+    static Handle left(Handle node) { return &node->get_left(); }
+    static Handle right(Handle node) { return &node->get_right(); }
+    static Aabb bounds(Handle node) { return node_bounds(*node); }
+};
+
+/** Traversal adapter for flat trees (FlatBVH, FlatBVHView or IndexedBVH), nodes are identified by their index. */
+template <typename Bvh>
+struct BasicFlatTree
+{
+    using Handle = uint32_t;
+
+    const Bvh& bvh;
+
+    Handle root() const { return 0; }
+    bool is_leaf(Handle node) const { return bvh.nodes[node].is_leaf(); }
+    static Handle left(Handle node) { return FlatBVH::left(node); }
+    Handle right(Handle node) const { return bvh.right(node); }
+    Aabb bounds(Handle node) const { return Aabb(bvh.nodes[node].min, bvh.nodes[node].max); }
+};
+
+using FlatTree = BasicFlatTree<FlatBVH>;
+using FlatViewTree = BasicFlatTree<FlatBVHView>;
+using IndexedTree = BasicFlatTree<IndexedBVH>;
+
+/** Calls visit for every triangle of a leaf until it returns false. */
+template <typename Visit>
+void for_each_leaf_triangle(const NodeTree&, BVHNode* node, Visit visit)
+{
+    for ( Triangle* triangle : node->get_triangles() )
+    {
+        if ( !visit(*triangle) )
+        {
+            return;
+        }
+    }
+}
+
+template <typename Visit>
+void for_each_leaf_triangle(const FlatViewTree& tree, uint32_t node, Visit visit)
+{
+    const FlatNode& leaf = tree.bvh.nodes[node];
+    for ( uint32_t i = 0; i < leaf.count; ++i )
+    {
+        if ( !visit(tree.bvh.leaf_triangle(leaf, i)) )
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * Calls emit(first, second) for the child pairs of an overlapping pair of nodes that are not both leaves, in visiting
+ * order. Both the traversal and the task split of the parallel queries descend through this.
+ */
+template <typename FirstTree, typename SecondTree, typename Emit>
+void for_each_child_pair(const FirstTree& first, const SecondTree& second, typename FirstTree::Handle first_node,
+                         typename SecondTree::Handle second_node, const Aabb& first_bounds, const Aabb& second_bounds,
+                         DescentRule rule, Emit emit)
+{
+    bool firstLeaf = first.is_leaf(first_node);
+    bool secondLeaf = second.is_leaf(second_node);
+
+    bool splitFirst;
+    if ( firstLeaf || secondLeaf )
+    {
+        splitFirst = secondLeaf;
+    }
+    else if ( rule == DescentRule::Larger )
+    {
+        splitFirst = first_bounds.surface_area() >= second_bounds.surface_area();
+    }
+    else
+    {
+        emit(first.left(first_node), second.left(second_node));
+        emit(first.left(first_node), second.right(second_node));
+        emit(first.right(first_node), second.left(second_node));
+        emit(first.right(first_node), second.right(second_node));
+        return;
+    }
+
+    if ( splitFirst )
+    {
+        emit(first.left(first_node), second_node);
+        emit(first.right(first_node), second_node);
+    }
+    else
+    {
+        emit(first_node, second.left(second_node));
+        emit(first_node, second.right(second_node));
+    }
+}
+
+/**
+ * Iterative dual tree traversal over the node pairs whose boxes overlap, starting at the given pair of nodes. For every
+ * such pair visit(first, second) is called first, then leaves(first, second) if both nodes are leaves; either returns
+ * false to end the traversal. Children are visited left before right, so DescentRule::Both reproduces the order of
+ * the recursive test. The counter policy counts the box tests, node pairs, leaf pairs and the stack depth.
+ *
+ * The box test (a BoxOverlap, or BoxOverlapTest to choose the mode at run time), the tree adapter, the two callbacks
+ * and the counter policy are all template parameters, so each combination compiles to a loop of its own.
+ */
+template <typename FirstTree, typename SecondTree, typename Overlap, typename Visit, typename Leaves,
+          typename Stats = NoStats>
+void traverse(const FirstTree& first, const SecondTree& second, typename FirstTree::Handle first_start,
+              typename SecondTree::Handle second_start, const Overlap& overlap, DescentRule rule, Visit visit,
+              Leaves leaves, Stats stats = Stats())
+{
+    using FirstHandle = typename FirstTree::Handle;
+    using SecondHandle = typename SecondTree::Handle;
+
+    struct Pair
+    {
+        FirstHandle first;
+        SecondHandle second;
+    };
+
+    TraversalStack<Pair> stack;
+    stack.push(Pair{ first_start, second_start });
+    stats.stack_depth(1);
+
+    while ( !stack.empty() )
+    {
+        Pair pair = stack.pop();
+
+        Aabb firstBounds = first.bounds(pair.first);
+        Aabb secondBounds = second.bounds(pair.second);
+        stats.box_tests(1);
+        if ( !overlap(firstBounds, secondBounds) )
+        {
+            continue;
+        }
+
+        stats.node_pair();
+        if ( !visit(pair.first, pair.second) )
+        {
+            return;
+        }
+
+        if ( first.is_leaf(pair.first) && second.is_leaf(pair.second) )
+        {
+            stats.leaf_pair();
+            if ( !leaves(pair.first, pair.second) )
+            {
+                return;
+            }
+            continue;
+        }
+
+        // pushed in reverse so that they are popped in visiting order
+        std::array<Pair, 4> children;
+        size_t childCount = 0;
+        for_each_child_pair(first, second, pair.first, pair.second, firstBounds, secondBounds, rule,
+                            [&](FirstHandle firstChild, SecondHandle secondChild) {
+                                children[childCount++] = Pair{ firstChild, secondChild };
+                            });
+        while ( childCount > 0 )
+        {
+            stack.push(children[--childCount]);
+        }
+        stats.stack_depth(stack.depth());
+    }
+}
+
+/** The traversal above starting at the two roots. */
+template <typename FirstTree, typename SecondTree, typename Overlap, typename Visit, typename Leaves,
+          typename Stats = NoStats>
+void traverse(const FirstTree& first, const SecondTree& second, const Overlap& overlap, DescentRule rule, Visit visit,
+              Leaves leaves, Stats stats = Stats())
+{
+    traverse(first, second, first.root(), second.root(), overlap, rule, visit, leaves, stats);
+}
+
+} // namespace bvh
@@ -0,0 +1,114 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "bvh_wide.hpp"
+
+namespace bvh {
+namespace {
+
+template <int Width>
+class Collapser
+{
+  public:
+    Collapser(const FlatBVH& flat, WideBVH<Width>& wide) : flat(flat), wide(wide) {}
+
+    /** Emits the wide node holding the (collapsed) children of the given interior binary node. */
+    uint32_t emit(uint32_t binary_node)
+    {
+        uint32_t index = static_cast<uint32_t>(wide.nodes.size());
+        wide.nodes.emplace_back();
+
+        // open the largest interior child until the slots are full, keeping the children in tree order
+        std::vector<uint32_t> children{ FlatBVH::left(binary_node), flat.right(binary_node) };
+        while ( children.size() < static_cast<size_t>(Width) )
+        {
+            int largest = -1;
+            float largestArea = -1.0f;
+            for ( size_t i = 0; i < children.size(); ++i )
+            {
+                const FlatNode& node = flat.nodes[children[i]];
+                float area = Aabb(node.min, node.max).surface_area();
+                if ( !node.is_leaf() && area > largestArea )
+                {
+                    largest = static_cast<int>(i);
+                    largestArea = area;
+                }
+            }
+            if ( largest < 0 )
+            {
+                break;
+            }
+
+            uint32_t opened = children[largest];
+            children[largest] = FlatBVH::left(opened);
+            children.insert(children.begin() + largest + 1, flat.right(opened));
+        }
+
+        for ( size_t slot = 0; slot < children.size(); ++slot )
+        {
+            fill(index, static_cast<int>(slot), children[slot]);
+        }
+        return index;
+    }
+
+    /** Fills a slot of the wide node with the given binary node, emitting the node's subtree if it is interior. */
+    void fill(uint32_t index, int slot, uint32_t binary_node)
+    {
+        const FlatNode& node = flat.nodes[binary_node];
+        wide.nodes[index].set_bounds(slot, Aabb(node.min, node.max));
+
+        if ( node.is_leaf() )
+        {
+            wide.nodes[index].child[slot] = node.offset;
+            wide.nodes[index].count[slot] = node.count;
+        }
+        else
+        {
+            // emit may reallocate the node array, so the slot is written only afterwards
+            uint32_t child = emit(binary_node);
+            wide.nodes[index].child[slot] = child;
+            wide.nodes[index].count[slot] = 0;
+        }
+    }
+
+  private:
+    const FlatBVH& flat;
+    WideBVH<Width>& wide;
+};
+
+} // namespace
+
+template <int Width>
+WideBVH<Width> collapse(const FlatBVH& bvh)
+{
+    WideBVH<Width> wide;
+    if ( bvh.empty() )
+    {
+        return wide;
+    }
+
+    wide.triangle_indices = bvh.triangle_indices;
+    wide.triangles = bvh.triangles;
+    wide.bounds = Aabb(bvh.nodes[0].min, bvh.nodes[0].max);
+
+    Collapser<Width> collapser(bvh, wide);
+    if ( bvh.nodes[0].is_leaf() )
+    {
+        wide.nodes.emplace_back();
+        collapser.fill(0, 0, 0);
+    }
+    else
+    {
+        collapser.emit(0);
+    }
+    return wide;
+}
+
+template WideBVH<4> collapse<4>(const FlatBVH& bvh);
+template WideBVH<8> collapse<8>(const FlatBVH& bvh);
+
+} // namespace bvh
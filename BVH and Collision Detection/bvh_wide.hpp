@@ -0,0 +1,189 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+#include "bvh_bounds.hpp"
+#include "bvh_flat.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace bvh {
+
+/**
+ * Node of a wide BVH with up to Width children. The child boxes are stored as structure of arrays, so one box can be
+ * tested against all children at once with a few SIMD comparisons. Leaves are not nodes of their own: a child slot
+ * either refers to another wide node or directly to the triangles of a leaf. Unused slots hold an inverted box that
+ * overlaps nothing.
+ */
+template <int Width>
+struct alignas(32) WideNode
+{
+    static_assert(Width == 4 || Width == 8, "wide nodes have 4 or 8 children");
+
+    float min_x[Width];
+    float min_y[Width];
+    float min_z[Width];
+    float max_x[Width];
+    float max_y[Width];
+    float max_z[Width];
+    /** Interior child: index of its wide node. Leaf child: index of its first entry in WideBVH::triangle_indices. */
+    uint32_t child[Width];
+    /** Number of triangles of a leaf child, 0 for interior children and unused slots. */
+    uint32_t count[Width];
+
+    WideNode()
+    {
+        for ( int i = 0; i < Width; ++i )
+        {
+            min_x[i] = min_y[i] = min_z[i] = std::numeric_limits<float>::max();
+            max_x[i] = max_y[i] = max_z[i] = -std::numeric_limits<float>::max();
+            child[i] = 0;
+            count[i] = 0;
+        }
+    }
+
+    Aabb bounds(int slot) const
+    {
+        return Aabb(glm::vec3(min_x[slot], min_y[slot], min_z[slot]), glm::vec3(max_x[slot], max_y[slot], max_z[slot]));
+    }
+
+    void set_bounds(int slot, const Aabb& box)
+    {
+        min_x[slot] = box.min.x;
+        min_y[slot] = box.min.y;
+        min_z[slot] = box.min.z;
+        max_x[slot] = box.max.x;
+        max_y[slot] = box.max.y;
+        max_z[slot] = box.max.z;
+    }
+
+    bool is_leaf(int slot) const { return count[slot] > 0; }
+};
+
+/**
+ * BVH with Width-ary nodes collapsed from a binary tree. The triangle arrays have the same meaning as in FlatBVH, the
+ * root is the first node and its children are the children of the binary root (or the root itself if it is a leaf).
+ */
+template <int Width>
+struct WideBVH
+{
+    std::vector<WideNode<Width>> nodes;
+    /** Indices into triangles, in leaf order. */
+    std::vector<uint32_t> triangle_indices;
+    /** The triangles of the model in their original order (not owned). */
+    std::vector<Triangle*> triangles;
+    /** The box of the whole model. */
+    Aabb bounds;
+
+    bool empty() const { return nodes.empty(); }
+
+    /** The i-th triangle of the leaf in the given slot. */
+    Triangle& leaf_triangle(const WideNode<Width>& node, int slot, uint32_t i) const
+    {
+        return *triangles[triangle_indices[node.child[slot] + i]];
+    }
+};
+
+using WideBVH4 = WideBVH<4>;
+using WideBVH8 = WideBVH<8>;
+
+/**
+ * Collapses a binary flat tree into a wide one. Every wide node takes the children of a binary node and keeps opening
+ * the interior child with the largest surface area until all slots are used or only leaves are left, which removes
+ * the upper levels of the binary tree that add the least culling.
+ *
+ * @param 	bvh	The binary tree, for example from construct_flat.
+ * @return	The wide copy of the tree, sharing the triangle order of the binary one.
+ */
+template <int Width>
+WideBVH<Width> collapse(const FlatBVH& bvh);
+
+extern template WideBVH<4> collapse<4>(const FlatBVH& bvh);
+extern template WideBVH<8> collapse<8>(const FlatBVH& bvh);
+
+/**
+ * Returns a bit mask with bit i set if the box overlaps child i of the node (touching boxes overlap). Uses SSE for the
+ * 4-wide and AVX (or two SSE halves) for the 8-wide nodes, NEON on AArch64 and a scalar loop everywhere else.
+ */
+template <int Width>
+inline uint32_t overlap_mask(const WideNode<Width>& node, const Aabb& box)
+{
+#if defined(__AVX__)
+    if constexpr ( Width == 8 )
+    {
+        __m256 x = _mm256_and_ps(_mm256_cmp_ps(_mm256_load_ps(node.min_x), _mm256_set1_ps(box.max.x), _CMP_LE_OQ),
+                                 _mm256_cmp_ps(_mm256_set1_ps(box.min.x), _mm256_load_ps(node.max_x), _CMP_LE_OQ));
+        __m256 y = _mm256_and_ps(_mm256_cmp_ps(_mm256_load_ps(node.min_y), _mm256_set1_ps(box.max.y), _CMP_LE_OQ),
+                                 _mm256_cmp_ps(_mm256_set1_ps(box.min.y), _mm256_load_ps(node.max_y), _CMP_LE_OQ));
+        __m256 z = _mm256_and_ps(_mm256_cmp_ps(_mm256_load_ps(node.min_z), _mm256_set1_ps(box.max.z), _CMP_LE_OQ),
+                                 _mm256_cmp_ps(_mm256_set1_ps(box.min.z), _mm256_load_ps(node.max_z), _CMP_LE_OQ));
+        __m256 overlap = _mm256_and_ps(x, _mm256_and_ps(y, z));
+        return static_cast<uint32_t>(_mm256_movemask_ps(overlap));
+    }
+#endif
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    __m128 boxMinX = _mm_set1_ps(box.min.x), boxMinY = _mm_set1_ps(box.min.y), boxMinZ = _mm_set1_ps(box.min.z);
+    __m128 boxMaxX = _mm_set1_ps(box.max.x), boxMaxY = _mm_set1_ps(box.max.y), boxMaxZ = _mm_set1_ps(box.max.z);
+
+    uint32_t mask = 0;
+    for ( int i = 0; i < Width; i += 4 )
+    {
+        __m128 x = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.min_x + i), boxMaxX),
+                              _mm_cmple_ps(boxMinX, _mm_load_ps(node.max_x + i)));
+        __m128 y = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.min_y + i), boxMaxY),
+                              _mm_cmple_ps(boxMinY, _mm_load_ps(node.max_y + i)));
+        __m128 z = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.min_z + i), boxMaxZ),
+                              _mm_cmple_ps(boxMinZ, _mm_load_ps(node.max_z + i)));
+        __m128 overlap = _mm_and_ps(x, _mm_and_ps(y, z));
+        mask |= static_cast<uint32_t>(_mm_movemask_ps(overlap)) << i;
+    }
+    return mask;
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    float32x4_t boxMinX = vdupq_n_f32(box.min.x), boxMinY = vdupq_n_f32(box.min.y), boxMinZ = vdupq_n_f32(box.min.z);
+    float32x4_t boxMaxX = vdupq_n_f32(box.max.x), boxMaxY = vdupq_n_f32(box.max.y), boxMaxZ = vdupq_n_f32(box.max.z);
+    const uint32_t bitValues[4] = { 1, 2, 4, 8 };
+    uint32x4_t bits = vld1q_u32(bitValues);
+
+    uint32_t mask = 0;
+    for ( int i = 0; i < Width; i += 4 )
+    {
+        uint32x4_t x =
+            vandq_u32(vcleq_f32(vld1q_f32(node.min_x + i), boxMaxX), vcleq_f32(boxMinX, vld1q_f32(node.max_x + i)));
+        uint32x4_t y =
+            vandq_u32(vcleq_f32(vld1q_f32(node.min_y + i), boxMaxY), vcleq_f32(boxMinY, vld1q_f32(node.max_y + i)));
+        uint32x4_t z =
+            vandq_u32(vcleq_f32(vld1q_f32(node.min_z + i), boxMaxZ), vcleq_f32(boxMinZ, vld1q_f32(node.max_z + i)));
+        uint32x4_t overlap = vandq_u32(x, vandq_u32(y, z));
+        mask |= vaddvq_u32(vandq_u32(overlap, bits)) << i;
+    }
+    return mask;
+#else
+    uint32_t mask = 0;
+    for ( int i = 0; i < Width; ++i )
+    {
+        bool overlap = node.min_x[i] <= box.max.x && box.min.x <= node.max_x[i] && node.min_y[i] <= box.max.y &&
+                       box.min.y <= node.max_y[i] && node.min_z[i] <= box.max.z && box.min.z <= node.max_z[i];
+        mask |= static_cast<uint32_t>(overlap) << i;
+    }
+    return mask;
+#endif
+}
+
+} // namespace bvh
@@ -0,0 +1,553 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#include "triangle_tests.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace bvh {
+namespace {
+
+// signed distances this close to the plane are treated as lying on it
+constexpr float kPlaneEpsilon = 1e-6f;
+
+/** Orientation of the 2D point c relative to the line a-b (positive when counter-clockwise). */
+float orient_2d(const float* a, const float* b, const float* c)
+{
+    return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+bool on_segment_2d(const float* a, const float* b, const float* p)
+{
+    return std::min(a[0], b[0]) <= p[0] && p[0] <= std::max(a[0], b[0]) &&
+           std::min(a[1], b[1]) <= p[1] && p[1] <= std::max(a[1], b[1]);
+}
+
+bool segments_intersect_2d(const float* a, const float* b, const float* c, const float* d)
+{
+    float d1 = orient_2d(c, d, a);
+    float d2 = orient_2d(c, d, b);
+    float d3 = orient_2d(a, b, c);
+    float d4 = orient_2d(a, b, d);
+
+    if ( ((d1 > 0.0f && d2 < 0.0f) || (d1 < 0.0f && d2 > 0.0f)) &&
+         ((d3 > 0.0f && d4 < 0.0f) || (d3 < 0.0f && d4 > 0.0f)) )
+    {
+        return true;
+    }
+
+    // collinear cases
+    return (d1 == 0.0f && on_segment_2d(c, d, a)) || (d2 == 0.0f && on_segment_2d(c, d, b)) ||
+           (d3 == 0.0f && on_segment_2d(a, b, c)) || (d4 == 0.0f && on_segment_2d(a, b, d));
+}
+
+bool point_in_triangle_2d(const float* p, const float (&triangle)[3][2])
+{
+    float d1 = orient_2d(triangle[0], triangle[1], p);
+    float d2 = orient_2d(triangle[1], triangle[2], p);
+    float d3 = orient_2d(triangle[2], triangle[0], p);
+
+    bool hasNegative = d1 < 0.0f || d2 < 0.0f || d3 < 0.0f;
+    bool hasPositive = d1 > 0.0f || d2 > 0.0f || d3 > 0.0f;
+    return !(hasNegative && hasPositive);
+}
+
+/** Both triangles lie in the plane with the given normal, test them in 2D after dropping its dominant axis. */
+bool coplanar_intersect(const glm::vec3& normal, const glm::vec3* first, const glm::vec3* second)
+{
+    glm::vec3 a = glm::abs(normal);
+    int i0, i1;
+    if ( a.x >= a.y && a.x >= a.z )
+    {
+        i0 = 1;
+        i1 = 2;
+    }
+    else if ( a.y >= a.z )
+    {
+        i0 = 0;
+        i1 = 2;
+    }
+    else
+    {
+        i0 = 0;
+        i1 = 1;
+    }
+
+    float p[3][2], q[3][2];
+    for ( int i = 0; i < 3; ++i )
+    {
+        p[i][0] = first[i][i0];
+        p[i][1] = first[i][i1];
+        q[i][0] = second[i][i0];
+        q[i][1] = second[i][i1];
+    }
+
+    for ( int i = 0; i < 3; ++i )
+    {
+        for ( int j = 0; j < 3; ++j )
+        {
+            if ( segments_intersect_2d(p[i], p[(i + 1) % 3], q[j], q[(j + 1) % 3]) )
+            {
+                return true;
+            }
+        }
+    }
+
+    // no edges cross, so either one triangle contains the other or they are disjoint
+    return point_in_triangle_2d(p[0], q) || point_in_triangle_2d(q[0], p);
+}
+
+/**
+ * Computes the interval in which the line of intersection of the two planes crosses the triangle. The projections
+ * on the line are in p, the signed distances to the other triangle's plane in d. Returns false if the triangle lies
+ * in the plane.
+ */
+bool plane_interval(const float (&p)[3], const float (&d)[3], float& t0, float& t1)
+{
+    // vertex k is the one alone on its side of the plane
+    auto interval = [&](int k, int a, int b) {
+        t0 = p[k] + (p[a] - p[k]) * d[k] / (d[k] - d[a]);
+        t1 = p[k] + (p[b] - p[k]) * d[k] / (d[k] - d[b]);
+        if ( t0 > t1 )
+        {
+            std::swap(t0, t1);
+        }
+    };
+
+    if ( d[0] * d[1] > 0.0f )
+    {
+        interval(2, 0, 1);
+    }
+    else if ( d[0] * d[2] > 0.0f )
+    {
+        interval(1, 0, 2);
+    }
+    else if ( d[1] * d[2] > 0.0f || d[0] != 0.0f )
+    {
+        interval(0, 1, 2);
+    }
+    else if ( d[1] != 0.0f )
+    {
+        interval(1, 0, 2);
+    }
+    else if ( d[2] != 0.0f )
+    {
+        interval(2, 0, 1);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/** Whether the three signed distances to a plane put the triangle strictly on one side of it. */
+bool one_side(float d0, float d1, float d2)
+{
+    return d0 * d1 > 0.0f && d0 * d2 > 0.0f;
+}
+
+float snap_to_plane(float distance)
+{
+    return std::abs(distance) < kPlaneEpsilon ? 0.0f : distance;
+}
+
+/** The point of the triangle closest to p (Ericson, "Real-Time Collision Detection", 5.1.5). */
+glm::vec3 closest_point_on_triangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    glm::vec3 ab = b - a;
+    glm::vec3 ac = c - a;
+    glm::vec3 ap = p - a;
+    float d1 = glm::dot(ab, ap);
+    float d2 = glm::dot(ac, ap);
+    if ( d1 <= 0.0f && d2 <= 0.0f )
+    {
+        return a;
+    }
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp);
+    float d4 = glm::dot(ac, bp);
+    if ( d3 >= 0.0f && d4 <= d3 )
+    {
+        return b;
+    }
+
+    float vc = d1 * d4 - d3 * d2;
+    if ( vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f )
+    {
+        return a + ab * (d1 / (d1 - d3));
+    }
+
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp);
+    float d6 = glm::dot(ac, cp);
+    if ( d6 >= 0.0f && d5 <= d6 )
+    {
+        return c;
+    }
+
+    float vb = d5 * d2 - d1 * d6;
+    if ( vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f )
+    {
+        return a + ac * (d2 / (d2 - d6));
+    }
+
+    float va = d3 * d6 - d5 * d4;
+    if ( va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f )
+    {
+        return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    }
+
+    // inside the face; a degenerate triangle has no inside, its edges are tested by the callers anyway
+    float area = va + vb + vc;
+    if ( area <= 0.0f )
+    {
+        return a;
+    }
+    return a + ab * (vb / area) + ac * (vc / area);
+}
+
+/** Closest points of the segments p1-q1 and p2-q2 (Ericson 5.1.9). */
+void closest_points_of_segments(const glm::vec3& p1, const glm::vec3& q1, const glm::vec3& p2, const glm::vec3& q2,
+                                glm::vec3& c1, glm::vec3& c2)
+{
+    constexpr float kEpsilon = 1e-12f;
+
+    glm::vec3 d1 = q1 - p1;
+    glm::vec3 d2 = q2 - p2;
+    glm::vec3 r = p1 - p2;
+    float a = glm::dot(d1, d1);
+    float e = glm::dot(d2, d2);
+    float f = glm::dot(d2, r);
+
+    float s = 0.0f;
+    float t = 0.0f;
+    if ( a <= kEpsilon && e <= kEpsilon )
+    {
+        c1 = p1;
+        c2 = p2;
+        return;
+    }
+    if ( a <= kEpsilon )
+    {
+        t = std::min(std::max(f / e, 0.0f), 1.0f);
+    }
+    else
+    {
+        float c = glm::dot(d1, r);
+        if ( e <= kEpsilon )
+        {
+            s = std::min(std::max(-c / a, 0.0f), 1.0f);
+        }
+        else
+        {
+            float b = glm::dot(d1, d2);
+            float denominator = a * e - b * b;
+            s = denominator != 0.0f ? std::min(std::max((b * f - c * e) / denominator, 0.0f), 1.0f) : 0.0f;
+            t = (b * s + f) / e;
+            if ( t < 0.0f )
+            {
+                t = 0.0f;
+                s = std::min(std::max(-c / a, 0.0f), 1.0f);
+            }
+            else if ( t > 1.0f )
+            {
+                t = 1.0f;
+                s = std::min(std::max((b - c) / a, 0.0f), 1.0f);
+            }
+        }
+    }
+
+    c1 = p1 + d1 * s;
+    c2 = p2 + d2 * t;
+}
+
+/** Whether the segment p-q crosses the triangle, and where. Parallel ones are left to the edge and vertex distances. */
+bool segment_crosses_triangle(const glm::vec3& p, const glm::vec3& q, const glm::vec3* triangle, glm::vec3& point)
+{
+    float t, u, v;
+    if ( !ray_triangle_intersection(p, q - p, triangle, 0.0f, 1.0f, t, u, v) )
+    {
+        return false;
+    }
+    point = p + (q - p) * t;
+    return true;
+}
+
+} // namespace
+
+bool triangles_intersect(const glm::vec3* first, const glm::vec3* second)
+{
+    // plane of the first triangle and the distances of the second triangle's vertices to it
+    glm::vec3 firstNormal = glm::cross(first[1] - first[0], first[2] - first[0]);
+    float firstOffset = -glm::dot(firstNormal, first[0]);
+
+    float du[3];
+    for ( int i = 0; i < 3; ++i )
+    {
+        du[i] = glm::dot(firstNormal, second[i]) + firstOffset;
+        if ( std::abs(du[i]) < kPlaneEpsilon )
+        {
+            du[i] = 0.0f;
+        }
+    }
+    if ( du[0] * du[1] > 0.0f && du[0] * du[2] > 0.0f )
+    {
+        return false;
+    }
+
+    // and the other way around
+    glm::vec3 secondNormal = glm::cross(second[1] - second[0], second[2] - second[0]);
+    float secondOffset = -glm::dot(secondNormal, second[0]);
+
+    float dv[3];
+    for ( int i = 0; i < 3; ++i )
+    {
+        dv[i] = glm::dot(secondNormal, first[i]) + secondOffset;
+        if ( std::abs(dv[i]) < kPlaneEpsilon )
+        {
+            dv[i] = 0.0f;
+        }
+    }
+    if ( dv[0] * dv[1] > 0.0f && dv[0] * dv[2] > 0.0f )
+    {
+        return false;
+    }
+
+    // project both triangles onto the dominant axis of the line where the planes meet
+    glm::vec3 direction = glm::abs(glm::cross(firstNormal, secondNormal));
+    int axis = 0;
+    if ( direction.y > direction.x )
+    {
+        axis = 1;
+    }
+    if ( direction.z > direction[axis] )
+    {
+        axis = 2;
+    }
+
+    float vp[3] = { first[0][axis], first[1][axis], first[2][axis] };
+    float up[3] = { second[0][axis], second[1][axis], second[2][axis] };
+
+    float firstStart, firstEnd, secondStart, secondEnd;
+    if ( !plane_interval(vp, dv, firstStart, firstEnd) || !plane_interval(up, du, secondStart, secondEnd) )
+    {
+        return coplanar_intersect(firstNormal, first, second);
+    }
+
+    return !(firstEnd < secondStart || secondEnd < firstStart);
+}
+
+void load_batch(TriangleBatch& batch, const glm::vec3* vertices, int count)
+{
+    batch.count = count;
+    for ( int lane = 0; lane < kTriangleBatchWidth; ++lane )
+    {
+        const glm::vec3* tr = vertices + 3 * std::min(lane, count - 1);
+        for ( int v = 0; v < 3; ++v )
+        {
+            batch.x[v][lane] = tr[v].x;
+            batch.y[v][lane] = tr[v].y;
+            batch.z[v][lane] = tr[v].z;
+        }
+
+        // exactly the arithmetic of triangles_intersect, so that both reject the same pairs
+        glm::vec3 normal = glm::cross(tr[1] - tr[0], tr[2] - tr[0]);
+        batch.normal_x[lane] = normal.x;
+        batch.normal_y[lane] = normal.y;
+        batch.normal_z[lane] = normal.z;
+        batch.offset[lane] = -glm::dot(normal, tr[0]);
+    }
+}
+
+uint32_t triangles_intersect(const glm::vec3* first, const TriangleBatch& batch)
+{
+    constexpr int W = kTriangleBatchWidth;
+
+    glm::vec3 firstNormal = glm::cross(first[1] - first[0], first[2] - first[0]);
+    float firstOffset = -glm::dot(firstNormal, first[0]);
+
+    // side of the first triangle's plane every batch vertex is on
+    float du[3][W];
+    for ( int v = 0; v < 3; ++v )
+    {
+        for ( int lane = 0; lane < W; ++lane )
+        {
+            du[v][lane] = snap_to_plane(firstNormal.x * batch.x[v][lane] + firstNormal.y * batch.y[v][lane] +
+                                        firstNormal.z * batch.z[v][lane] + firstOffset);
+        }
+    }
+
+    // side of every batch triangle's plane the vertices of the first triangle are on
+    float dv[3][W];
+    for ( int v = 0; v < 3; ++v )
+    {
+        for ( int lane = 0; lane < W; ++lane )
+        {
+            dv[v][lane] = snap_to_plane(batch.normal_x[lane] * first[v].x + batch.normal_y[lane] * first[v].y +
+                                        batch.normal_z[lane] * first[v].z + batch.offset[lane]);
+        }
+    }
+
+    uint32_t candidates = 0;
+    for ( int lane = 0; lane < W; ++lane )
+    {
+        bool rejected = one_side(du[0][lane], du[1][lane], du[2][lane]) ||
+                        one_side(dv[0][lane], dv[1][lane], dv[2][lane]);
+        candidates |= static_cast<uint32_t>(!rejected) << lane;
+    }
+    candidates &= (1u << batch.count) - 1;
+    if ( candidates == 0 )
+    {
+        return 0;
+    }
+
+    // dominant axis of the line where the planes meet, and the projections of both triangles onto it
+    float vp[3][W];
+    float up[3][W];
+    for ( int lane = 0; lane < W; ++lane )
+    {
+        float dx = std::abs(firstNormal.y * batch.normal_z[lane] - batch.normal_y[lane] * firstNormal.z);
+        float dy = std::abs(firstNormal.z * batch.normal_x[lane] - batch.normal_z[lane] * firstNormal.x);
+        float dz = std::abs(firstNormal.x * batch.normal_y[lane] - batch.normal_x[lane] * firstNormal.y);
+        bool useY = dy > dx;
+        bool useZ = dz > (useY ? dy : dx);
+        for ( int v = 0; v < 3; ++v )
+        {
+            vp[v][lane] = useZ ? first[v].z : (useY ? first[v].y : first[v].x);
+            up[v][lane] = useZ ? batch.z[v][lane] : (useY ? batch.y[v][lane] : batch.x[v][lane]);
+        }
+    }
+
+    uint32_t hits = 0;
+    for ( int lane = 0; lane < batch.count; ++lane )
+    {
+        if ( !(candidates & (1u << lane)) )
+        {
+            continue;
+        }
+
+        float firstProjection[3] = { vp[0][lane], vp[1][lane], vp[2][lane] };
+        float secondProjection[3] = { up[0][lane], up[1][lane], up[2][lane] };
+        float firstDistance[3] = { dv[0][lane], dv[1][lane], dv[2][lane] };
+        float secondDistance[3] = { du[0][lane], du[1][lane], du[2][lane] };
+
+        bool hit;
+        float firstStart, firstEnd, secondStart, secondEnd;
+        if ( plane_interval(firstProjection, firstDistance, firstStart, firstEnd) &&
+             plane_interval(secondProjection, secondDistance, secondStart, secondEnd) )
+        {
+            hit = !(firstEnd < secondStart || secondEnd < firstStart);
+        }
+        else
+        {
+            glm::vec3 second[3];
+            for ( int v = 0; v < 3; ++v )
+            {
+                second[v] = glm::vec3(batch.x[v][lane], batch.y[v][lane], batch.z[v][lane]);
+            }
+            hit = coplanar_intersect(firstNormal, first, second);
+        }
+        hits |= static_cast<uint32_t>(hit) << lane;
+    }
+    return hits;
+}
+
+bool ray_triangle_intersection(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3* triangle,
+                               float t_min, float t_max, float& t, float& u, float& v)
+{
+    glm::vec3 edge1 = triangle[1] - triangle[0];
+    glm::vec3 edge2 = triangle[2] - triangle[0];
+    glm::vec3 h = glm::cross(direction, edge2);
+    float determinant = glm::dot(edge1, h);
+    if ( std::abs(determinant) < 1e-12f )
+    {
+        // parallel to the plane of the triangle
+        return false;
+    }
+
+    float inverse = 1.0f / determinant;
+    glm::vec3 s = origin - triangle[0];
+    u = glm::dot(s, h) * inverse;
+    if ( u < 0.0f || u > 1.0f )
+    {
+        return false;
+    }
+    glm::vec3 qv = glm::cross(s, edge1);
+    v = glm::dot(direction, qv) * inverse;
+    if ( v < 0.0f || u + v > 1.0f )
+    {
+        return false;
+    }
+    t = glm::dot(edge2, qv) * inverse;
+    return t_min <= t && t <= t_max;
+}
+
+float triangle_distance(const glm::vec3* first, const glm::vec3* second, glm::vec3* first_point,
+                        glm::vec3* second_point)
+{
+    glm::vec3 bestFirst = first[0];
+    glm::vec3 bestSecond = second[0];
+    float best = std::numeric_limits<float>::max();
+
+    auto consider = [&](const glm::vec3& a, const glm::vec3& b) {
+        float distance = glm::dot(a - b, a - b);
+        if ( distance < best )
+        {
+            best = distance;
+            bestFirst = a;
+            bestSecond = b;
+        }
+    };
+
+    // intersecting triangles always have an edge of one crossing the other, unless they are coplanar, in which case
+    // the edge and vertex distances below reach 0
+    glm::vec3 crossing;
+    for ( int i = 0; i < 3; ++i )
+    {
+        if ( segment_crosses_triangle(first[i], first[(i + 1) % 3], second, crossing) ||
+             segment_crosses_triangle(second[i], second[(i + 1) % 3], first, crossing) )
+        {
+            bestFirst = crossing;
+            bestSecond = crossing;
+            best = 0.0f;
+            break;
+        }
+    }
+
+    if ( best > 0.0f )
+    {
+        for ( int i = 0; i < 3; ++i )
+        {
+            consider(first[i], closest_point_on_triangle(first[i], second[0], second[1], second[2]));
+            consider(closest_point_on_triangle(second[i], first[0], first[1], first[2]), second[i]);
+
+            for ( int j = 0; j < 3; ++j )
+            {
+                glm::vec3 a, b;
+                closest_points_of_segments(first[i], first[(i + 1) % 3], second[j], second[(j + 1) % 3], a, b);
+                consider(a, b);
+            }
+        }
+    }
+
+    if ( first_point != nullptr )
+    {
+        *first_point = bestFirst;
+    }
+    if ( second_point != nullptr )
+    {
+        *second_point = bestSecond;
+    }
+    return std::sqrt(best);
+}
+
+} // namespace bvh
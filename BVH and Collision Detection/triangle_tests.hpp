@@ -0,0 +1,99 @@
+// ################################################################################
+// Common Framework for Computer Graphics Courses at FI MUNI.
+//
+// Copyright (c) 2021-2022 Visitlab (https://visitlab.fi.muni.cz)
+// All rights reserved.
+// ################################################################################
+
+#pragma once
+
+#include "application.hpp"
+
+#include <cstdint>
+
+namespace bvh {
+
+/**
+ * Triangle-triangle intersection test on vertices that are already in a common space (Möller, "A Fast
+ * Triangle-Triangle Intersection Test"). Unlike triangle_triangle_intersection it transforms nothing, so the callers
+ * can transform every triangle once instead of once per tested pair. Coplanar triangles are handled as well.
+ *
+ * @param 	first 	The three vertices of the first triangle.
+ * @param 	second	The three vertices of the second triangle.
+ * @return	Whether the triangles intersect (touching triangles do).
+ */
+bool triangles_intersect(const glm::vec3* first, const glm::vec3* second);
+
+/** Number of triangles in a TriangleBatch. */
+constexpr int kTriangleBatchWidth = 8;
+
+/**
+ * Up to kTriangleBatchWidth triangles in structure of arrays layout, together with their planes. Unused lanes hold
+ * copies of the last triangle and are masked out by count.
+ */
+struct TriangleBatch
+{
+    float x[3][kTriangleBatchWidth];
+    float y[3][kTriangleBatchWidth];
+    float z[3][kTriangleBatchWidth];
+    // plane of each triangle, normal . p + offset = 0
+    float normal_x[kTriangleBatchWidth];
+    float normal_y[kTriangleBatchWidth];
+    float normal_z[kTriangleBatchWidth];
+    float offset[kTriangleBatchWidth];
+    int count = 0;
+};
+
+/**
+ * Fills a batch with the triangles starting at the given vertices.
+ *
+ * @param 	batch	 	The batch to fill.
+ * @param 	vertices 	Three vertices per triangle.
+ * @param 	count	 	The number of triangles, 1 to kTriangleBatchWidth.
+ */
+void load_batch(TriangleBatch& batch, const glm::vec3* vertices, int count);
+
+/**
+ * triangles_intersect of one triangle against every triangle of a batch. The plane distances of both triangles, the
+ * plane side rejection and the projections onto the line where the planes meet are done for all lanes at once, with
+ * fixed width loops over the SoA arrays that the compiler turns into SIMD code; the interval overlap of the surviving
+ * lanes reuses them, only coplanar pairs go through the 2D test. The result is the same as calling
+ * triangles_intersect for every lane.
+ *
+ * @param 	first	The three vertices of the single triangle.
+ * @param 	batch	The triangles it is tested against.
+ * @return	A mask with bit i set if the triangle intersects lane i of the batch.
+ */
+uint32_t triangles_intersect(const glm::vec3* first, const TriangleBatch& batch);
+
+/**
+ * Ray-triangle intersection (Möller and Trumbore, "Fast, Minimum Storage Ray/Triangle Intersection"). Rays parallel
+ * to the plane of the triangle miss it.
+ *
+ * @param 	origin   	The origin of the ray.
+ * @param 	direction	The direction of the ray, not necessarily normalized.
+ * @param 	triangle 	The three vertices of the triangle.
+ * @param 	t_min    	The start of the tested interval, in units of direction.
+ * @param 	t_max    	The end of the tested interval.
+ * @param 	t        	Receives the ray parameter of the hit (origin + t * direction).
+ * @param 	u        	Receives the barycentric coordinate of the hit belonging to the second vertex.
+ * @param 	v        	Receives the barycentric coordinate of the hit belonging to the third vertex.
+ * @return	Whether the ray hits the triangle within [t_min, t_max].
+ */
+bool ray_triangle_intersection(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3* triangle,
+                               float t_min, float t_max, float& t, float& u, float& v);
+
+/**
+ * Distance between two triangles in a common space, together with a closest pair of points. The distance is 0 if
+ * the triangles intersect, the points are then a common point of both.
+ *
+ * @param 	first       	The three vertices of the first triangle.
+ * @param 	second      	The three vertices of the second triangle.
+ * @param 	first_point 	Receives the closest point on the first triangle, if given.
+ * @param 	second_point	Receives the closest point on the second triangle, if given.
+ * @return	The distance.
+ */
+float triangle_distance(const glm::vec3* first, const glm::vec3* second, glm::vec3* first_point = nullptr,
+                        glm::vec3* second_point = nullptr);
+
+} // namespace bvh